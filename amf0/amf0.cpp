@@ -6,32 +6,11 @@
 
 #include "amf_core.h"
 #include "amf_errno.h"
+#include "amf0_simd.h"
+#include "amf0_stats.h"
+#include "amf0_trace.h"
 #include "simple_buffer.h"
 
-class AMF0_MARKER
-{
-public:
-    static const char AMF0_MARKER_NUMBER        = 0x00;
-    static const char AMF0_MARKER_BOOLEAN       = 0x01;
-    static const char AMF0_MARKER_STRING        = 0x02;
-    static const char AMF0_MARKER_OBJECT        = 0x03;
-    static const char AMF0_MARKER_MOVIECLIP     = 0x04; // reserved, not used
-    static const char AMF0_MARKER_NULL          = 0x05;
-    static const char AMF0_MARKER_UNDEFINED     = 0x06;
-    static const char AMF0_MARKER_REFERENCE     = 0x07;
-    static const char AMF0_MARKER_ECMA_ARRAY    = 0x08;
-    static const char AMF0_MARKER_OBJECT_END    = 0x09;
-    static const char AMF0_MARKER_STRICT_ARRAY  = 0x0A;
-    static const char AMF0_MARKER_DATE          = 0x0B;
-    static const char AMF0_MARKER_LONG_STRING   = 0x0C;
-    static const char AMF0_MARKER_UNSUPPORTED   = 0x0D;
-    static const char AMF0_MARKER_RECORDSET     = 0x0E; // reserved, not used
-    static const char AMF0_MARKER_XML_DOC       = 0x0F;
-    static const char AMF0_MARKER_TYPED_OBJECT  = 0x10;
-
-    static const char AMF0_MARKER_INVALID       = 0xff;
-};
-
 Amf0Data::Amf0Data()
 {
     marker = AMF0_MARKER::AMF0_MARKER_INVALID;
@@ -82,77 +61,286 @@ bool Amf0Data::is_ecma_array()
     return marker == AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY;
 }
 
-Amf0Data *Amf0Data::create_amf0data(SimpleBuffer *sb)
+void *Amf0Data::operator new(size_t size)
 {
-    if (!sb->require(1)) {
-        return nullptr;
+    return amf0_allocate(size);
+}
+
+void Amf0Data::operator delete(void *p)
+{
+    amf0_deallocate(p);
+}
+
+// shared_ptr control blocks come from the same allocator as the nodes
+static std::shared_ptr<Amf0Data> amf0_shared(Amf0Data *value)
+{
+    return std::shared_ptr<Amf0Data>(value, std::default_delete<Amf0Data>(), Amf0StlAllocator<Amf0Data>());
+}
+
+Amf0DecodeContext::Amf0DecodeContext()
+    : max_depth(64), max_nodes(0), max_bytes(0), validate_utf8(false)
+{
+    reset();
+}
+
+Amf0DecodeContext::~Amf0DecodeContext()
+{
+}
+
+void Amf0DecodeContext::reset()
+{
+    depth = 0;
+    nodes = 0;
+    bytes = 0;
+    error = ERROR_SUCCESS;
+    error_pos = -1;
+}
+
+int Amf0DecodeContext::fail(SimpleBuffer *sb, int code)
+{
+    if (error == ERROR_SUCCESS) {
+        error = code;
+        error_pos = sb->pos();
     }
 
-    int8_t m = sb->read_1byte();
-    sb->skip(-1);
+    return code;
+}
 
-    switch (m) {
-        case AMF0_MARKER::AMF0_MARKER_NUMBER: {
-            Amf0Number *value = new Amf0Number();
-            if (value->read(sb) != ERROR_SUCCESS) {
-                freep(value);
-                return nullptr;
+int Amf0DecodeContext::charge(SimpleBuffer *sb, int node_size, int payload)
+{
+    int64_t n = nodes + (node_size > 0 ? 1 : 0);
+    int64_t b = bytes + node_size + payload;
+
+    if (max_nodes > 0 && n > max_nodes) {
+        return fail(sb, ERROR_AMF0_NODES);
+    }
+
+    if (max_bytes > 0 && b > max_bytes) {
+        return fail(sb, ERROR_AMF0_BUDGET);
+    }
+
+    nodes = n;
+    bytes = b;
+
+    return ERROR_SUCCESS;
+}
+
+// deeper values are left to the decoder, which reports them properly
+#define AMF0_SCAN_MAX_DEPTH 64
+
+static inline uint32_t amf0_be16(const char *p)
+{
+    return ((uint8_t)p[0] << 8) | (uint8_t)p[1];
+}
+
+static inline uint32_t amf0_be32(const char *p)
+{
+    return ((uint32_t)(uint8_t)p[0] << 24) | ((uint8_t)p[1] << 16) | ((uint8_t)p[2] << 8) | (uint8_t)p[3];
+}
+
+static int amf0_scan(const char *p, int n, int depth)
+{
+    if (n < 1 || depth > AMF0_SCAN_MAX_DEPTH) {
+        return -1;
+    }
+
+    int pos = 1;
+    switch (p[0]) {
+        case AMF0_MARKER::AMF0_MARKER_NUMBER:
+            return n >= 9 ? 9 : -1;
+        case AMF0_MARKER::AMF0_MARKER_BOOLEAN:
+            return n >= 2 ? 2 : -1;
+        case AMF0_MARKER::AMF0_MARKER_NULL:
+        case AMF0_MARKER::AMF0_MARKER_UNDEFINED:
+            return 1;
+        case AMF0_MARKER::AMF0_MARKER_STRING:
+            if (n < 3) {
+                return -1;
             }
-            return value;
-        }
-        case AMF0_MARKER::AMF0_MARKER_BOOLEAN: {
-            Amf0Boolean *value = new Amf0Boolean();
-            if (value->read(sb) != ERROR_SUCCESS) {
-                freep(value);
-                return nullptr;
+            pos = 3 + amf0_be16(p + 1);
+            return pos <= n ? pos : -1;
+        case AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY:
+            pos += 4;
+            // fall through, the count is followed by properties
+        case AMF0_MARKER::AMF0_MARKER_OBJECT:
+            while (true) {
+                if (pos + 3 > n) {
+                    return -1;
+                }
+                int len = amf0_be16(p + pos);
+                if (len == 0) {
+                    return p[pos + 2] == AMF0_MARKER::AMF0_MARKER_OBJECT_END ? pos + 3 : -1;
+                }
+                pos += 2 + len;
+                int size = amf0_scan(p + pos, n - pos, depth + 1);
+                if (size < 0) {
+                    return -1;
+                }
+                pos += size;
             }
-            return value;
-        }
-        case AMF0_MARKER::AMF0_MARKER_STRING: {
-            Amf0String *value = new Amf0String();
-            if (value->read(sb) != ERROR_SUCCESS) {
-                freep(value);
-                return nullptr;
+        case AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY: {
+            if (n < 5) {
+                return -1;
             }
-            return value;
-        }
-        case AMF0_MARKER::AMF0_MARKER_OBJECT: {
-            Amf0Object *value = new Amf0Object();
-            if (value->read(sb) != ERROR_SUCCESS) {
-                freep(value);
-                return nullptr;
+            uint32_t count = amf0_be32(p + 1);
+            pos = 5;
+            for (uint32_t i = 0; i < count; ++i) {
+                int size = amf0_scan(p + pos, n - pos, depth + 1);
+                if (size < 0) {
+                    return -1;
+                }
+                pos += size;
             }
-            return value;
+            return pos;
         }
-        case AMF0_MARKER::AMF0_MARKER_NULL: {
-            Amf0Null *value = new Amf0Null();
-            if (value->read(sb) != ERROR_SUCCESS) {
-                freep(value);
-                return nullptr;
-            }
-            return value;
+        default:
+            return -1;
+    }
+}
+
+int amf0_value_size(const char *data, int size)
+{
+    return amf0_scan(data, size, 0);
+}
+
+int amf0_encode(Amf0Data *value, char *data, int capacity)
+{
+    FixedSimpleBuffer sb(data, capacity);
+    value->write(&sb);
+    return sb.size();
+}
+
+// what a node of marker m costs before it is allocated
+static int amf0_node_size(char m)
+{
+    switch (m) {
+        case AMF0_MARKER::AMF0_MARKER_NUMBER:
+            return sizeof(Amf0Number);
+        case AMF0_MARKER::AMF0_MARKER_BOOLEAN:
+            return sizeof(Amf0Boolean);
+        case AMF0_MARKER::AMF0_MARKER_STRING:
+            return sizeof(Amf0String);
+        case AMF0_MARKER::AMF0_MARKER_OBJECT:
+            return sizeof(Amf0Object) + sizeof(Amf0ObjectEnd);
+        case AMF0_MARKER::AMF0_MARKER_NULL:
+            return sizeof(Amf0Null);
+        case AMF0_MARKER::AMF0_MARKER_UNDEFINED:
+            return sizeof(Amf0Undefined);
+        case AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY:
+            return sizeof(Amf0EcmaArray) + sizeof(Amf0ObjectEnd);
+        case AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY:
+            return sizeof(Amf0StrictArray);
+        default:
+            return 0;
+    }
+}
+
+int Amf0Data::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    return read(sb);
+}
+
+Amf0Data *Amf0Data::create_amf0data(SimpleBuffer *sb)
+{
+    return create_amf0data(sb, nullptr);
+}
+
+Amf0Data *Amf0Data::create_amf0data(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    // untrusted nesting must not run the stack out either way
+    if (!ctx) {
+        Amf0DecodeContext limits;
+        return create_amf0data(sb, &limits);
+    }
+
+    // a new message, nothing decoded before counts against it
+    if (ctx->depth == 0) {
+        ctx->reset();
+    }
+
+    AMF0_TRACE_SPAN("create_amf0data");
+    if (!sb->require(1)) {
+        AMF0_STATS_FAILURE(ERROR_AMF0_DECODE, sb->pos());
+        return nullptr;
+    }
+
+    AMF0_STATS_DECODE_BEGIN(sb);
+
+    int8_t m = sb->peek_1byte();
+    int ret = ERROR_AMF0_DECODE;
+    bool container = (m == AMF0_MARKER::AMF0_MARKER_OBJECT || m == AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY
+        || m == AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY);
+
+    // strings are paid for with their length, known from the header
+    int payload = 0;
+    if (m == AMF0_MARKER::AMF0_MARKER_STRING && sb->require(3)) {
+        payload = (uint8_t)sb->data()[sb->pos() + 1] << 8 | (uint8_t)sb->data()[sb->pos() + 2];
+    }
+
+    if (container && ctx->max_depth > 0 && ctx->depth >= ctx->max_depth) {
+        ret = ctx->fail(sb, ERROR_AMF0_DEPTH);
+    } else if (amf0_node_size(m) > 0) {
+        ret = ctx->charge(sb, amf0_node_size(m), payload);
+    }
+
+    Amf0Data *value = nullptr;
+    if (ret == ERROR_SUCCESS) {
+        switch (m) {
+            case AMF0_MARKER::AMF0_MARKER_NUMBER:
+                value = new Amf0Number();
+                break;
+            case AMF0_MARKER::AMF0_MARKER_BOOLEAN:
+                value = new Amf0Boolean();
+                break;
+            case AMF0_MARKER::AMF0_MARKER_STRING:
+                value = new Amf0String();
+                break;
+            case AMF0_MARKER::AMF0_MARKER_OBJECT:
+                value = new Amf0Object();
+                break;
+            case AMF0_MARKER::AMF0_MARKER_NULL:
+                value = new Amf0Null();
+                break;
+            case AMF0_MARKER::AMF0_MARKER_UNDEFINED:
+                value = new Amf0Undefined();
+                break;
+            case AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY:
+                value = new Amf0EcmaArray();
+                break;
+            case AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY:
+                value = new Amf0StrictArray();
+                break;
+            default:
+                ret = ERROR_AMF0_DECODE;
+                break;
         }
-        case AMF0_MARKER::AMF0_MARKER_UNDEFINED: {
-            Amf0Undefined *value = new Amf0Undefined();
-            if (value->read(sb) != ERROR_SUCCESS) {
-                freep(value);
-                return nullptr;
-            }
-            return value;
+    }
+
+    if (value) {
+        AMF0_STATS_NODE();
+
+        if (container) {
+            ctx->depth++;
         }
-        case AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY: {
-            Amf0EcmaArray *value = new Amf0EcmaArray();
-            if (value->read(sb) != ERROR_SUCCESS) {
-                freep(value);
-                return nullptr;
-            }
-            return value;
+        ret = value->decode(sb, ctx);
+        if (container) {
+            ctx->depth--;
+        }
+
+        if (ret != ERROR_SUCCESS) {
+            freep(value);
         }
-        default:
-            break;
     }
 
-    return nullptr;
+    if (value) {
+        AMF0_STATS_DECODED(m);
+    } else {
+        AMF0_STATS_FAILURE(ret, sb->pos());
+    }
+
+    AMF0_STATS_DECODE_END(sb);
+
+    return value;
 }
 
 Amf0Number::Amf0Number()
@@ -173,9 +361,11 @@ Amf0Number::~Amf0Number()
 
 int Amf0Number::read(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Number::read");
     int ret = ERROR_SUCCESS;
 
-    if (!sb->require(1)) {
+    // marker and value in one check
+    if (!sb->require(9)) {
         ret = ERROR_AMF0_DECODE;
         return ret;
     }
@@ -186,11 +376,6 @@ int Amf0Number::read(SimpleBuffer *sb)
         return ret;
     }
 
-    if (!sb->require(8)) {
-        ret = ERROR_AMF0_DECODE;
-        return ret;
-    }
-
     int64_t temp = sb->read_8bytes();
     memcpy(&value, &temp, 8);
 
@@ -199,15 +384,26 @@ int Amf0Number::read(SimpleBuffer *sb)
 
 int Amf0Number::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Number::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
     sb->write_1byte(marker);
 
     int64_t temp = 0x00;
     memcpy(&temp, &value, 8);
     sb->write_8bytes(temp);
 
+    AMF0_STATS_ENCODE_END(sb);
+
     return 0;
 }
 
+Amf0Data *Amf0Number::clone()
+{
+    return new Amf0Number(value);
+}
+
 Amf0Boolean::Amf0Boolean()
 {
     marker = AMF0_MARKER::AMF0_MARKER_BOOLEAN;
@@ -226,9 +422,10 @@ Amf0Boolean::~Amf0Boolean()
 
 int Amf0Boolean::read(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Boolean::read");
     int ret = ERROR_SUCCESS;
 
-    if (!sb->require(1)) {
+    if (!sb->require(2)) {
         ret = ERROR_AMF0_DECODE;
         return ret;
     }
@@ -239,11 +436,6 @@ int Amf0Boolean::read(SimpleBuffer *sb)
         return ret;
     }
 
-    if (!sb->require(1)) {
-        ret = ERROR_AMF0_DECODE;
-        return ret;
-    }
-
     value = (sb->read_1byte() != 0);
 
     return ret;
@@ -251,12 +443,23 @@ int Amf0Boolean::read(SimpleBuffer *sb)
 
 int Amf0Boolean::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Boolean::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
     sb->write_1byte(marker);
     sb->write_1byte(value ? 0x01 : 0x00);
 
+    AMF0_STATS_ENCODE_END(sb);
+
     return 0;
 }
 
+Amf0Data *Amf0Boolean::clone()
+{
+    return new Amf0Boolean(value);
+}
+
 Amf0String::Amf0String()
 {
     marker = AMF0_MARKER::AMF0_MARKER_STRING;
@@ -275,9 +478,16 @@ Amf0String::~Amf0String()
 
 int Amf0String::read(SimpleBuffer *sb)
 {
+    return decode(sb, nullptr);
+}
+
+int Amf0String::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    AMF0_TRACE_SPAN("Amf0String::read");
     int ret = ERROR_SUCCESS;
 
-    if (!sb->require(1)) {
+    // marker and length in one check
+    if (!sb->require(3)) {
         ret = ERROR_AMF0_DECODE;
         return ret;
     }
@@ -288,31 +498,118 @@ int Amf0String::read(SimpleBuffer *sb)
         return ret;
     }
 
-    if (!sb->require(2)) {
+    uint16_t len = sb->read_2bytes();
+    if (!sb->require(len)) {
         ret = ERROR_AMF0_DECODE;
         return ret;
     }
 
-    int16_t len = sb->read_2bytes();
-    if (!sb->require(len)) {
-        ret = ERROR_AMF0_DECODE;
+    if (ctx && ctx->validate_utf8 && !amf0_utf8_valid(sb->data() + sb->pos(), len)) {
+        ret = ctx->fail(sb, ERROR_AMF0_UTF8);
         return ret;
     }
 
     value = sb->read_string(len);
+    AMF0_STATS_STRING();
 
     return ret;
 }
 
 int Amf0String::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0String::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
     sb->write_1byte(marker);
     sb->write_2bytes(value.length());
     sb->write_string(value);
 
+    AMF0_STATS_ENCODE_END(sb);
+
     return 0;
 }
 
+Amf0Data *Amf0String::clone()
+{
+    return new Amf0String(value);
+}
+
+// a container decoded on its own, not through create_amf0data(), is a
+// message of its own and holds its children one level down itself
+class Amf0DecodeEntry
+{
+public:
+    Amf0DecodeEntry(Amf0DecodeContext *ctx)
+        : ctx((ctx && ctx->depth == 0) ? ctx : nullptr)
+    {
+        if (this->ctx) {
+            this->ctx->reset();
+            this->ctx->depth++;
+        }
+    }
+    ~Amf0DecodeEntry()
+    {
+        if (ctx) {
+            ctx->depth--;
+        }
+    }
+
+private:
+    Amf0DecodeContext *ctx;
+};
+
+// key/value pairs of an object or ECMA array, up to the object end
+static int amf0_read_properties(SimpleBuffer *sb, Amf0ObjectProperty &property, Amf0DecodeContext *ctx)
+{
+    int ret = ERROR_SUCCESS;
+
+    while (!sb->empty()) {
+        // key length and the marker that follows, either the value's
+        // or the object end
+        if (!sb->require(3)) {
+            ret = ERROR_AMF0_DECODE;
+            return ret;
+        }
+
+        uint16_t len = sb->read_2bytes();
+        if (len == 0) {
+            if (AMF0_MARKER::AMF0_MARKER_OBJECT_END != sb->read_1byte()) {
+                ret = ERROR_AMF0_DECODE;
+                return ret;
+            }
+
+            return ret;
+        }
+
+        if (!sb->require(len + 1)) {
+            ret = ERROR_AMF0_DECODE;
+            return ret;
+        }
+
+        if (ctx && ctx->validate_utf8 && !amf0_utf8_valid(sb->data() + sb->pos(), len)) {
+            ret = ctx->fail(sb, ERROR_AMF0_UTF8);
+            return ret;
+        }
+
+        if (ctx && (ret = ctx->charge(sb, 0, len)) != ERROR_SUCCESS) {
+            return ret;
+        }
+
+        std::string property_name = sb->read_string(len);
+        AMF0_STATS_STRING();
+
+        Amf0Data *value = Amf0Data::create_amf0data(sb, ctx);
+        if (!value) {
+            ret = (ctx && ctx->error != ERROR_SUCCESS) ? ctx->error : ERROR_AMF0_DECODE;
+            return ret;
+        }
+        property.put(property_name, value);
+    }
+
+    return ret;
+}
+
 Amf0ObjectProperty::Amf0ObjectProperty()
 {
 
@@ -325,21 +622,22 @@ Amf0ObjectProperty::~Amf0ObjectProperty()
 
 void Amf0ObjectProperty::put(std::string key, Amf0Data *value)
 {
-    auto it = std::find_if(properties.begin(), properties.end(), [key](const Property &p) {
-        return p.first == key;
+    AMF0_TRACE_SPAN("Amf0ObjectProperty::put");
+    auto it = std::find_if(properties.begin(), properties.end(), [&key](const Property &p) {
+        return p.first.size() == key.size() && amf0_key_equal(p.first.data(), key.data(), key.size());
     });
 
     if (it != properties.end())
         properties.erase(it);
 
-    properties.push_back(std::make_pair(key, std::shared_ptr<Amf0Data>(value)));
+    properties.push_back(std::make_pair(amf0_string(key.data(), key.size()), amf0_shared(value)));
 }
 
 std::string Amf0ObjectProperty::key_at(int index)
 {
     assert(index >= 0 && index < properties.size());
 
-    return properties[index].first;
+    return std::string(properties[index].first.data(), properties[index].first.size());
 }
 
 Amf0Data *Amf0ObjectProperty::value_at(int index)
@@ -351,16 +649,54 @@ Amf0Data *Amf0ObjectProperty::value_at(int index)
 
 Amf0Data *Amf0ObjectProperty::value_at(std::string key)
 {
-    auto it = std::find_if(properties.begin(), properties.end(), [key](const Property &p) {
-        return p.first == key;
-    });
+    const char *k = key.data();
+    size_t n = key.size();
 
-    if (it != properties.end())
-        return it->second.get();
+    // most keys differ in length, so the vector compare rarely runs
+    for (size_t i = 0; i < properties.size(); ++i) {
+        const amf0_string &name = properties[i].first;
+        if (name.size() == n && amf0_key_equal(name.data(), k, n))
+            return properties[i].second.get();
+    }
 
     return nullptr;
 }
 
+void Amf0ObjectProperty::write(SimpleBuffer *sb)
+{
+    // straight from the stored keys, encoding allocates nothing
+    for (size_t i = 0; i < properties.size(); ++i) {
+        const amf0_string &name = properties[i].first;
+
+        sb->write_2bytes(name.size());
+        sb->append(name.data(), name.size());
+        properties[i].second->write(sb);
+    }
+}
+
+Amf0Data *Amf0ObjectProperty::mutable_value_at(int index)
+{
+    assert(index >= 0 && index < (int)properties.size());
+
+    // shared with a clone or the tree it was cloned from
+    std::shared_ptr<Amf0Data> &value = properties[index].second;
+    if (value.use_count() > 1) {
+        value = amf0_shared(value->clone());
+    }
+    return value.get();
+}
+
+int Amf0ObjectProperty::index_of(std::string key)
+{
+    for (size_t i = 0; i < properties.size(); ++i) {
+        const amf0_string &name = properties[i].first;
+        if (name.size() == key.size() && amf0_key_equal(name.data(), key.data(), key.size()))
+            return i;
+    }
+
+    return -1;
+}
+
 int Amf0ObjectProperty::count()
 {
     return properties.size();
@@ -398,8 +734,20 @@ Amf0Data *Amf0Object::value_at(int index)
     return property.value_at(index);
 }
 
+int Amf0Object::count()
+{
+    return property.count();
+}
+
 int Amf0Object::read(SimpleBuffer *sb)
 {
+    return decode(sb, nullptr);
+}
+
+int Amf0Object::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    AMF0_TRACE_SPAN("Amf0Object::read");
+    Amf0DecodeEntry entry(ctx);
     int ret = ERROR_SUCCESS;
 
     if (!sb->require(1)) {
@@ -413,56 +761,42 @@ int Amf0Object::read(SimpleBuffer *sb)
         return ret;
     }
 
-    while (!sb->empty()) {
-        if (!sb->require(2)) {
-            ret = ERROR_AMF0_DECODE;
-            return ret;
-        }
+    return amf0_read_properties(sb, property, ctx);
+}
 
-        int16_t len = sb->read_2bytes();
-        if (!sb->require(len)) {
-            ret = ERROR_AMF0_DECODE;
-            return ret;
-        }
+int Amf0Object::write(SimpleBuffer *sb)
+{
+    AMF0_TRACE_SPAN("Amf0Object::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
 
-        // maybe object end
-        if (len == 0) {
-            if (!sb->require(1)) {
-                ret = ERROR_AMF0_DECODE;
-                return ret;
-            }
+    sb->write_1byte(marker);
 
-            if (AMF0_MARKER::AMF0_MARKER_OBJECT_END != sb->read_1byte()) {
-                ret = ERROR_AMF0_DECODE;
-                return ret;
-            }
+    property.write(sb);
 
-            return ret;
-        }
+    oe->write(sb);
 
-        std::string property_name = sb->read_string(len);
-        put(property_name, Amf0Data::create_amf0data(sb));
-    }
+    AMF0_STATS_ENCODE_END(sb);
 
-    return ret;
+    return 0;
 }
 
-int Amf0Object::write(SimpleBuffer *sb)
+Amf0Data *Amf0Object::clone()
 {
-    sb->write_1byte(marker);
-
-    for (int i = 0; i < property.count(); ++i) {
-        std::string name = key_at(i);
-        Amf0Data *data = value_at(i);
-
-        sb->write_2bytes(name.length());
-        sb->write_string(name);
-        data->write(sb);
-    }
+    Amf0Object *copy = new Amf0Object();
+    copy->property = property;
+    return copy;
+}
 
-    oe->write(sb);
+Amf0Data *Amf0Object::mutable_value_at(std::string key)
+{
+    int index = property.index_of(key);
+    return index < 0 ? nullptr : property.mutable_value_at(index);
+}
 
-    return 0;
+Amf0Data *Amf0Object::mutable_value_at(int index)
+{
+    return property.mutable_value_at(index);
 }
 
 Amf0ObjectEnd::Amf0ObjectEnd()
@@ -477,16 +811,23 @@ Amf0ObjectEnd::~Amf0ObjectEnd()
 
 int Amf0ObjectEnd::read(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0ObjectEnd::read");
     return 0;
 }
 
 int Amf0ObjectEnd::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0ObjectEnd::write");
     sb->write_2bytes(0x00);
     sb->write_1byte(marker);
     return 0;
 }
 
+Amf0Data *Amf0ObjectEnd::clone()
+{
+    return new Amf0ObjectEnd();
+}
+
 Amf0Null::Amf0Null()
 {
     marker = AMF0_MARKER::AMF0_MARKER_NULL;
@@ -499,6 +840,7 @@ Amf0Null::~Amf0Null()
 
 int Amf0Null::read(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Null::read");
     int ret = ERROR_SUCCESS;
 
     if (!sb->require(1)) {
@@ -517,10 +859,21 @@ int Amf0Null::read(SimpleBuffer *sb)
 
 int Amf0Null::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Null::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
     sb->write_1byte(marker);
+    AMF0_STATS_ENCODE_END(sb);
+
     return 0;
 }
 
+Amf0Data *Amf0Null::clone()
+{
+    return new Amf0Null();
+}
+
 Amf0Undefined::Amf0Undefined()
 {
     marker = AMF0_MARKER::AMF0_MARKER_UNDEFINED;
@@ -533,6 +886,7 @@ Amf0Undefined::~Amf0Undefined()
 
 int Amf0Undefined::read(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Undefined::read");
     int ret = ERROR_SUCCESS;
 
     if (!sb->require(1)) {
@@ -551,10 +905,21 @@ int Amf0Undefined::read(SimpleBuffer *sb)
 
 int Amf0Undefined::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0Undefined::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
     sb->write_1byte(marker);
+    AMF0_STATS_ENCODE_END(sb);
+
     return 0;
 }
 
+Amf0Data *Amf0Undefined::clone()
+{
+    return new Amf0Undefined();
+}
+
 Amf0EcmaArray::Amf0EcmaArray()
 {
     marker = AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY;
@@ -587,11 +952,24 @@ Amf0Data *Amf0EcmaArray::value_at(int index)
     return property.value_at(index);
 }
 
+int Amf0EcmaArray::count()
+{
+    return property.count();
+}
+
 int Amf0EcmaArray::read(SimpleBuffer *sb)
 {
+    return decode(sb, nullptr);
+}
+
+int Amf0EcmaArray::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    AMF0_TRACE_SPAN("Amf0EcmaArray::read");
+    Amf0DecodeEntry entry(ctx);
     int ret = ERROR_SUCCESS;
 
-    if (!sb->require(1)) {
+    // marker and count in one check
+    if (!sb->require(5)) {
         ret = ERROR_AMF0_DECODE;
         return ret;
     }
@@ -602,67 +980,49 @@ int Amf0EcmaArray::read(SimpleBuffer *sb)
         return ret;
     }
 
-    if (!sb->require(4)) {
-        ret = ERROR_AMF0_DECODE;
-        return ret;
-    }
-
-    int32_t count = sb->read_4bytes();
-    // just for compatibility
-    // for (int i = 0; i < count && !sb->empty(); i++) {
-    while (!sb->empty()) {
-        if (!sb->require(2)) {
-            ret = ERROR_AMF0_DECODE;
-            return ret;
-        }
-
-        int16_t len = sb->read_2bytes();
-        if (!sb->require(len)) {
-            ret = ERROR_AMF0_DECODE;
-            return ret;
-        }
-
-        // maybe object end
-        if (len == 0) {
-            if (!sb->require(1)) {
-                ret = ERROR_AMF0_DECODE;
-                return ret;
-            }
-
-            if (AMF0_MARKER::AMF0_MARKER_OBJECT_END != sb->read_1byte()) {
-                ret = ERROR_AMF0_DECODE;
-                return ret;
-            }
-
-            return ret;
-        }
-
-        std::string property_name = sb->read_string(len);
-        put(property_name, Amf0Data::create_amf0data(sb));
-    }
+    // the count is only a hint, just for compatibility the
+    // properties run up to the object end
+    sb->skip(4);
 
-    return ret;
+    return amf0_read_properties(sb, property, ctx);
 }
 
 int Amf0EcmaArray::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0EcmaArray::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
     sb->write_1byte(marker);
     sb->write_4bytes(property.count());
 
-    for (int i = 0; i < property.count(); ++i) {
-        std::string name = key_at(i);
-        Amf0Data *data = value_at(i);
-
-        sb->write_2bytes(name.length());
-        sb->write_string(name);
-        data->write(sb);
-    }
+    property.write(sb);
 
     oe->write(sb);
 
+    AMF0_STATS_ENCODE_END(sb);
+
     return 0;
 }
 
+Amf0Data *Amf0EcmaArray::clone()
+{
+    Amf0EcmaArray *copy = new Amf0EcmaArray();
+    copy->property = property;
+    return copy;
+}
+
+Amf0Data *Amf0EcmaArray::mutable_value_at(std::string key)
+{
+    int index = property.index_of(key);
+    return index < 0 ? nullptr : property.mutable_value_at(index);
+}
+
+Amf0Data *Amf0EcmaArray::mutable_value_at(int index)
+{
+    return property.mutable_value_at(index);
+}
+
 Amf0StrictArray::Amf0StrictArray()
 {
     marker = AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY;
@@ -675,7 +1035,7 @@ Amf0StrictArray::~Amf0StrictArray()
 
 void Amf0StrictArray::put(Amf0Data *value)
 {
-    properties.push_back(std::shared_ptr<Amf0Data>(value));
+    properties.push_back(amf0_shared(value));
 }
 
 Amf0Data *Amf0StrictArray::value_at(int index)
@@ -684,29 +1044,42 @@ Amf0Data *Amf0StrictArray::value_at(int index)
     return properties[index].get();
 }
 
+int Amf0StrictArray::count()
+{
+    return properties.size();
+}
+
 int Amf0StrictArray::read(SimpleBuffer *sb)
 {
+    return decode(sb, nullptr);
+}
+
+int Amf0StrictArray::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    AMF0_TRACE_SPAN("Amf0StrictArray::read");
+    Amf0DecodeEntry entry(ctx);
     int ret = ERROR_SUCCESS;
 
-    if (!sb->require(1)) {
+    if (!sb->require(5)) {
         ret = ERROR_AMF0_DECODE;
         return ret;
     }
 
     marker = sb->read_1byte();
-    if (marker != AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY) {
-        ret = ERROR_AMF0_DECODE;
-        return ret;
-    }
-
-    if (!sb->require(4)) {
+    if (marker != AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY) {
         ret = ERROR_AMF0_DECODE;
         return ret;
     }
 
+    // every element must be there, like amf0_value_size() requires
     int32_t count = sb->read_4bytes();
-    for (int i = 0; i < count && !sb->empty(); i++) {
-        properties.push_back(std::shared_ptr<Amf0Data>(Amf0Data::create_amf0data(sb)));
+    for (int i = 0; i < count; i++) {
+        Amf0Data *value = Amf0Data::create_amf0data(sb, ctx);
+        if (!value) {
+            ret = (ctx && ctx->error != ERROR_SUCCESS) ? ctx->error : ERROR_AMF0_DECODE;
+            return ret;
+        }
+        properties.push_back(amf0_shared(value));
     }
 
     return ret;
@@ -714,6 +1087,10 @@ int Amf0StrictArray::read(SimpleBuffer *sb)
 
 int Amf0StrictArray::write(SimpleBuffer *sb)
 {
+    AMF0_TRACE_SPAN("Amf0StrictArray::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
     sb->write_1byte(marker);
     sb->write_4bytes(properties.size());
     for (int i = 0; i < properties.size(); ++i) {
@@ -722,5 +1099,25 @@ int Amf0StrictArray::write(SimpleBuffer *sb)
         data->write(sb);
     }
 
+    AMF0_STATS_ENCODE_END(sb);
+
     return 0;
 }
+
+Amf0Data *Amf0StrictArray::clone()
+{
+    Amf0StrictArray *copy = new Amf0StrictArray();
+    copy->properties = properties;
+    return copy;
+}
+
+Amf0Data *Amf0StrictArray::mutable_value_at(int index)
+{
+    assert(index >= 0 && index < (int)properties.size());
+
+    std::shared_ptr<Amf0Data> &value = properties[index];
+    if (value.use_count() > 1) {
+        value = amf0_shared(value->clone());
+    }
+    return value.get();
+}
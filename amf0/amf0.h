@@ -4,10 +4,48 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <stdint.h>
+
+#include "amf0_allocator.h"
 
 class SimpleBuffer;
 class Amf0ObjectEnd;
 
+/**
+ * Limits for decoding untrusted input, one context can serve a connection.
+ * The limits are per message: every top level decode starts nodes, bytes
+ * and the error over, so they count the value being decoded and never what
+ * was decoded before. A limit is checked before the node or string it
+ * would pay for is allocated. Zero means unlimited.
+ */
+class Amf0DecodeContext
+{
+public:
+    Amf0DecodeContext();
+    virtual ~Amf0DecodeContext();
+
+public:
+    void reset();
+    // accounts one node of node_size plus payload bytes
+    int charge(SimpleBuffer *sb, int node_size, int payload);
+    int fail(SimpleBuffer *sb, int code);
+
+public:
+    int max_depth;
+    int64_t max_nodes;
+    int64_t max_bytes;
+    // strings and object keys must be valid UTF-8 to decode
+    bool validate_utf8;
+
+public:
+    int depth;
+    int64_t nodes;
+    int64_t bytes;
+    // first limit hit and the buffer position it happened at
+    int error;
+    int error_pos;
+};
+
 class Amf0Data
 {
 public:
@@ -17,6 +55,12 @@ public:
 public:
     virtual int read(SimpleBuffer *sb) = 0;
     virtual int write(SimpleBuffer *sb) = 0;
+    // read() under the limits of ctx, ctx may be nullptr
+    virtual int decode(SimpleBuffer *sb, Amf0DecodeContext *ctx);
+    // a copy sharing every child with this tree, only the list of children
+    // is copied. Change a clone through put() and mutable_value_at(), they
+    // copy a shared child first, so a variant costs the path it changes.
+    virtual Amf0Data *clone() = 0;
 
 public:
     bool is_number();
@@ -29,12 +73,28 @@ public:
     bool is_ecma_array();
 
 public:
+    // without a context the default one applies, it caps the depth only
     static Amf0Data *create_amf0data(SimpleBuffer *sb);
+    static Amf0Data *create_amf0data(SimpleBuffer *sb, Amf0DecodeContext *ctx);
+
+public:
+    // nodes come from Amf0Allocator::current()
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
 
 public:
     char marker;
 };
 
+// encoded size of the value at data without decoding it, -1 if it is
+// incomplete or holds a type create_amf0data() does not decode
+int amf0_value_size(const char *data, int size);
+
+// encodes value into [data, data + capacity) without allocating or growing,
+// returns the bytes written, or when that is more than capacity the size
+// it needs, nothing past capacity is touched
+int amf0_encode(Amf0Data *value, char *data, int capacity);
+
 class Amf0Number : public Amf0Data
 {
 public:
@@ -45,6 +105,7 @@ public:
 public:
     virtual int read(SimpleBuffer *sb);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 
 public:
     double value;
@@ -60,6 +121,7 @@ public:
 public:
     virtual int read(SimpleBuffer *sb);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 
 public:
     bool value;
@@ -74,7 +136,9 @@ public:
 
 public:
     virtual int read(SimpleBuffer *sb);
+    virtual int decode(SimpleBuffer *sb, Amf0DecodeContext *ctx);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 
 public:
     std::string value;
@@ -83,8 +147,8 @@ public:
 class Amf0ObjectProperty
 {
 private:
-    typedef std::pair<std::string, std::shared_ptr<Amf0Data>> Property;
-    std::vector<Property> properties;
+    typedef std::pair<amf0_string, std::shared_ptr<Amf0Data>> Property;
+    std::vector<Property, Amf0StlAllocator<Property>> properties;
 
 public:
     Amf0ObjectProperty();
@@ -95,7 +159,12 @@ public:
     std::string key_at(int index);
     Amf0Data *value_at(int index);
     Amf0Data *value_at(std::string key);
+    // the child at index, first copied if another tree shares it
+    Amf0Data *mutable_value_at(int index);
+    int index_of(std::string key);
     int count();
+    // every key and value, without the object end
+    void write(SimpleBuffer *sb);
 };
 
 class Amf0Object : public Amf0Data
@@ -109,10 +178,16 @@ public:
     std::string key_at(int index);
     Amf0Data *value_at(std::string key);
     Amf0Data *value_at(int index);
+    // copy on write access for clones, nullptr if the key is absent
+    Amf0Data *mutable_value_at(std::string key);
+    Amf0Data *mutable_value_at(int index);
+    int count();
 
 public:
     virtual int read(SimpleBuffer *sb);
+    virtual int decode(SimpleBuffer *sb, Amf0DecodeContext *ctx);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 
 private:
     Amf0ObjectProperty property;
@@ -128,6 +203,7 @@ public:
 public:
     virtual int read(SimpleBuffer *sb);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 };
 
 class Amf0Null : public Amf0Data
@@ -139,6 +215,7 @@ public:
 public:
     virtual int read(SimpleBuffer *sb);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 };
 
 class Amf0Undefined : public Amf0Data
@@ -150,6 +227,7 @@ public:
 public:
     virtual int read(SimpleBuffer *sb);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 };
 
 class Amf0EcmaArray : public Amf0Data
@@ -163,10 +241,16 @@ public:
     std::string key_at(int index);
     Amf0Data *value_at(std::string key);
     Amf0Data *value_at(int index);
+    // copy on write access for clones, nullptr if the key is absent
+    Amf0Data *mutable_value_at(std::string key);
+    Amf0Data *mutable_value_at(int index);
+    int count();
 
 public:
     virtual int read(SimpleBuffer *sb);
+    virtual int decode(SimpleBuffer *sb, Amf0DecodeContext *ctx);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 
 private:
     Amf0ObjectProperty property;
@@ -182,13 +266,17 @@ public:
 public:
     void put(Amf0Data *value);
     Amf0Data *value_at(int index);
+    Amf0Data *mutable_value_at(int index);
+    int count();
 
 public:
     virtual int read(SimpleBuffer *sb);
+    virtual int decode(SimpleBuffer *sb, Amf0DecodeContext *ctx);
     virtual int write(SimpleBuffer *sb);
+    virtual Amf0Data *clone();
 
 private:
-    std::vector<std::shared_ptr<Amf0Data>> properties;
+    std::vector<std::shared_ptr<Amf0Data>, Amf0StlAllocator<std::shared_ptr<Amf0Data>>> properties;
 };
 
 #endif /* __AMF_0_H__ */
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include "amf0_allocator.h"
+
+#include <assert.h>
+#include <new>
+#include <string.h>
+
+// keeps the payload 16 byte aligned
+#define AMF0_ALLOC_HEADER 16
+
+struct Amf0AllocHeader
+{
+    Amf0Allocator *allocator;
+    size_t size;
+};
+
+class Amf0NewAllocator : public Amf0Allocator
+{
+public:
+    virtual void *allocate(size_t size)
+    {
+        return ::operator new(size);
+    }
+
+    virtual void deallocate(void *p, size_t size)
+    {
+        ::operator delete(p);
+    }
+};
+
+static thread_local Amf0Allocator *amf0_current_allocator = nullptr;
+
+Amf0Allocator::Amf0Allocator()
+{
+}
+
+Amf0Allocator::~Amf0Allocator()
+{
+}
+
+Amf0Allocator *Amf0Allocator::default_allocator()
+{
+    static Amf0NewAllocator allocator;
+    return &allocator;
+}
+
+Amf0Allocator *Amf0Allocator::current()
+{
+    return amf0_current_allocator ? amf0_current_allocator : default_allocator();
+}
+
+Amf0AllocatorScope::Amf0AllocatorScope(Amf0Allocator *allocator)
+{
+    previous = amf0_current_allocator;
+    amf0_current_allocator = allocator;
+}
+
+Amf0AllocatorScope::~Amf0AllocatorScope()
+{
+    amf0_current_allocator = previous;
+}
+
+void *amf0_allocate(size_t size)
+{
+    Amf0Allocator *allocator = Amf0Allocator::current();
+
+    char *p = (char *)allocator->allocate(size + AMF0_ALLOC_HEADER);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+
+    Amf0AllocHeader *h = (Amf0AllocHeader *)p;
+    h->allocator = allocator;
+    h->size = size + AMF0_ALLOC_HEADER;
+
+    return p + AMF0_ALLOC_HEADER;
+}
+
+void amf0_deallocate(void *p)
+{
+    if (!p) {
+        return;
+    }
+
+    Amf0AllocHeader *h = (Amf0AllocHeader *)((char *)p - AMF0_ALLOC_HEADER);
+    h->allocator->deallocate(h, h->size);
+}
+
+Amf0CountingAllocator::Amf0CountingAllocator(Amf0Allocator *upstream)
+    : upstream(upstream ? upstream : Amf0Allocator::default_allocator()), allocs(0), frees(0), bytes(0), peak(0)
+{
+}
+
+Amf0CountingAllocator::~Amf0CountingAllocator()
+{
+}
+
+void *Amf0CountingAllocator::allocate(size_t size)
+{
+    void *p = upstream->allocate(size);
+
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    uint64_t now = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t old = peak.load(std::memory_order_relaxed);
+    while (now > old && !peak.compare_exchange_weak(old, now, std::memory_order_relaxed)) {
+    }
+
+    return p;
+}
+
+void Amf0CountingAllocator::deallocate(void *p, size_t size)
+{
+    frees.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_sub(size, std::memory_order_relaxed);
+
+    upstream->deallocate(p, size);
+}
+
+uint64_t Amf0CountingAllocator::allocations()
+{
+    return allocs.load(std::memory_order_relaxed);
+}
+
+uint64_t Amf0CountingAllocator::deallocations()
+{
+    return frees.load(std::memory_order_relaxed);
+}
+
+uint64_t Amf0CountingAllocator::live_allocations()
+{
+    return allocations() - deallocations();
+}
+
+uint64_t Amf0CountingAllocator::live_bytes()
+{
+    return bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t Amf0CountingAllocator::peak_bytes()
+{
+    return peak.load(std::memory_order_relaxed);
+}
+
+void Amf0CountingAllocator::reset()
+{
+    allocs.store(0);
+    frees.store(0);
+    peak.store(bytes.load());
+}
+
+Amf0PoolAllocator::Amf0PoolAllocator(Amf0Allocator *upstream, size_t block_size)
+    : upstream(upstream ? upstream : Amf0Allocator::default_allocator()),
+      block_size(block_size < max_small ? max_small : block_size),
+      cursor(nullptr), limit(nullptr), large_bytes(0)
+{
+    memset(free_lists, 0, sizeof(free_lists));
+}
+
+Amf0PoolAllocator::~Amf0PoolAllocator()
+{
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        upstream->deallocate(blocks[i], block_size);
+    }
+}
+
+void *Amf0PoolAllocator::allocate(size_t size)
+{
+    if (size > max_small) {
+        large_bytes += size;
+        return upstream->allocate(size);
+    }
+
+    size_t index = (size + granularity - 1) / granularity;
+    if (FreeBlock *b = free_lists[index]) {
+        free_lists[index] = b->next;
+        return b;
+    }
+
+    size_t rounded = index * granularity;
+    if (cursor + rounded > limit) {
+        cursor = (char *)upstream->allocate(block_size);
+        limit = cursor + block_size;
+        blocks.push_back(cursor);
+    }
+
+    void *p = cursor;
+    cursor += rounded;
+    return p;
+}
+
+void Amf0PoolAllocator::deallocate(void *p, size_t size)
+{
+    if (size > max_small) {
+        large_bytes -= size;
+        upstream->deallocate(p, size);
+        return;
+    }
+
+    size_t index = (size + granularity - 1) / granularity;
+    FreeBlock *b = (FreeBlock *)p;
+    b->next = free_lists[index];
+    free_lists[index] = b;
+}
+
+size_t Amf0PoolAllocator::retained()
+{
+    return blocks.size() * block_size + large_bytes;
+}
@@ -0,0 +1,151 @@
+#ifndef __AMF0_ALLOCATOR_H__
+#define __AMF0_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// source of every node, container and buffer allocation of the library
+class Amf0Allocator
+{
+public:
+    Amf0Allocator();
+    virtual ~Amf0Allocator();
+
+public:
+    virtual void *allocate(size_t size) = 0;
+    virtual void deallocate(void *p, size_t size) = 0;
+
+public:
+    // global operator new/delete
+    static Amf0Allocator *default_allocator();
+    // the allocator new memory of the calling thread comes from
+    static Amf0Allocator *current();
+};
+
+// routes the allocations of the calling thread to allocator while alive,
+// e.g. one per connection around its decode and encode calls
+class Amf0AllocatorScope
+{
+public:
+    Amf0AllocatorScope(Amf0Allocator *allocator);
+    virtual ~Amf0AllocatorScope();
+
+private:
+    Amf0Allocator *previous;
+};
+
+// allocates from Amf0Allocator::current() and remembers the allocator in a
+// small header, so the block can be freed on any thread in any scope
+void *amf0_allocate(size_t size);
+void amf0_deallocate(void *p);
+
+// stateless std allocator on top of amf0_allocate
+template <class T>
+class Amf0StlAllocator
+{
+public:
+    typedef T value_type;
+
+    Amf0StlAllocator() {}
+    template <class U> Amf0StlAllocator(const Amf0StlAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        return (T *)amf0_allocate(n * sizeof(T));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        amf0_deallocate(p);
+    }
+
+    template <class U> struct rebind { typedef Amf0StlAllocator<U> other; };
+};
+
+template <class T, class U>
+inline bool operator==(const Amf0StlAllocator<T> &, const Amf0StlAllocator<U> &)
+{
+    return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const Amf0StlAllocator<T> &, const Amf0StlAllocator<U> &)
+{
+    return false;
+}
+
+typedef std::basic_string<char, std::char_traits<char>, Amf0StlAllocator<char>> amf0_string;
+
+// counts what passes through to upstream, thread safe
+class Amf0CountingAllocator : public Amf0Allocator
+{
+public:
+    Amf0CountingAllocator(Amf0Allocator *upstream = nullptr);
+    virtual ~Amf0CountingAllocator();
+
+public:
+    virtual void *allocate(size_t size);
+    virtual void deallocate(void *p, size_t size);
+
+public:
+    uint64_t allocations();
+    uint64_t deallocations();
+    uint64_t live_allocations();
+    uint64_t live_bytes();
+    uint64_t peak_bytes();
+    void reset();
+
+private:
+    Amf0Allocator *upstream;
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> peak;
+};
+
+// size class pool for one connection: small blocks are recycled through
+// free lists carved out of large upstream blocks, everything goes back to
+// upstream when the pool is destroyed.
+//
+// not thread safe. amf0_deallocate() returns a block to the pool it came
+// from on whatever thread frees it, so a value built in a pool must be
+// destroyed, like it was created, on the thread that owns the pool, and
+// must not outlive it. values that cross threads need a thread safe
+// allocator, or the pool behind a lock.
+class Amf0PoolAllocator : public Amf0Allocator
+{
+public:
+    // block_size below the largest pooled size is raised to it
+    Amf0PoolAllocator(Amf0Allocator *upstream = nullptr, size_t block_size = 64 * 1024);
+    virtual ~Amf0PoolAllocator();
+
+public:
+    virtual void *allocate(size_t size);
+    virtual void deallocate(void *p, size_t size);
+
+public:
+    // bytes currently held from upstream
+    size_t retained();
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    static const size_t granularity = 16;
+    static const size_t max_small = 512;
+
+    Amf0Allocator *upstream;
+    size_t block_size;
+    std::vector<void *> blocks;
+    FreeBlock *free_lists[max_small / granularity + 1];
+    char *cursor;
+    char *limit;
+    size_t large_bytes;
+};
+
+#endif /* __AMF0_ALLOCATOR_H__ */
@@ -0,0 +1,308 @@
+#include "amf0_batch.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0.h"
+#include "amf0_allocator.h"
+#include "simple_buffer.h"
+
+// slices handed out per steal, keeps lock traffic low for tiny messages
+#define AMF0_BATCH_MIN_GRAIN 16
+
+// the pool one worker decodes from. Only that worker allocates, but the
+// values are freed by whoever drops them, so every call takes the lock,
+// which the worker alone finds uncontended.
+class Amf0BatchArena : public Amf0Allocator
+{
+public:
+    Amf0BatchArena(Amf0Allocator *upstream) : pool(upstream), live(0), orphaned(false) {}
+    virtual ~Amf0BatchArena() {}
+
+public:
+    virtual void *allocate(size_t size)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        void *p = pool.allocate(size);
+        live++;
+        return p;
+    }
+
+    virtual void deallocate(void *p, size_t size)
+    {
+        bool last = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pool.deallocate(p, size);
+            last = --live == 0 && orphaned;
+        }
+
+        if (last) {
+            delete this;
+        }
+    }
+
+    // the codec is gone, the arena follows the last value decoded from it
+    void orphan()
+    {
+        bool last = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            orphaned = true;
+            last = live == 0;
+        }
+
+        if (last) {
+            delete this;
+        }
+    }
+
+private:
+    std::mutex mutex;
+    Amf0PoolAllocator pool;
+    int64_t live;
+    bool orphaned;
+};
+
+class Amf0BatchWorker
+{
+public:
+    Amf0BatchWorker(Amf0Allocator *upstream) : head(0), tail(0), arena(new Amf0BatchArena(upstream)) {}
+    ~Amf0BatchWorker()
+    {
+        arena->orphan();
+    }
+
+public:
+    // chunks [head, tail) not yet taken, owner pops head, thieves pop tail
+    std::mutex mutex;
+    int head;
+    int tail;
+
+    // reused for every message encoded by this worker, keeps its capacity
+    SimpleBuffer scratch;
+    // every value this worker decodes comes from here
+    Amf0BatchArena *arena;
+};
+
+Amf0BatchItem::Amf0BatchItem()
+    : ret(ERROR_SUCCESS)
+{
+}
+
+Amf0BatchItem::Amf0BatchItem(Amf0BatchItem &&other)
+    : ret(other.ret), values(std::move(other.values))
+{
+    other.values.clear();
+}
+
+Amf0BatchItem::~Amf0BatchItem()
+{
+    clear();
+}
+
+void Amf0BatchItem::clear()
+{
+    for (size_t i = 0; i < values.size(); ++i) {
+        freep(values[i]);
+    }
+    values.clear();
+    ret = ERROR_SUCCESS;
+}
+
+Amf0BatchCodec::Amf0BatchCodec(int threads, Amf0Allocator *allocator)
+    : generation(0), active(0), stop(false), current_job(nullptr), current_count(0), grain(AMF0_BATCH_MIN_GRAIN)
+{
+    if (threads <= 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        workers.push_back(new Amf0BatchWorker(allocator));
+    }
+
+    for (int i = 1; i < threads; ++i) {
+        pool.push_back(std::thread(&Amf0BatchCodec::worker_loop, this, i));
+    }
+}
+
+Amf0BatchCodec::~Amf0BatchCodec()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeup.notify_all();
+
+    for (size_t i = 0; i < pool.size(); ++i) {
+        pool[i].join();
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        freep(workers[i]);
+    }
+}
+
+int Amf0BatchCodec::threads()
+{
+    return workers.size();
+}
+
+int Amf0BatchCodec::decode(const std::vector<Amf0Slice> &slices, std::vector<Amf0BatchItem> &items)
+{
+    items.clear();
+    items.resize(slices.size());
+
+    run(slices.size(), [&](Amf0BatchWorker *w, int i) {
+        Amf0BatchItem &item = items[i];
+        Amf0AllocatorScope scope(w->arena);
+        ViewSimpleBuffer sb(slices[i].data, slices[i].size);
+
+        while (!sb.empty()) {
+            Amf0Data *value = Amf0Data::create_amf0data(&sb);
+            if (!value) {
+                item.ret = ERROR_AMF0_DECODE;
+                break;
+            }
+            item.values.push_back(value);
+        }
+    });
+
+    int failed = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i].ret != ERROR_SUCCESS) {
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+int Amf0BatchCodec::encode(const std::vector<Amf0Data *> &values, std::vector<std::string> &results)
+{
+    results.clear();
+    results.resize(values.size());
+
+    run(values.size(), [&](Amf0BatchWorker *w, int i) {
+        SimpleBuffer *sb = &w->scratch;
+
+        sb->clear();
+        values[i]->write(sb);
+        results[i].assign(sb->data(), sb->size());
+    });
+
+    return ERROR_SUCCESS;
+}
+
+void Amf0BatchCodec::run(int count, const std::function<void(Amf0BatchWorker *, int)> &job)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    int n = workers.size();
+
+    // at least a few chunks per worker so stealing can balance the tail
+    grain = count / (n * 8);
+    if (grain < AMF0_BATCH_MIN_GRAIN) {
+        grain = AMF0_BATCH_MIN_GRAIN;
+    }
+
+    int chunks = (count + grain - 1) / grain;
+    for (int i = 0; i < n; ++i) {
+        std::unique_lock<std::mutex> lock(workers[i]->mutex);
+        workers[i]->head = (int)((int64_t)chunks * i / n);
+        workers[i]->tail = (int)((int64_t)chunks * (i + 1) / n);
+    }
+
+    if (n == 1) {
+        current_job = &job;
+        current_count = count;
+        work(0);
+        current_job = nullptr;
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        current_job = &job;
+        current_count = count;
+        active = n - 1;
+        generation++;
+    }
+    wakeup.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return active == 0; });
+    current_job = nullptr;
+}
+
+void Amf0BatchCodec::work(int id)
+{
+    Amf0BatchWorker *w = workers[id];
+    int chunk = 0;
+
+    while (next_chunk(id, chunk)) {
+        int begin = chunk * grain;
+        int end = std::min(begin + grain, current_count);
+        for (int i = begin; i < end; ++i) {
+            (*current_job)(w, i);
+        }
+    }
+}
+
+bool Amf0BatchCodec::next_chunk(int id, int &chunk)
+{
+    Amf0BatchWorker *self = workers[id];
+    {
+        std::unique_lock<std::mutex> lock(self->mutex);
+        if (self->head < self->tail) {
+            chunk = self->head++;
+            return true;
+        }
+    }
+
+    int n = workers.size();
+    for (int k = 1; k < n; ++k) {
+        Amf0BatchWorker *victim = workers[(id + k) % n];
+        std::unique_lock<std::mutex> lock(victim->mutex);
+        if (victim->head < victim->tail) {
+            chunk = --victim->tail;
+            return true;
+        }
+    }
+
+    // chunks are never added during a run, so nothing is left to take
+    return false;
+}
+
+void Amf0BatchCodec::worker_loop(int id)
+{
+    int seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) {
+                return;
+            }
+            seen = generation;
+        }
+
+        work(id);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (--active == 0) {
+            done.notify_one();
+        }
+    }
+}
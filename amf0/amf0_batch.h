@@ -0,0 +1,87 @@
+#ifndef __AMF0_BATCH_H__
+#define __AMF0_BATCH_H__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class Amf0Data;
+class Amf0Allocator;
+class Amf0BatchWorker;
+
+// a view of one independent message, decoded in place without a copy
+struct Amf0Slice
+{
+    const char *data;
+    int size;
+};
+
+// decoded values of one slice, in stream order
+class Amf0BatchItem
+{
+public:
+    Amf0BatchItem();
+    Amf0BatchItem(Amf0BatchItem &&other);
+    virtual ~Amf0BatchItem();
+
+    Amf0BatchItem(const Amf0BatchItem &) = delete;
+    Amf0BatchItem &operator=(const Amf0BatchItem &) = delete;
+
+public:
+    void clear();
+
+public:
+    int ret;
+    std::vector<Amf0Data *> values;
+};
+
+// decodes or encodes many independent messages on a pool of workers.
+// slices are split into chunks, each worker drains its own chunks first
+// and then steals from the others, results are always stored by index.
+class Amf0BatchCodec
+{
+public:
+    // threads <= 0 means one worker per hardware thread,
+    // the calling thread always works as worker 0. Every worker decodes
+    // from an arena of its own, a pool drawing blocks from allocator,
+    // nullptr is the default one. The arenas draw at the same time, so
+    // allocator must be thread safe, an Amf0PoolAllocator is not. Values
+    // may be freed on any thread and may outlive the codec, an arena
+    // goes when the codec and the last value decoded from it are gone.
+    Amf0BatchCodec(int threads = 0, Amf0Allocator *allocator = nullptr);
+    virtual ~Amf0BatchCodec();
+
+public:
+    // items[i] receives every value of slices[i], returns the number of
+    // slices that failed to decode
+    int decode(const std::vector<Amf0Slice> &slices, std::vector<Amf0BatchItem> &items);
+    // results[i] receives the encoded bytes of values[i]
+    int encode(const std::vector<Amf0Data *> &values, std::vector<std::string> &results);
+    int threads();
+
+private:
+    void run(int count, const std::function<void(Amf0BatchWorker *, int)> &job);
+    void work(int id);
+    bool next_chunk(int id, int &chunk);
+    void worker_loop(int id);
+
+private:
+    std::vector<Amf0BatchWorker *> workers;
+    std::vector<std::thread> pool;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable done;
+    int generation;
+    int active;
+    bool stop;
+
+    const std::function<void(Amf0BatchWorker *, int)> *current_job;
+    int current_count;
+    int grain;
+};
+
+#endif /* __AMF0_BATCH_H__ */
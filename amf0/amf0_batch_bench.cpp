@@ -0,0 +1,100 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "simple_buffer.h"
+#include "amf0.h"
+#include "amf0_batch.h"
+
+using namespace std;
+
+// builds a typical "onMetaData" script data payload
+static string make_payload(int seed)
+{
+    SimpleBuffer sb;
+
+    Amf0String name("onMetaData");
+    name.write(&sb);
+
+    Amf0EcmaArray meta;
+    meta.put("duration", new Amf0Number(seed % 3600));
+    meta.put("width", new Amf0Number(1280));
+    meta.put("height", new Amf0Number(720));
+    meta.put("videodatarate", new Amf0Number(2500 + seed % 100));
+    meta.put("framerate", new Amf0Number(30));
+    meta.put("videocodecid", new Amf0Number(7));
+    meta.put("audiodatarate", new Amf0Number(128));
+    meta.put("audiosamplerate", new Amf0Number(44100));
+    meta.put("audiosamplesize", new Amf0Number(16));
+    meta.put("stereo", new Amf0Boolean(true));
+    meta.put("audiocodecid", new Amf0Number(10));
+    meta.put("encoder", new Amf0String("Lavf58.29.100"));
+    meta.put("filesize", new Amf0Number(seed * 1024.0));
+    meta.write(&sb);
+
+    return sb.to_string();
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 3;
+    int max_threads = std::thread::hardware_concurrency();
+    if (max_threads <= 0) {
+        max_threads = 1;
+    }
+
+    vector<string> payloads;
+    for (int i = 0; i < count; ++i) {
+        payloads.push_back(make_payload(i));
+    }
+
+    vector<Amf0Slice> slices;
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        Amf0Slice slice = { payloads[i].data(), (int)payloads[i].size() };
+        slices.push_back(slice);
+    }
+
+    printf("%d messages, %d rounds, %d hardware threads\n", count, rounds, max_threads);
+    printf("%8s %14s %14s %9s\n", "threads", "decode msg/s", "encode msg/s", "speedup");
+
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        Amf0BatchCodec codec(threads);
+        vector<Amf0BatchItem> items;
+        vector<string> encoded;
+        double decode_best = 0, encode_best = 0;
+
+        for (int r = 0; r < rounds; ++r) {
+            auto start = chrono::steady_clock::now();
+            codec.decode(slices, items);
+            double decode_sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            vector<Amf0Data *> values;
+            for (size_t i = 0; i < items.size(); ++i) {
+                values.push_back(items[i].values.back());
+            }
+
+            start = chrono::steady_clock::now();
+            codec.encode(values, encoded);
+            double encode_sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            decode_best = max(decode_best, count / decode_sec);
+            encode_best = max(encode_best, count / encode_sec);
+        }
+
+        if (threads == 1) {
+            base = decode_best;
+        }
+        printf("%8d %14.0f %14.0f %8.2fx\n", threads, decode_best, encode_best, decode_best / base);
+
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include "amf0_buffer_pool.h"
+
+#include <string.h>
+#include <atomic>
+
+/**
+ * One per thread, pushed once onto a global list and never freed: a
+ * buffer may still point at it after its thread exited. The next new
+ * thread takes such a cache over, inbox included.
+ */
+class Amf0BufferCache
+{
+public:
+    Amf0BufferCache() : retained(0), next(nullptr)
+    {
+        memset(lists, 0, sizeof(lists));
+        memset(counts, 0, sizeof(counts));
+        in_use.store(true);
+        inbox.store(nullptr);
+        acquires.store(0);
+        hits.store(0);
+        releases.store(0);
+        remote_releases.store(0);
+        dropped.store(0);
+        retained_bytes.store(0);
+        retained_buffers.store(0);
+    }
+
+public:
+    Amf0PooledSimpleBuffer *pop(int cls);
+    void push(Amf0PooledSimpleBuffer *sb);
+    void drain();
+    void purge();
+
+public:
+    // owner thread only
+    Amf0PooledSimpleBuffer *lists[AMF0_BUFFER_POOL_CLASSES];
+    int counts[AMF0_BUFFER_POOL_CLASSES];
+    int64_t retained;
+
+    // buffers released by other threads
+    std::atomic<Amf0PooledSimpleBuffer *> inbox;
+    std::atomic<bool> in_use;
+    Amf0BufferCache *next;
+
+    // written by the owner, read by amf0_buffer_pool_stats()
+    std::atomic<uint64_t> acquires;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> releases;
+    std::atomic<uint64_t> remote_releases;
+    std::atomic<uint64_t> dropped;
+    std::atomic<int64_t> retained_bytes;
+    std::atomic<int64_t> retained_buffers;
+};
+
+static std::atomic<Amf0BufferCache *> amf0_buffer_caches(nullptr);
+static std::atomic<bool> amf0_buffer_remote_return(true);
+
+static inline void amf0_pool_add(std::atomic<uint64_t> &counter, uint64_t n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// class whose buffers hold at least size bytes, -1 above the largest
+static int amf0_buffer_class_for(int size)
+{
+    int cls = 0;
+    for (int c = AMF0_BUFFER_POOL_MIN_CLASS; c < size; c <<= 1) {
+        if (++cls >= AMF0_BUFFER_POOL_CLASSES) {
+            return -1;
+        }
+    }
+    return cls;
+}
+
+// largest class a buffer of capacity can serve, -1 if it serves none
+static int amf0_buffer_class_of(int capacity)
+{
+    if (capacity < AMF0_BUFFER_POOL_MIN_CLASS || capacity > AMF0_BUFFER_POOL_MAX_CLASS) {
+        return -1;
+    }
+    int cls = 0;
+    while (cls + 1 < AMF0_BUFFER_POOL_CLASSES && (AMF0_BUFFER_POOL_MIN_CLASS << (cls + 1)) <= capacity) {
+        cls++;
+    }
+    return cls;
+}
+
+Amf0PooledSimpleBuffer *Amf0BufferCache::pop(int cls)
+{
+    Amf0PooledSimpleBuffer *sb = lists[cls];
+    if (sb) {
+        lists[cls] = sb->next;
+        counts[cls]--;
+        retained -= sb->capacity();
+        retained_bytes.store(retained, std::memory_order_relaxed);
+        retained_buffers.store(retained_buffers.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+    return sb;
+}
+
+void Amf0BufferCache::push(Amf0PooledSimpleBuffer *sb)
+{
+    int cls = amf0_buffer_class_of(sb->capacity());
+    if (cls < 0 || counts[cls] >= AMF0_BUFFER_POOL_MAX_PER_CLASS || retained + sb->capacity() > AMF0_BUFFER_POOL_MAX_RETAINED) {
+        amf0_pool_add(dropped, 1);
+        delete sb;
+        return;
+    }
+
+    sb->clear();
+    sb->owner = this;
+    sb->next = lists[cls];
+    lists[cls] = sb;
+    counts[cls]++;
+    retained += sb->capacity();
+    retained_bytes.store(retained, std::memory_order_relaxed);
+    retained_buffers.store(retained_buffers.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Amf0BufferCache::drain()
+{
+    Amf0PooledSimpleBuffer *sb = inbox.exchange(nullptr, std::memory_order_acquire);
+    while (sb) {
+        Amf0PooledSimpleBuffer *next = sb->next;
+        push(sb);
+        sb = next;
+    }
+}
+
+void Amf0BufferCache::purge()
+{
+    drain();
+    for (int cls = 0; cls < AMF0_BUFFER_POOL_CLASSES; ++cls) {
+        Amf0PooledSimpleBuffer *sb = nullptr;
+        while ((sb = pop(cls)) != nullptr) {
+            delete sb;
+        }
+    }
+}
+
+class Amf0BufferLocal
+{
+public:
+    Amf0BufferLocal() : cache(nullptr) {}
+    ~Amf0BufferLocal()
+    {
+        if (cache) {
+            cache->purge();
+            cache->in_use.store(false, std::memory_order_release);
+            cache = nullptr;
+        }
+    }
+
+public:
+    Amf0BufferCache *get()
+    {
+        if (cache) {
+            return cache;
+        }
+
+        for (Amf0BufferCache *c = amf0_buffer_caches.load(std::memory_order_acquire); c; c = c->next) {
+            bool expected = false;
+            if (!c->in_use.load(std::memory_order_relaxed) && c->in_use.compare_exchange_strong(expected, true)) {
+                cache = c;
+                return c;
+            }
+        }
+
+        Amf0BufferCache *c = new Amf0BufferCache();
+        Amf0BufferCache *head = amf0_buffer_caches.load(std::memory_order_relaxed);
+        do {
+            c->next = head;
+        } while (!amf0_buffer_caches.compare_exchange_weak(head, c, std::memory_order_release, std::memory_order_relaxed));
+
+        cache = c;
+        return c;
+    }
+
+private:
+    Amf0BufferCache *cache;
+};
+
+static thread_local Amf0BufferLocal amf0_buffer_local;
+
+SimpleBuffer *amf0_buffer_acquire(int size_hint)
+{
+    Amf0BufferCache *cache = amf0_buffer_local.get();
+    amf0_pool_add(cache->acquires, 1);
+
+    if (cache->inbox.load(std::memory_order_relaxed)) {
+        cache->drain();
+    }
+
+    int cls = amf0_buffer_class_for(size_hint > 0 ? size_hint : 1);
+    if (cls >= 0) {
+        // the class asked for, or the next one up
+        for (int c = cls; c < AMF0_BUFFER_POOL_CLASSES && c <= cls + 1; ++c) {
+            Amf0PooledSimpleBuffer *sb = cache->pop(c);
+            if (sb) {
+                amf0_pool_add(cache->hits, 1);
+                return sb;
+            }
+        }
+    }
+
+    // kept by the pool past the caller's allocator scope
+    Amf0AllocatorScope scope(Amf0Allocator::default_allocator());
+    Amf0PooledSimpleBuffer *sb = new Amf0PooledSimpleBuffer();
+    sb->owner = cache;
+    sb->reserve(cls >= 0 ? AMF0_BUFFER_POOL_MIN_CLASS << cls : size_hint);
+    return sb;
+}
+
+void amf0_buffer_release(SimpleBuffer *buffer)
+{
+    if (!buffer) {
+        return;
+    }
+
+    Amf0PooledSimpleBuffer *sb = static_cast<Amf0PooledSimpleBuffer *>(buffer);
+    Amf0BufferCache *cache = amf0_buffer_local.get();
+    Amf0BufferCache *owner = sb->owner;
+    amf0_pool_add(cache->releases, 1);
+
+    if (owner && owner != cache && amf0_buffer_remote_return.load(std::memory_order_relaxed)
+        && owner->in_use.load(std::memory_order_acquire)) {
+        amf0_pool_add(cache->remote_releases, 1);
+        Amf0PooledSimpleBuffer *head = owner->inbox.load(std::memory_order_relaxed);
+        do {
+            sb->next = head;
+        } while (!owner->inbox.compare_exchange_weak(head, sb, std::memory_order_release, std::memory_order_relaxed));
+        return;
+    }
+
+    cache->push(sb);
+}
+
+void amf0_buffer_pool_set_remote_return(bool enable)
+{
+    amf0_buffer_remote_return.store(enable);
+}
+
+void amf0_buffer_pool_stats(Amf0BufferPoolStats *s)
+{
+    memset(s, 0, sizeof(Amf0BufferPoolStats));
+
+    for (Amf0BufferCache *c = amf0_buffer_caches.load(std::memory_order_acquire); c; c = c->next) {
+        s->acquires += c->acquires.load(std::memory_order_relaxed);
+        s->hits += c->hits.load(std::memory_order_relaxed);
+        s->releases += c->releases.load(std::memory_order_relaxed);
+        s->remote_releases += c->remote_releases.load(std::memory_order_relaxed);
+        s->dropped += c->dropped.load(std::memory_order_relaxed);
+        s->retained_bytes += c->retained_bytes.load(std::memory_order_relaxed);
+        s->retained_buffers += c->retained_buffers.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef __AMF0_BUFFER_POOL_H__
+#define __AMF0_BUFFER_POOL_H__
+
+#include <stdint.h>
+
+#include "amf0_allocator.h"
+#include "simple_buffer.h"
+
+// size classes are powers of two from the smallest to the largest
+#define AMF0_BUFFER_POOL_MIN_CLASS 256
+#define AMF0_BUFFER_POOL_MAX_CLASS (1024 * 1024)
+#define AMF0_BUFFER_POOL_CLASSES 13
+// what one thread keeps at most, in buffers per class and in bytes
+#define AMF0_BUFFER_POOL_MAX_PER_CLASS 64
+#define AMF0_BUFFER_POOL_MAX_RETAINED (8 * 1024 * 1024)
+
+class Amf0BufferCache;
+
+// a SimpleBuffer that remembers the thread cache it came from. Its storage
+// outlives any allocator scope in the pool, so it grows from the default
+// allocator whatever scope the writes run in.
+class Amf0PooledSimpleBuffer : public SimpleBuffer
+{
+public:
+    Amf0PooledSimpleBuffer() : owner(nullptr), next(nullptr) {}
+    virtual ~Amf0PooledSimpleBuffer() {}
+
+protected:
+    virtual void write_slow(const char *bytes, int n)
+    {
+        Amf0AllocatorScope scope(Amf0Allocator::default_allocator());
+        SimpleBuffer::write_slow(bytes, n);
+    }
+
+public:
+    Amf0BufferCache *owner;
+    Amf0PooledSimpleBuffer *next;
+};
+
+/**
+ * Encode buffers recycled through per-thread free lists, so a steady
+ * stream of messages allocates neither buffers nor their storage. A
+ * buffer comes back empty but with its capacity, filed under the largest
+ * class it holds. Buffers above the largest class and whatever would
+ * push a thread past its limits are freed instead of kept.
+ *
+ * A buffer released on another thread, e.g. after the send completed on
+ * an I/O thread, goes back to the thread it came from through a lock
+ * free inbox, or stays with the releasing thread when remote return is
+ * off.
+ */
+SimpleBuffer *amf0_buffer_acquire(int size_hint = 0);
+void amf0_buffer_release(SimpleBuffer *sb);
+// on by default
+void amf0_buffer_pool_set_remote_return(bool enable);
+
+struct Amf0BufferPoolStats
+{
+    uint64_t acquires;
+    // acquires served from a free list
+    uint64_t hits;
+    uint64_t releases;
+    // releases sent back to another thread
+    uint64_t remote_releases;
+    // releases freed instead of kept
+    uint64_t dropped;
+    int64_t retained_bytes;
+    int64_t retained_buffers;
+};
+
+// totals over every thread
+void amf0_buffer_pool_stats(Amf0BufferPoolStats *stats);
+
+// acquires on construction and releases on destruction
+class Amf0PooledBuffer
+{
+public:
+    Amf0PooledBuffer(int size_hint = 0) : sb(amf0_buffer_acquire(size_hint)) {}
+    virtual ~Amf0PooledBuffer()
+    {
+        amf0_buffer_release(sb);
+    }
+
+    Amf0PooledBuffer(const Amf0PooledBuffer &) = delete;
+    Amf0PooledBuffer &operator=(const Amf0PooledBuffer &) = delete;
+
+public:
+    SimpleBuffer *get()
+    {
+        return sb;
+    }
+    SimpleBuffer *operator->()
+    {
+        return sb;
+    }
+
+private:
+    SimpleBuffer *sb;
+};
+
+#endif /* __AMF0_BUFFER_POOL_H__ */
@@ -0,0 +1,260 @@
+#include "amf0_cache.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0.h"
+#include "amf0_lazy.h"
+#include "simple_buffer.h"
+
+static const uint64_t AMF0_PRIME64_1 = 11400714785074694791ULL;
+static const uint64_t AMF0_PRIME64_2 = 14029467366897019727ULL;
+static const uint64_t AMF0_PRIME64_3 = 1609587929392839161ULL;
+static const uint64_t AMF0_PRIME64_4 = 9650029242287828579ULL;
+static const uint64_t AMF0_PRIME64_5 = 2870177450012600261ULL;
+
+static inline uint64_t amf0_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t amf0_read64(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t amf0_read32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t amf0_xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * AMF0_PRIME64_2;
+    acc = amf0_rotl64(acc, 31);
+    return acc * AMF0_PRIME64_1;
+}
+
+static inline uint64_t amf0_xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= amf0_xxh64_round(0, val);
+    return acc * AMF0_PRIME64_1 + AMF0_PRIME64_4;
+}
+
+uint64_t amf0_hash(const char *p, int len, uint64_t seed)
+{
+    const char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + AMF0_PRIME64_1 + AMF0_PRIME64_2;
+        uint64_t v2 = seed + AMF0_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - AMF0_PRIME64_1;
+
+        const char *limit = end - 32;
+        do {
+            v1 = amf0_xxh64_round(v1, amf0_read64(p));
+            v2 = amf0_xxh64_round(v2, amf0_read64(p + 8));
+            v3 = amf0_xxh64_round(v3, amf0_read64(p + 16));
+            v4 = amf0_xxh64_round(v4, amf0_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = amf0_rotl64(v1, 1) + amf0_rotl64(v2, 7) + amf0_rotl64(v3, 12) + amf0_rotl64(v4, 18);
+        h = amf0_xxh64_merge(h, v1);
+        h = amf0_xxh64_merge(h, v2);
+        h = amf0_xxh64_merge(h, v3);
+        h = amf0_xxh64_merge(h, v4);
+    } else {
+        h = seed + AMF0_PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end) {
+        h ^= amf0_xxh64_round(0, amf0_read64(p));
+        h = amf0_rotl64(h, 27) * AMF0_PRIME64_1 + AMF0_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)amf0_read32(p) * AMF0_PRIME64_1;
+        h = amf0_rotl64(h, 23) * AMF0_PRIME64_2 + AMF0_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (uint8_t)*p * AMF0_PRIME64_5;
+        h = amf0_rotl64(h, 11) * AMF0_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= AMF0_PRIME64_2;
+    h ^= h >> 29;
+    h *= AMF0_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// container levels of value, what max_depth has to allow for it
+static int amf0_cache_depth(Amf0Data *value)
+{
+    bool map = value->is_object() || value->is_ecma_array();
+    int count = 0;
+    if (map) {
+        count = amf0_map_count(value);
+    } else if (value->marker == AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY) {
+        count = ((Amf0StrictArray *)value)->count();
+    } else {
+        return 0;
+    }
+
+    int deepest = 0;
+    for (int i = 0; i < count; ++i) {
+        Amf0Data *child = map ? amf0_map_value(value, i) : ((Amf0StrictArray *)value)->value_at(i);
+        deepest = std::max(deepest, amf0_cache_depth(child));
+    }
+
+    return 1 + deepest;
+}
+
+Amf0DecodeCache::Amf0DecodeCache(int max_entries, int64_t max_bytes)
+    : max_entries(max_entries), max_bytes(max_bytes)
+{
+    memset(&counters, 0, sizeof(counters));
+}
+
+Amf0DecodeCache::~Amf0DecodeCache()
+{
+}
+
+std::shared_ptr<Amf0Data> Amf0DecodeCache::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    // the default limits of create_amf0data(), and a new message at the top
+    Amf0DecodeContext limits;
+    if (!ctx) {
+        ctx = &limits;
+    }
+    if (ctx->depth == 0) {
+        ctx->reset();
+    }
+
+    int start = sb->pos();
+    const char *p = sb->data() + start;
+    int n = sb->size() - start;
+
+    int8_t m = n > 0 ? p[0] : 0;
+    bool container = n > 0 && (m == AMF0_MARKER::AMF0_MARKER_OBJECT || m == AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY
+        || m == AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY);
+    int size = container ? amf0_value_size(p, n) : -1;
+
+    if (size < 0) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            counters.bypassed++;
+        }
+        return std::shared_ptr<Amf0Data>(Amf0Data::create_amf0data(sb, ctx));
+    }
+
+    // a tree decoded without UTF-8 checks must not answer a checked decode
+    uint64_t hash = amf0_hash(p, size, ctx->validate_utf8);
+
+    bool refused = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        std::unordered_map<uint64_t, Lru::iterator>::iterator it = index.find(hash);
+        if (it != index.end() && it->second->bytes.size() == (size_t)size && memcmp(it->second->bytes.data(), p, size) == 0) {
+            const Entry &e = *it->second;
+            refused = (ctx->max_depth > 0 && ctx->depth + e.depth > ctx->max_depth)
+                || (ctx->max_nodes > 0 && ctx->nodes + e.nodes > ctx->max_nodes)
+                || (ctx->max_bytes > 0 && ctx->bytes + e.charged > ctx->max_bytes);
+
+            if (!refused) {
+                lru.splice(lru.begin(), lru, it->second);
+                counters.hits++;
+                ctx->nodes += e.nodes;
+                ctx->bytes += e.charged;
+                sb->skip(size);
+                return lru.front().value;
+            }
+            counters.bypassed++;
+        } else {
+            counters.misses++;
+        }
+    }
+
+    // over the limits of ctx, the decoder fails it where it should
+    if (refused) {
+        return std::shared_ptr<Amf0Data>(Amf0Data::create_amf0data(sb, ctx));
+    }
+
+    int64_t nodes = ctx->nodes;
+    int64_t bytes = ctx->bytes;
+
+    // kept past the caller's allocator scope, so never from it
+    std::shared_ptr<Amf0Data> value;
+    {
+        Amf0AllocatorScope scope(Amf0Allocator::default_allocator());
+        value.reset(Amf0Data::create_amf0data(sb, ctx));
+    }
+
+    // the lenient decoder may read past a damaged value differently
+    // than the scan measured it, such a value is not worth keeping
+    if (!value || sb->pos() - start != size || size > max_bytes) {
+        return value;
+    }
+
+    Entry entry;
+    entry.hash = hash;
+    entry.bytes.assign(p, size);
+    entry.value = value;
+    entry.depth = amf0_cache_depth(value.get());
+    entry.nodes = ctx->nodes - nodes;
+    entry.charged = ctx->bytes - bytes;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    std::unordered_map<uint64_t, Lru::iterator>::iterator it = index.find(hash);
+    if (it != index.end()) {
+        counters.bytes -= it->second->bytes.size();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+    lru.push_front(entry);
+    index[hash] = lru.begin();
+    counters.bytes += size;
+
+    while ((int)index.size() > max_entries || counters.bytes > max_bytes) {
+        Entry &last = lru.back();
+        counters.bytes -= last.bytes.size();
+        counters.evictions++;
+        index.erase(last.hash);
+        lru.pop_back();
+    }
+
+    return value;
+}
+
+Amf0DecodeCacheStats Amf0DecodeCache::stats()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Amf0DecodeCacheStats s = counters;
+    s.entries = index.size();
+    return s;
+}
+
+void Amf0DecodeCache::clear()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    counters.bytes = 0;
+}
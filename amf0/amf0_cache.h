@@ -0,0 +1,78 @@
+#ifndef __AMF0_CACHE_H__
+#define __AMF0_CACHE_H__
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class Amf0Data;
+class Amf0DecodeContext;
+class SimpleBuffer;
+
+// xxHash64 of len bytes
+uint64_t amf0_hash(const char *data, int len, uint64_t seed = 0);
+
+struct Amf0DecodeCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // values not cached, e.g. scalars or ones that failed to decode
+    uint64_t bypassed;
+    int entries;
+    int64_t bytes;
+};
+
+/**
+ * LRU of decoded containers keyed by the hash of their encoded bytes, for
+ * peers that send the same connect object or @setDataFrame again and
+ * again. Objects, ECMA and strict arrays are measured with a scan that
+ * allocates nothing, looked up and only decoded on a miss. A hit also
+ * compares the bytes, so a hash collision is just a miss. Scalars are
+ * decoded as usual. Safe to share between threads.
+ */
+class Amf0DecodeCache
+{
+public:
+    // max_bytes counts the encoded bytes of the cached values
+    Amf0DecodeCache(int max_entries = 1024, int64_t max_bytes = 4 * 1024 * 1024);
+    virtual ~Amf0DecodeCache();
+
+public:
+    // like Amf0Data::create_amf0data(), a cached tree is shared by every
+    // caller and must not be modified. Hits allocate nothing, they are
+    // charged to ctx like the decode they save, and one over its limits
+    // is decoded instead so that it fails as it would without the cache.
+    // Cached trees come from the default allocator.
+    std::shared_ptr<Amf0Data> decode(SimpleBuffer *sb, Amf0DecodeContext *ctx = nullptr);
+    Amf0DecodeCacheStats stats();
+    void clear();
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        std::string bytes;
+        std::shared_ptr<Amf0Data> value;
+        // what decoding it cost, checked against the limits of a hit
+        int depth;
+        int64_t nodes;
+        int64_t charged;
+    };
+    typedef std::list<Entry> Lru;
+
+private:
+    int max_entries;
+    int64_t max_bytes;
+
+    std::mutex mutex;
+    // most recently used first
+    Lru lru;
+    std::unordered_map<uint64_t, Lru::iterator> index;
+    Amf0DecodeCacheStats counters;
+};
+
+#endif /* __AMF0_CACHE_H__ */
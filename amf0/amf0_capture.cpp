@@ -0,0 +1,131 @@
+#include "amf0_capture.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "amf_errno.h"
+
+Amf0CaptureReader::Amf0CaptureReader(int fd, const char *base, uint64_t size)
+    : fd(fd), base(base), _size(size), pos(AMF0_CAPTURE_HEADER_SIZE)
+{
+}
+
+Amf0CaptureReader::~Amf0CaptureReader()
+{
+    munmap((void *)base, _size);
+    ::close(fd);
+}
+
+Amf0CaptureReader *Amf0CaptureReader::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < AMF0_CAPTURE_HEADER_SIZE) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    uint64_t size = st.st_size;
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+    madvise(p, size, MADV_SEQUENTIAL);
+
+    if (memcmp(p, AMF0_CAPTURE_MAGIC, AMF0_CAPTURE_HEADER_SIZE) != 0) {
+        munmap(p, size);
+        ::close(fd);
+        return nullptr;
+    }
+
+    return new Amf0CaptureReader(fd, (const char *)p, size);
+}
+
+bool Amf0CaptureReader::next(Amf0CaptureMessage &message)
+{
+    if (pos + AMF0_CAPTURE_RECORD_SIZE > _size) {
+        return false;
+    }
+
+    const uint8_t *u = (const uint8_t *)base + pos;
+    uint32_t size = ((uint32_t)u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+    if (pos + AMF0_CAPTURE_RECORD_SIZE + size > _size) {
+        return false;
+    }
+
+    message.type = u[4];
+    message.size = size;
+    message.data = base + pos + AMF0_CAPTURE_RECORD_SIZE;
+    pos += AMF0_CAPTURE_RECORD_SIZE + size;
+    return true;
+}
+
+void Amf0CaptureReader::rewind()
+{
+    pos = AMF0_CAPTURE_HEADER_SIZE;
+}
+
+bool Amf0CaptureReader::truncated()
+{
+    return pos < _size;
+}
+
+uint64_t Amf0CaptureReader::size()
+{
+    return _size;
+}
+
+Amf0CaptureWriter::Amf0CaptureWriter(FILE *fp) : fp(fp), error(ERROR_SUCCESS)
+{
+}
+
+Amf0CaptureWriter::~Amf0CaptureWriter()
+{
+    close();
+}
+
+Amf0CaptureWriter *Amf0CaptureWriter::open(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return nullptr;
+    }
+
+    Amf0CaptureWriter *writer = new Amf0CaptureWriter(fp);
+    if (fwrite(AMF0_CAPTURE_MAGIC, AMF0_CAPTURE_HEADER_SIZE, 1, fp) != 1) {
+        writer->error = ERROR_AMF0_IO;
+    }
+    return writer;
+}
+
+int Amf0CaptureWriter::write(uint8_t type, const char *data, uint32_t size)
+{
+    if (!fp) {
+        return ERROR_AMF0_IO;
+    }
+
+    char record[AMF0_CAPTURE_RECORD_SIZE] = { (char)(size >> 24), (char)(size >> 16), (char)(size >> 8), (char)size, (char)type };
+    if (fwrite(record, sizeof(record), 1, fp) != 1 || (size > 0 && fwrite(data, size, 1, fp) != 1)) {
+        error = ERROR_AMF0_IO;
+    }
+    return error;
+}
+
+int Amf0CaptureWriter::close()
+{
+    if (fp) {
+        if (fclose(fp) != 0) {
+            error = ERROR_AMF0_IO;
+        }
+        fp = nullptr;
+    }
+    return error;
+}
@@ -0,0 +1,80 @@
+#ifndef __AMF0_CAPTURE_H__
+#define __AMF0_CAPTURE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// "AMF0CAP" and a version byte
+#define AMF0_CAPTURE_MAGIC "AMF0CAP\x01"
+#define AMF0_CAPTURE_HEADER_SIZE 8
+// size and message type before every payload
+#define AMF0_CAPTURE_RECORD_SIZE 5
+
+// one message of a mapped capture, data points into the mapping
+struct Amf0CaptureMessage
+{
+    // RTMP message type, e.g. RTMP_MSG_AMF0_COMMAND
+    uint8_t type;
+    uint32_t size;
+    const char *data;
+};
+
+/**
+ * A capture is the AMF0 messages of real traffic, for replaying them
+ * offline. After the magic every record is a big endian payload size, a
+ * message type and the payload, the values of one message back to back.
+ * The reader maps the file read-only for sequential access, so it does
+ * not matter how large it is.
+ */
+class Amf0CaptureReader
+{
+public:
+    virtual ~Amf0CaptureReader();
+
+private:
+    Amf0CaptureReader(int fd, const char *base, uint64_t size);
+
+public:
+    // nullptr when the file cannot be mapped or is not a capture
+    static Amf0CaptureReader *open(const std::string &path);
+
+public:
+    // false at the end of the file or at a record running past it
+    bool next(Amf0CaptureMessage &message);
+    void rewind();
+    // whether next() stopped at a damaged record instead of the end
+    bool truncated();
+    uint64_t size();
+
+private:
+    int fd;
+    const char *base;
+    uint64_t _size;
+    uint64_t pos;
+};
+
+// appends records to a new capture through a stdio buffer
+class Amf0CaptureWriter
+{
+public:
+    virtual ~Amf0CaptureWriter();
+
+private:
+    Amf0CaptureWriter(FILE *fp);
+
+public:
+    // nullptr when path cannot be created
+    static Amf0CaptureWriter *open(const std::string &path);
+
+public:
+    int write(uint8_t type, const char *data, uint32_t size);
+    // flushes and closes, a failed write before is reported here too
+    int close();
+
+private:
+    FILE *fp;
+    int error;
+};
+
+#endif /* __AMF0_CAPTURE_H__ */
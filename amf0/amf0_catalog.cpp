@@ -0,0 +1,238 @@
+#include "amf0_catalog.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0.h"
+
+static uint64_t amf0_align8(uint64_t v)
+{
+    return (v + 7) & ~(uint64_t)7;
+}
+
+Amf0CatalogWriter::Amf0CatalogWriter()
+{
+}
+
+Amf0CatalogWriter::~Amf0CatalogWriter()
+{
+    for (std::map<std::string, Amf0Frozen *>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        freep(it->second);
+    }
+}
+
+int Amf0CatalogWriter::add(const std::string &key, Amf0Data *data)
+{
+    Amf0Frozen *frozen = Amf0Frozen::freeze(data);
+    if (!frozen) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    Amf0Frozen *&slot = entries[key];
+    freep(slot);
+    slot = frozen;
+
+    return ERROR_SUCCESS;
+}
+
+int Amf0CatalogWriter::write(const std::string &path)
+{
+    int ret = ERROR_SUCCESS;
+
+    // layout first, entries come out of the map already sorted by key
+    std::vector<Amf0CatalogEntry> index(entries.size());
+    uint64_t keys_offset = sizeof(Amf0CatalogHeader) + entries.size() * sizeof(Amf0CatalogEntry);
+    uint64_t offset = keys_offset;
+
+    int i = 0;
+    for (std::map<std::string, Amf0Frozen *>::iterator it = entries.begin(); it != entries.end(); ++it, ++i) {
+        memset(&index[i], 0, sizeof(Amf0CatalogEntry));
+        index[i].key_offset = offset;
+        index[i].key_length = it->first.size();
+        offset += it->first.size();
+    }
+
+    i = 0;
+    for (std::map<std::string, Amf0Frozen *>::iterator it = entries.begin(); it != entries.end(); ++it, ++i) {
+        offset = amf0_align8(offset);
+        index[i].block_offset = offset;
+        index[i].block_size = it->second->size();
+        offset += it->second->size();
+    }
+
+    Amf0CatalogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = AMF0_CATALOG_MAGIC;
+    header.version = AMF0_CATALOG_VERSION;
+    header.file_size = offset;
+    header.entry_count = entries.size();
+    header.entries_offset = sizeof(Amf0CatalogHeader);
+
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        return ERROR_AMF0_IO;
+    }
+
+    static const char zeros[8] = { 0 };
+    uint64_t written = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    written += sizeof(header);
+    if (ok && !index.empty()) {
+        ok = fwrite(&index[0], sizeof(Amf0CatalogEntry), index.size(), f) == index.size();
+        written += index.size() * sizeof(Amf0CatalogEntry);
+    }
+
+    for (std::map<std::string, Amf0Frozen *>::iterator it = entries.begin(); ok && it != entries.end(); ++it) {
+        ok = fwrite(it->first.data(), 1, it->first.size(), f) == it->first.size();
+        written += it->first.size();
+    }
+
+    i = 0;
+    for (std::map<std::string, Amf0Frozen *>::iterator it = entries.begin(); ok && it != entries.end(); ++it, ++i) {
+        uint64_t pad = index[i].block_offset - written;
+        ok = fwrite(zeros, 1, pad, f) == pad && fwrite(it->second->data(), 1, it->second->size(), f) == (size_t)it->second->size();
+        written += pad + it->second->size();
+    }
+
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        ret = ERROR_AMF0_IO;
+    }
+
+    return ret;
+}
+
+Amf0Catalog::Amf0Catalog(const char *base, uint64_t size)
+    : base(base), size(size)
+{
+    const Amf0CatalogHeader *h = (const Amf0CatalogHeader *)base;
+    entries = (const Amf0CatalogEntry *)(base + h->entries_offset);
+    entry_count = h->entry_count;
+}
+
+Amf0Catalog::~Amf0Catalog()
+{
+    munmap((void *)base, size);
+}
+
+Amf0Catalog *Amf0Catalog::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Amf0CatalogHeader)) {
+        close(fd);
+        return nullptr;
+    }
+
+    uint64_t size = st.st_size;
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+
+    // the header and index must hold, the blocks are checked on demand
+    const char *base = (const char *)p;
+    const Amf0CatalogHeader *h = (const Amf0CatalogHeader *)base;
+    bool ok = h->magic == AMF0_CATALOG_MAGIC && h->version == AMF0_CATALOG_VERSION && h->file_size == size
+        && h->entries_offset >= sizeof(Amf0CatalogHeader) && h->entries_offset % 8 == 0
+        && h->entries_offset + (uint64_t)h->entry_count * sizeof(Amf0CatalogEntry) <= size;
+
+    const Amf0CatalogEntry *e = (const Amf0CatalogEntry *)(base + h->entries_offset);
+    for (uint32_t i = 0; ok && i < h->entry_count; ++i) {
+        // offsets are 64 bits from the file, so they are never added up
+        ok = e[i].key_offset <= size && e[i].key_length <= size - e[i].key_offset && e[i].block_offset % 8 == 0
+            && e[i].block_size >= sizeof(Amf0FrozenHeader) && e[i].block_offset <= size
+            && e[i].block_size <= size - e[i].block_offset;
+    }
+
+    if (!ok) {
+        munmap(p, size);
+        return nullptr;
+    }
+
+    return new Amf0Catalog(base, size);
+}
+
+int Amf0Catalog::count()
+{
+    return entry_count;
+}
+
+std::string Amf0Catalog::key_at(int index)
+{
+    if (index < 0 || index >= entry_count) {
+        return std::string();
+    }
+    return std::string(base + entries[index].key_offset, entries[index].key_length);
+}
+
+Amf0FrozenValue Amf0Catalog::value_at(int index)
+{
+    if (index < 0 || index >= entry_count) {
+        return Amf0FrozenValue();
+    }
+
+    const char *block = base + entries[index].block_offset;
+    const Amf0FrozenHeader *h = (const Amf0FrozenHeader *)block;
+    if (h->magic != AMF0_FROZEN_MAGIC || h->size != entries[index].block_size || h->root >= h->node_count) {
+        return Amf0FrozenValue();
+    }
+
+    const Amf0FrozenNode *nodes = (const Amf0FrozenNode *)(block + h->nodes_offset);
+    return Amf0FrozenValue(block, nodes + h->root);
+}
+
+Amf0FrozenValue Amf0Catalog::find(const std::string &key)
+{
+    int lo = 0, hi = entry_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const Amf0CatalogEntry &e = entries[mid];
+
+        // same order as std::string::compare, which sorted the writer's map
+        size_t n = std::min((size_t)e.key_length, key.size());
+        int c = memcmp(base + e.key_offset, key.data(), n);
+        if (c == 0) {
+            c = (e.key_length < key.size()) ? -1 : (e.key_length > key.size() ? 1 : 0);
+        }
+
+        if (c == 0) {
+            return value_at(mid);
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return Amf0FrozenValue();
+}
+
+bool Amf0Catalog::verify()
+{
+    for (int i = 0; i < entry_count; ++i) {
+        if (!Amf0Frozen::verify(base + entries[i].block_offset, entries[i].block_size)) {
+            return false;
+        }
+    }
+    return true;
+}
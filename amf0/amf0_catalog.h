@@ -0,0 +1,90 @@
+#ifndef __AMF0_CATALOG_H__
+#define __AMF0_CATALOG_H__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+#include "amf0_frozen.h"
+
+class Amf0Data;
+
+#define AMF0_CATALOG_MAGIC   0x43304641 // "AF0C"
+#define AMF0_CATALOG_VERSION 1
+
+/**
+ * On-disk catalog of frozen trees keyed by name, e.g. the onMetaData of
+ * every file of a VOD library. Integers are little endian, offsets are
+ * from the start of the file and every block is 8 byte aligned.
+ *
+ *     header | entries[entry_count] sorted by key | keys | frozen blocks
+ */
+struct Amf0CatalogHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    uint32_t entry_count;
+    uint32_t entries_offset;
+    uint64_t reserved;
+};
+
+struct Amf0CatalogEntry
+{
+    uint64_t key_offset;
+    uint32_t key_length;
+    uint32_t block_size;
+    uint64_t block_offset;
+    uint64_t reserved;
+};
+
+class Amf0CatalogWriter
+{
+public:
+    Amf0CatalogWriter();
+    virtual ~Amf0CatalogWriter();
+
+public:
+    // freezes data under key, a later add() of the same key replaces it
+    int add(const std::string &key, Amf0Data *data);
+    // writes to a temporary file and renames it over path
+    int write(const std::string &path);
+
+private:
+    std::map<std::string, Amf0Frozen *> entries;
+};
+
+/**
+ * A catalog opened with mmap: there is no parse step, lookups binary
+ * search the mapped index and hand out views straight into the page
+ * cache, which every process mapping the file shares. open() checks the
+ * header and index, blocks are trusted as written by Amf0CatalogWriter
+ * unless verify() is called.
+ */
+class Amf0Catalog
+{
+public:
+    virtual ~Amf0Catalog();
+
+private:
+    Amf0Catalog(const char *base, uint64_t size);
+
+public:
+    static Amf0Catalog *open(const std::string &path);
+
+public:
+    int count();
+    std::string key_at(int index);
+    Amf0FrozenValue value_at(int index);
+    Amf0FrozenValue find(const std::string &key);
+    // full structural check of every block
+    bool verify();
+
+private:
+    const char *base;
+    uint64_t size;
+    const Amf0CatalogEntry *entries;
+    int entry_count;
+};
+
+#endif /* __AMF0_CATALOG_H__ */
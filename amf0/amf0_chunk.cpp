@@ -0,0 +1,158 @@
+#include "amf0_chunk.h"
+
+#include <assert.h>
+#include <algorithm>
+
+#include "amf_errno.h"
+
+// bytes of a basic header of fmt for csid
+static int rtmp_basic_header(char *p, int fmt, int csid)
+{
+    if (csid < 64) {
+        p[0] = (char)((fmt << 6) | csid);
+        return 1;
+    }
+    if (csid < 320) {
+        p[0] = (char)(fmt << 6);
+        p[1] = (char)(csid - 64);
+        return 2;
+    }
+    p[0] = (char)((fmt << 6) | 1);
+    p[1] = (char)((csid - 64) & 0xff);
+    p[2] = (char)((csid - 64) >> 8);
+    return 3;
+}
+
+ChunkedSimpleBuffer::ChunkedSimpleBuffer(int chunk_size)
+    : _chunk_size(chunk_size > 0 ? chunk_size : RTMP_DEFAULT_CHUNK_SIZE), _in_message(false), _start(0),
+      _length_pos(0), _payload_start(0), _next(0), _headers(0), _payload(0), _continuation_size(0)
+{
+}
+
+ChunkedSimpleBuffer::~ChunkedSimpleBuffer()
+{
+}
+
+void ChunkedSimpleBuffer::set_chunk_size(int chunk_size)
+{
+    assert(!_in_message);
+    if (chunk_size > 0) {
+        _chunk_size = chunk_size;
+    }
+}
+
+int ChunkedSimpleBuffer::chunk_size()
+{
+    return _chunk_size;
+}
+
+void ChunkedSimpleBuffer::begin_message(int csid, uint32_t timestamp, int type, uint32_t stream_id)
+{
+    assert(!_in_message);
+    assert(csid >= 2 && csid <= 65599);
+
+    bool extended = timestamp >= 0xffffff;
+    char basic[3];
+    int basic_size = rtmp_basic_header(basic, 0, csid);
+
+    _start = size();
+    append(basic, basic_size);
+    write_3bytes(extended ? 0xffffff : timestamp);
+    _length_pos = size();
+    write_3bytes(0);
+    write_1byte(type);
+    // the only little endian field of the header
+    char sid[4] = { (char)stream_id, (char)(stream_id >> 8), (char)(stream_id >> 16), (char)(stream_id >> 24) };
+    append(sid, 4);
+    if (extended) {
+        write_4bytes(timestamp);
+    }
+
+    _continuation_size = rtmp_basic_header(_continuation, 3, csid);
+    if (extended) {
+        uint32_t be = __builtin_bswap32(timestamp);
+        memcpy(_continuation + _continuation_size, &be, 4);
+        _continuation_size += 4;
+    }
+
+    _in_message = true;
+    _payload_start = size();
+    _headers = 0;
+    _payload = 0;
+    _next = _payload_start + _chunk_size;
+    set_boundary(_next);
+}
+
+int ChunkedSimpleBuffer::end_message()
+{
+    assert(_in_message);
+
+    _in_message = false;
+    set_boundary(INT32_MAX);
+
+    _payload = size() - _payload_start - _headers * _continuation_size;
+    if (_payload > 0xffffff) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    _data[_length_pos] = (char)(_payload >> 16);
+    _data[_length_pos + 1] = (char)(_payload >> 8);
+    _data[_length_pos + 2] = (char)_payload;
+
+    return ERROR_SUCCESS;
+}
+
+int ChunkedSimpleBuffer::payload_size()
+{
+    if (_in_message) {
+        return size() - _payload_start - _headers * _continuation_size;
+    }
+    return _payload;
+}
+
+void ChunkedSimpleBuffer::write_slow(const char *bytes, int n)
+{
+    if (!_in_message) {
+        SimpleBuffer::write_slow(bytes, n);
+        return;
+    }
+
+    while (n > 0) {
+        // a header only goes in once payload follows the boundary
+        if (_size == _next) {
+            SimpleBuffer::write_slow(_continuation, _continuation_size);
+            _headers++;
+            _next = _size + _chunk_size;
+            set_boundary(_next);
+        }
+
+        int take = std::min(n, _next - _size);
+        SimpleBuffer::write_slow(bytes, take);
+        bytes += take;
+        n -= take;
+    }
+}
+
+void ChunkedSimpleBuffer::set_data(int pos, const char *data, int len)
+{
+    if (!_in_message || pos < _payload_start) {
+        SimpleBuffer::set_data(pos, data, len);
+        return;
+    }
+
+    // pos is a size() taken before a write, at a boundary the header
+    // was not in yet, so it names the first byte after the header
+    int period = _chunk_size + _continuation_size;
+    int q = pos - _payload_start;
+    int k = q / period;
+    int r = q % period;
+    int offset = (r < _chunk_size) ? k * _chunk_size + r : (k + 1) * _chunk_size;
+
+    for (int i = 0; i < len; ++i) {
+        int o = offset + i;
+        int at = _payload_start + o + (o / _chunk_size) * _continuation_size;
+        if (at < _size) {
+            _data[at] = data[i];
+        }
+    }
+}
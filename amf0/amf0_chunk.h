@@ -0,0 +1,68 @@
+#ifndef __AMF0_CHUNK_H__
+#define __AMF0_CHUNK_H__
+
+#include <stdint.h>
+
+#include "simple_buffer.h"
+
+// RTMP message types that carry AMF0
+#define RTMP_MSG_AMF0_DATA    18
+#define RTMP_MSG_AMF0_COMMAND 20
+
+#define RTMP_DEFAULT_CHUNK_SIZE 128
+
+/**
+ * A SimpleBuffer that frames what is written between begin_message() and
+ * end_message() as RTMP chunks on the fly, so a value is encoded straight
+ * into its wire format:
+ *
+ *     ChunkedSimpleBuffer sb(4096);
+ *     sb.begin_message(3, 0, RTMP_MSG_AMF0_COMMAND, 0);
+ *     name.write(&sb);
+ *     ...
+ *     sb.end_message();
+ *
+ * The first chunk gets a type 0 header, every chunk_size payload bytes a
+ * type 3 header is put in, inside a number if need be. Writes between
+ * boundaries take the usual inline path. end_message() patches the
+ * message length, set_data() addresses the payload around the headers.
+ */
+class ChunkedSimpleBuffer : public SimpleBuffer
+{
+public:
+    ChunkedSimpleBuffer(int chunk_size = RTMP_DEFAULT_CHUNK_SIZE);
+    virtual ~ChunkedSimpleBuffer();
+
+public:
+    void set_chunk_size(int chunk_size);
+    int chunk_size();
+    // csid 2 to 65599, timestamps from 0xffffff on use the extended field
+    void begin_message(int csid, uint32_t timestamp, int type, uint32_t stream_id);
+    // ERROR_AMF0_INVALID if the payload is too long for the length field
+    int end_message();
+    // payload bytes of the current or last message
+    int payload_size();
+
+public:
+    virtual void set_data(int pos, const char *data, int len);
+
+protected:
+    virtual void write_slow(const char *bytes, int n);
+
+private:
+    int _chunk_size;
+    bool _in_message;
+    // of the type 0 header and of its length field
+    int _start;
+    int _length_pos;
+    int _payload_start;
+    // where the next type 3 header goes
+    int _next;
+    int _headers;
+    int _payload;
+    // basic header and extended timestamp of every type 3 chunk
+    char _continuation[7];
+    int _continuation_size;
+};
+
+#endif /* __AMF0_CHUNK_H__ */
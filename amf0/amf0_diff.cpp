@@ -0,0 +1,176 @@
+#include "amf0_diff.h"
+
+#include <string.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0.h"
+#include "amf0_cache.h"
+#include "amf0_lazy.h"
+#include "simple_buffer.h"
+
+static bool amf0_is_map(Amf0Data *data)
+{
+    return data && (data->is_object() || data->is_ecma_array());
+}
+
+bool amf0_equal(Amf0Data *a, Amf0Data *b)
+{
+    if (a == b) {
+        return true;
+    }
+    if (!a || !b || a->marker != b->marker) {
+        return false;
+    }
+
+    switch (a->marker) {
+        case AMF0_MARKER::AMF0_MARKER_NUMBER:
+            // by bits, as encoded, so NaN equals NaN and -0 is not 0
+            return memcmp(&((Amf0Number *)a)->value, &((Amf0Number *)b)->value, sizeof(double)) == 0;
+        case AMF0_MARKER::AMF0_MARKER_BOOLEAN:
+            return ((Amf0Boolean *)a)->value == ((Amf0Boolean *)b)->value;
+        case AMF0_MARKER::AMF0_MARKER_STRING:
+            return ((Amf0String *)a)->value == ((Amf0String *)b)->value;
+        case AMF0_MARKER::AMF0_MARKER_OBJECT:
+        case AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY: {
+            int n = amf0_map_count(a);
+            if (n != amf0_map_count(b)) {
+                return false;
+            }
+            for (int i = 0; i < n; ++i) {
+                if (amf0_map_key(a, i) != amf0_map_key(b, i) || !amf0_equal(amf0_map_value(a, i), amf0_map_value(b, i))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY: {
+            Amf0StrictArray *x = (Amf0StrictArray *)a;
+            Amf0StrictArray *y = (Amf0StrictArray *)b;
+            if (x->count() != y->count()) {
+                return false;
+            }
+            for (int i = 0; i < x->count(); ++i) {
+                if (!amf0_equal(x->value_at(i), y->value_at(i))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            // null, undefined and object end carry nothing but the marker
+            return true;
+    }
+}
+
+Amf0Diff::Amf0Diff()
+{
+}
+
+Amf0Diff::~Amf0Diff()
+{
+}
+
+int Amf0Diff::find(const std::string &key, uint64_t hash)
+{
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        int slot = slots[i];
+        if (!slot) {
+            return -1;
+        }
+        if (hashes[slot - 1] == hash && keys[slot - 1] == key) {
+            return slot - 1;
+        }
+    }
+}
+
+int Amf0Diff::diff(Amf0Data *before, Amf0Data *after)
+{
+    events.clear();
+
+    if ((before && !amf0_is_map(before)) || !amf0_is_map(after)) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    int n = before ? amf0_map_count(before) : 0;
+    keys.resize(n);
+    hashes.resize(n);
+    matched.assign(n, 0);
+
+    // at most half full
+    size_t size = 16;
+    while (size < (size_t)n * 2) {
+        size <<= 1;
+    }
+    slots.assign(size, 0);
+
+    for (int i = 0; i < n; ++i) {
+        keys[i] = amf0_map_key(before, i);
+        hashes[i] = amf0_hash(keys[i].data(), keys[i].size());
+
+        size_t j = hashes[i] & (size - 1);
+        while (slots[j]) {
+            j = (j + 1) & (size - 1);
+        }
+        slots[j] = i + 1;
+    }
+
+    Amf0Change change;
+    int m = amf0_map_count(after);
+    for (int i = 0; i < m; ++i) {
+        change.key = amf0_map_key(after, i);
+        change.value = amf0_map_value(after, i);
+
+        int index = find(change.key, amf0_hash(change.key.data(), change.key.size()));
+        if (index >= 0) {
+            matched[index] = 1;
+            if (amf0_equal(amf0_map_value(before, index), change.value)) {
+                continue;
+            }
+        }
+        events.push_back(change);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (!matched[i]) {
+            change.key = keys[i];
+            change.value = nullptr;
+            events.push_back(change);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+const std::vector<Amf0Change> &Amf0Diff::changes()
+{
+    return events;
+}
+
+bool Amf0Diff::empty()
+{
+    return events.empty();
+}
+
+void Amf0Diff::write(SimpleBuffer *sb)
+{
+    for (size_t i = 0; i < events.size(); ++i) {
+        const Amf0Change &e = events[i];
+
+        // type, length of what follows, then the key and for a change the value
+        sb->write_1byte(e.value ? RTMP_SO_EVENT_CHANGE : RTMP_SO_EVENT_REMOVE);
+        int length_pos = sb->size();
+        sb->write_4bytes(0);
+
+        sb->write_2bytes(e.key.size());
+        sb->append(e.key.data(), e.key.size());
+        if (e.value) {
+            e.value->write(sb);
+        }
+
+        int32_t length = sb->size() - length_pos - 4;
+        char be[4] = { (char)(length >> 24), (char)(length >> 16), (char)(length >> 8), (char)length };
+        sb->set_data(length_pos, be, 4);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef __AMF0_DIFF_H__
+#define __AMF0_DIFF_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class Amf0Data;
+class SimpleBuffer;
+
+// RTMP shared object message and the events a diff is sent as
+#define RTMP_MSG_AMF0_SHARED_OBJECT 19
+#define RTMP_SO_EVENT_CHANGE 4
+#define RTMP_SO_EVENT_REMOVE 9
+
+// same type and same encoding, children shared by a clone compare by
+// pointer without being walked
+bool amf0_equal(Amf0Data *a, Amf0Data *b);
+
+struct Amf0Change
+{
+    std::string key;
+    // owned by the newer version, nullptr when the key was removed
+    Amf0Data *value;
+};
+
+/**
+ * Property changes between two versions of a shared object, an
+ * Amf0Object or Amf0EcmaArray each:
+ *
+ *     Amf0Diff diff;
+ *     diff.diff(last_sent, current);
+ *     diff.write(&sb);  // events of the shared object message
+ *
+ * The keys of the older version go into a hash table, so the newer one
+ * is matched in one pass whatever the order. Unchanged values cost one
+ * compare, a pointer compare when the versions were made with clone().
+ * Changes keep the order of the newer version, removals follow in the
+ * order of the older one. Tables are kept between diffs.
+ */
+class Amf0Diff
+{
+public:
+    Amf0Diff();
+    virtual ~Amf0Diff();
+
+public:
+    // before may be nullptr, then every property of after is a change
+    int diff(Amf0Data *before, Amf0Data *after);
+    const std::vector<Amf0Change> &changes();
+    bool empty();
+    // a change event per changed key, a remove event per removed one,
+    // the values stay valid while after is unchanged
+    void write(SimpleBuffer *sb);
+
+private:
+    int find(const std::string &key, uint64_t hash);
+
+private:
+    std::vector<Amf0Change> events;
+    // keys of before with their hash, and which of them after still has
+    std::vector<std::string> keys;
+    std::vector<uint64_t> hashes;
+    std::vector<char> matched;
+    // open addressing, index into keys plus one, zero is empty
+    std::vector<int> slots;
+};
+
+#endif /* __AMF0_DIFF_H__ */
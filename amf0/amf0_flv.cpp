@@ -0,0 +1,330 @@
+#include "amf0_flv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0.h"
+#include "amf0_lazy.h"
+#include "simple_buffer.h"
+
+static uint32_t amf0_flv_be24(const char *p)
+{
+    const uint8_t *u = (const uint8_t *)p;
+    return (u[0] << 16) | (u[1] << 8) | u[2];
+}
+
+static uint32_t amf0_flv_be32(const char *p)
+{
+    const uint8_t *u = (const uint8_t *)p;
+    return ((uint32_t)u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+uint64_t Amf0FlvTag::total() const
+{
+    return AMF0_FLV_TAG_HEADER_SIZE + (uint64_t)data_size + AMF0_FLV_TAG_TRAILER_SIZE;
+}
+
+bool Amf0FlvTag::keyframe() const
+{
+    return type == AMF0_FLV_TAG_VIDEO && data_size > 0 && ((uint8_t)data[0] >> 4) == 1;
+}
+
+bool Amf0FlvTag::on_metadata() const
+{
+    // a short string "onMetaData" first, checked without decoding
+    return type == AMF0_FLV_TAG_SCRIPT && data_size >= 13 && data[0] == AMF0_MARKER::AMF0_MARKER_STRING
+        && data[1] == 0 && data[2] == 10 && memcmp(data + 3, "onMetaData", 10) == 0;
+}
+
+Amf0FlvReader::Amf0FlvReader(int fd, const char *base, uint64_t size, uint64_t body)
+    : _fd(fd), base(base), _size(size), _body(body), pos(body)
+{
+}
+
+Amf0FlvReader::~Amf0FlvReader()
+{
+    munmap((void *)base, _size);
+    close(_fd);
+}
+
+Amf0FlvReader *Amf0FlvReader::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 13) {
+        close(fd);
+        return nullptr;
+    }
+
+    uint64_t size = st.st_size;
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+    madvise(p, size, MADV_SEQUENTIAL);
+
+    // "FLV", version, flags, header size, then PreviousTagSize0
+    const char *base = (const char *)p;
+    uint64_t header = amf0_flv_be32(base + 5);
+    if (memcmp(base, "FLV", 3) != 0 || header < 9 || header + 4 > size) {
+        munmap(p, size);
+        close(fd);
+        return nullptr;
+    }
+
+    return new Amf0FlvReader(fd, base, size, header + 4);
+}
+
+int Amf0FlvReader::decode_script(const Amf0FlvTag &tag, std::vector<Amf0Data *> &values)
+{
+    if (tag.type != AMF0_FLV_TAG_SCRIPT) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    SimpleBuffer sb;
+    sb.append(tag.data, tag.data_size);
+
+    while (!sb.empty()) {
+        Amf0Data *value = Amf0Data::create_amf0data(&sb);
+        if (!value) {
+            return ERROR_AMF0_DECODE;
+        }
+        values.push_back(value);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+bool Amf0FlvReader::next(Amf0FlvTag &tag)
+{
+    if (pos + AMF0_FLV_TAG_HEADER_SIZE > _size) {
+        return false;
+    }
+
+    const char *p = base + pos;
+    uint32_t data_size = amf0_flv_be24(p + 1);
+    if (pos + AMF0_FLV_TAG_HEADER_SIZE + data_size + AMF0_FLV_TAG_TRAILER_SIZE > _size) {
+        return false;
+    }
+
+    tag.type = p[0] & 0x1f;
+    tag.timestamp = amf0_flv_be24(p + 4) | ((uint32_t)(uint8_t)p[7] << 24);
+    tag.offset = pos;
+    tag.data_size = data_size;
+    tag.data = p + AMF0_FLV_TAG_HEADER_SIZE;
+
+    pos += tag.total();
+    return true;
+}
+
+void Amf0FlvReader::rewind()
+{
+    pos = _body;
+}
+
+bool Amf0FlvReader::truncated()
+{
+    return pos != _size;
+}
+
+int Amf0FlvReader::fd()
+{
+    return _fd;
+}
+
+const char *Amf0FlvReader::data()
+{
+    return base;
+}
+
+uint64_t Amf0FlvReader::size()
+{
+    return _size;
+}
+
+uint64_t Amf0FlvReader::body()
+{
+    return _body;
+}
+
+static int amf0_flv_write(int fd, const char *data, uint64_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return ERROR_AMF0_IO;
+        }
+        data += n;
+        len -= n;
+    }
+    return ERROR_SUCCESS;
+}
+
+// copies [offset, offset + len) of in to the position of out, tries
+// copy_file_range (reflinks or server side copies), then sendfile, and
+// writes from the mapping only when the kernel can do neither
+static int amf0_flv_copy(Amf0FlvReader *in, int out, uint64_t offset, uint64_t len)
+{
+    loff_t from = offset;
+    while (len > 0) {
+        ssize_t n = copy_file_range(in->fd(), &from, out, nullptr, len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len -= n;
+    }
+
+    off_t off = from;
+    while (len > 0) {
+        ssize_t n = sendfile(out, in->fd(), &off, len);
+        if (n <= 0) {
+            break;
+        }
+        len -= n;
+    }
+
+    return amf0_flv_write(out, in->data() + off, len);
+}
+
+int amf0_flv_write_metadata(const std::string &in, const std::string &out, Amf0Data *meta, int flags)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!meta || (!meta->is_ecma_array() && !meta->is_object())) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    Amf0FlvReader *reader = Amf0FlvReader::open(in);
+    if (!reader) {
+        return ERROR_AMF0_IO;
+    }
+
+    // one pass over the tag headers, only keyframe positions are kept
+    uint64_t replace_offset = reader->body();
+    uint64_t replace_size = 0;
+    std::vector<uint64_t> positions;
+    std::vector<double> times;
+
+    Amf0FlvTag tag;
+    while (reader->next(tag)) {
+        if (replace_size == 0 && tag.on_metadata()) {
+            replace_offset = tag.offset;
+            replace_size = tag.total();
+        }
+        if ((flags & AMF0_FLV_KEYFRAMES) && tag.keyframe()) {
+            positions.push_back(tag.offset);
+            times.push_back(tag.timestamp / 1000.0);
+        }
+    }
+
+    // numbers are 8 bytes whatever their value, so the tag size is known
+    // before the positions it shifts are filled in
+    std::vector<Amf0Number *> filepositions;
+    Amf0Number *filesize = nullptr;
+
+    if (flags & AMF0_FLV_KEYFRAMES) {
+        Amf0StrictArray *t = new Amf0StrictArray();
+        Amf0StrictArray *p = new Amf0StrictArray();
+        for (size_t i = 0; i < positions.size(); ++i) {
+            t->put(new Amf0Number(times[i]));
+            filepositions.push_back(new Amf0Number());
+            p->put(filepositions.back());
+        }
+
+        Amf0Object *keyframes = new Amf0Object();
+        keyframes->put("times", t);
+        keyframes->put("filepositions", p);
+        amf0_map_put(meta, "keyframes", keyframes);
+    }
+
+    if (flags & AMF0_FLV_FILESIZE) {
+        filesize = new Amf0Number();
+        amf0_map_put(meta, "filesize", filesize);
+    }
+
+    SimpleBuffer script;
+    Amf0String name("onMetaData");
+    name.write(&script);
+    meta->write(&script);
+
+    if (script.size() >= (1 << 24)) {
+        freep(reader);
+        return ERROR_AMF0_INVALID;
+    }
+
+    int64_t delta = (int64_t)(AMF0_FLV_TAG_HEADER_SIZE + script.size() + AMF0_FLV_TAG_TRAILER_SIZE) - (int64_t)replace_size;
+    for (size_t i = 0; i < filepositions.size(); ++i) {
+        filepositions[i]->value = positions[i] < replace_offset ? positions[i] : positions[i] + delta;
+    }
+    if (filesize) {
+        filesize->value = reader->size() + delta;
+    }
+
+    if (!filepositions.empty() || filesize) {
+        script.clear();
+        name.write(&script);
+        meta->write(&script);
+    }
+
+    SimpleBuffer header;
+    header.write_1byte(AMF0_FLV_TAG_SCRIPT);
+    header.write_3bytes(script.size());
+    header.write_3bytes(0);
+    header.write_1byte(0);
+    header.write_3bytes(0);
+
+    SimpleBuffer trailer;
+    trailer.write_4bytes(AMF0_FLV_TAG_HEADER_SIZE + script.size());
+
+    int fd = ::open(out.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        freep(reader);
+        return ERROR_AMF0_IO;
+    }
+
+    // truncating the file that is still mapped would fault the copy, so the
+    // check is on the opened file, whatever path or link led to it
+    struct stat src, dst;
+    if (fstat(reader->fd(), &src) != 0 || fstat(fd, &dst) != 0) {
+        ret = ERROR_AMF0_IO;
+    } else if (src.st_dev == dst.st_dev && src.st_ino == dst.st_ino) {
+        ret = ERROR_AMF0_INVALID;
+    } else if (ftruncate(fd, 0) != 0) {
+        ret = ERROR_AMF0_IO;
+    }
+    if (ret != ERROR_SUCCESS) {
+        close(fd);
+        freep(reader);
+        return ret;
+    }
+
+    if ((ret = amf0_flv_copy(reader, fd, 0, replace_offset)) == ERROR_SUCCESS
+        && (ret = amf0_flv_write(fd, header.data(), header.size())) == ERROR_SUCCESS
+        && (ret = amf0_flv_write(fd, script.data(), script.size())) == ERROR_SUCCESS
+        && (ret = amf0_flv_write(fd, trailer.data(), trailer.size())) == ERROR_SUCCESS) {
+        uint64_t rest = replace_offset + replace_size;
+        ret = amf0_flv_copy(reader, fd, rest, reader->size() - rest);
+    }
+
+    if (close(fd) != 0 && ret == ERROR_SUCCESS) {
+        ret = ERROR_AMF0_IO;
+    }
+
+    freep(reader);
+    return ret;
+}
@@ -0,0 +1,85 @@
+#ifndef __AMF0_FLV_H__
+#define __AMF0_FLV_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class Amf0Data;
+
+#define AMF0_FLV_TAG_AUDIO  8
+#define AMF0_FLV_TAG_VIDEO  9
+#define AMF0_FLV_TAG_SCRIPT 18
+
+// header, data and the back pointer that follows it
+#define AMF0_FLV_TAG_HEADER_SIZE 11
+#define AMF0_FLV_TAG_TRAILER_SIZE 4
+
+// flags of amf0_flv_write_metadata()
+#define AMF0_FLV_KEYFRAMES 0x01 // keyframes: { times, filepositions } of the output
+#define AMF0_FLV_FILESIZE  0x02 // filesize: size of the output
+
+// one tag of a mapped file, data points into the mapping
+struct Amf0FlvTag
+{
+    uint8_t type;
+    uint32_t timestamp;
+    // of the tag header in the file
+    uint64_t offset;
+    uint32_t data_size;
+    const char *data;
+
+    uint64_t total() const;
+    bool keyframe() const;
+    bool on_metadata() const;
+};
+
+/**
+ * Walks the tags of an FLV file mapped read-only, only the pages that are
+ * touched are read in, so the file size does not matter.
+ */
+class Amf0FlvReader
+{
+public:
+    virtual ~Amf0FlvReader();
+
+private:
+    Amf0FlvReader(int fd, const char *base, uint64_t size, uint64_t body);
+
+public:
+    // nullptr when the file cannot be mapped or is not FLV
+    static Amf0FlvReader *open(const std::string &path);
+    // decodes every value of a script tag, the caller frees them
+    static int decode_script(const Amf0FlvTag &tag, std::vector<Amf0Data *> &values);
+
+public:
+    // false at the end of the file or at a tag running past it
+    bool next(Amf0FlvTag &tag);
+    void rewind();
+    // whether next() stopped at a damaged tag instead of the end
+    bool truncated();
+
+public:
+    int fd();
+    const char *data();
+    uint64_t size();
+    // offset of the first tag
+    uint64_t body();
+
+private:
+    int _fd;
+    const char *base;
+    uint64_t _size;
+    uint64_t _body;
+    uint64_t pos;
+};
+
+// writes in to out with meta, an ECMA array or object, as its onMetaData
+// tag. The first onMetaData tag of in is replaced, without one the tag is
+// put before the first tag. flags add fields to meta, which are computed
+// for the output. Every other byte range is copied file to file by the
+// kernel, it never passes through user space. out must not be in, not
+// even through another path, that is ERROR_AMF0_INVALID.
+int amf0_flv_write_metadata(const std::string &in, const std::string &out, Amf0Data *meta, int flags);
+
+#endif /* __AMF0_FLV_H__ */
@@ -0,0 +1,118 @@
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "simple_buffer.h"
+#include "amf0.h"
+#include "amf0_json.h"
+#include "amf0_flv.h"
+#include "amf0_lazy.h"
+
+using namespace std;
+
+static int usage()
+{
+    fprintf(stderr, "usage: amf0_flv info <in.flv>\n");
+    fprintf(stderr, "       amf0_flv inject <in.flv> <out.flv>\n");
+    return 1;
+}
+
+// tag counts, duration and onMetaData as JSON
+static int info(const char *path)
+{
+    Amf0FlvReader *reader = Amf0FlvReader::open(path);
+    if (!reader) {
+        fprintf(stderr, "%s: not an FLV file\n", path);
+        return 1;
+    }
+
+    int audio = 0, video = 0, script = 0, keyframes = 0;
+    uint32_t last = 0;
+    string meta;
+
+    Amf0FlvTag tag;
+    while (reader->next(tag)) {
+        audio += tag.type == AMF0_FLV_TAG_AUDIO;
+        video += tag.type == AMF0_FLV_TAG_VIDEO;
+        script += tag.type == AMF0_FLV_TAG_SCRIPT;
+        keyframes += tag.keyframe();
+        last = max(last, tag.timestamp);
+
+        if (meta.empty() && tag.on_metadata()) {
+            SimpleBuffer sb;
+            sb.append(tag.data, tag.data_size);
+            string name;
+            if (amf0_to_json(&sb, name) != ERROR_SUCCESS || amf0_to_json(&sb, meta) != ERROR_SUCCESS) {
+                meta = "(undecodable)";
+            }
+        }
+    }
+
+    printf("size %llu, audio %d, video %d, script %d, keyframes %d, duration %.3f\n",
+        (unsigned long long)reader->size(), audio, video, script, keyframes, last / 1000.0);
+    if (reader->truncated()) {
+        printf("truncated at a damaged tag\n");
+    }
+    printf("onMetaData %s\n", meta.empty() ? "(none)" : meta.c_str());
+
+    freep(reader);
+    return 0;
+}
+
+// keeps the existing onMetaData and refreshes duration, filesize and keyframes
+static int inject(const char *in, const char *out)
+{
+    Amf0FlvReader *reader = Amf0FlvReader::open(in);
+    if (!reader) {
+        fprintf(stderr, "%s: not an FLV file\n", in);
+        return 1;
+    }
+
+    Amf0Data *meta = nullptr;
+    uint32_t last = 0;
+
+    Amf0FlvTag tag;
+    while (reader->next(tag)) {
+        last = max(last, tag.timestamp);
+
+        vector<Amf0Data *> values;
+        if (!meta && tag.on_metadata() && Amf0FlvReader::decode_script(tag, values) == ERROR_SUCCESS
+            && values.size() >= 2 && (values[1]->is_ecma_array() || values[1]->is_object())) {
+            meta = values[1];
+            values[1] = nullptr;
+        }
+        for (size_t i = 0; i < values.size(); ++i) {
+            freep(values[i]);
+        }
+    }
+    freep(reader);
+
+    if (!meta) {
+        meta = new Amf0EcmaArray();
+    }
+
+    amf0_map_put(meta, "duration", new Amf0Number(last / 1000.0));
+
+    int ret = amf0_flv_write_metadata(in, out, meta, AMF0_FLV_KEYFRAMES | AMF0_FLV_FILESIZE);
+    freep(meta);
+
+    if (ret != ERROR_SUCCESS) {
+        fprintf(stderr, "%s: write failed, ret=%d\n", out, ret);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "info") == 0) {
+        return info(argv[2]);
+    }
+    if (argc == 4 && strcmp(argv[1], "inject") == 0) {
+        return inject(argv[2], argv[3]);
+    }
+    return usage();
+}
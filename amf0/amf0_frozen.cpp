@@ -0,0 +1,377 @@
+#include "amf0_frozen.h"
+
+#include <string.h>
+#include <vector>
+
+#include "amf_core.h"
+#include "amf0.h"
+#include "amf0_allocator.h"
+#include "amf0_lazy.h"
+#include "amf0_simd.h"
+
+Amf0FrozenValue::Amf0FrozenValue()
+    : base(nullptr), node(nullptr)
+{
+}
+
+Amf0FrozenValue::Amf0FrozenValue(const char *base, const Amf0FrozenNode *node)
+    : base(base), node(node)
+{
+}
+
+bool Amf0FrozenValue::valid() const
+{
+    return node != nullptr;
+}
+
+char Amf0FrozenValue::marker() const
+{
+    return node ? node->marker : AMF0_MARKER::AMF0_MARKER_INVALID;
+}
+
+bool Amf0FrozenValue::is_number() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_NUMBER;
+}
+
+bool Amf0FrozenValue::is_boolean() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_BOOLEAN;
+}
+
+bool Amf0FrozenValue::is_string() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_STRING;
+}
+
+bool Amf0FrozenValue::is_object() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_OBJECT;
+}
+
+bool Amf0FrozenValue::is_null() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_NULL;
+}
+
+bool Amf0FrozenValue::is_undefined() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_UNDEFINED;
+}
+
+bool Amf0FrozenValue::is_ecma_array() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY;
+}
+
+bool Amf0FrozenValue::is_strict_array() const
+{
+    return marker() == AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY;
+}
+
+double Amf0FrozenValue::number() const
+{
+    double v = 0;
+    if (is_number()) {
+        memcpy(&v, &node->payload, 8);
+    }
+    return v;
+}
+
+bool Amf0FrozenValue::boolean() const
+{
+    return is_boolean() && node->boolean;
+}
+
+const char *Amf0FrozenValue::string_data() const
+{
+    return is_string() ? base + node->payload : nullptr;
+}
+
+int Amf0FrozenValue::string_size() const
+{
+    return is_string() ? node->count : 0;
+}
+
+std::string Amf0FrozenValue::string() const
+{
+    return is_string() ? std::string(base + node->payload, node->count) : std::string();
+}
+
+int Amf0FrozenValue::count() const
+{
+    if (is_object() || is_ecma_array() || is_strict_array()) {
+        return node->count;
+    }
+    return 0;
+}
+
+Amf0FrozenValue Amf0FrozenValue::value_at(int index) const
+{
+    if (index < 0 || index >= count()) {
+        return Amf0FrozenValue();
+    }
+
+    const Amf0FrozenHeader *h = (const Amf0FrozenHeader *)base;
+    const Amf0FrozenNode *nodes = (const Amf0FrozenNode *)(base + h->nodes_offset);
+    return Amf0FrozenValue(base, nodes + node->payload + index);
+}
+
+Amf0FrozenValue Amf0FrozenValue::value_at(const char *key, int len) const
+{
+    if (count() == 0 || is_strict_array()) {
+        return Amf0FrozenValue();
+    }
+
+    const Amf0FrozenHeader *h = (const Amf0FrozenHeader *)base;
+    const Amf0FrozenNode *child = (const Amf0FrozenNode *)(base + h->nodes_offset) + node->payload;
+    for (int i = 0; i < count(); ++i, ++child) {
+        if ((int)child->key_length == len && amf0_key_equal(base + child->key_offset, key, len)) {
+            return Amf0FrozenValue(base, child);
+        }
+    }
+
+    return Amf0FrozenValue();
+}
+
+Amf0FrozenValue Amf0FrozenValue::value_at(const std::string &key) const
+{
+    return value_at(key.data(), key.size());
+}
+
+std::string Amf0FrozenValue::key_at(int index) const
+{
+    Amf0FrozenValue child = value_at(index);
+    if (!child.valid()) {
+        return std::string();
+    }
+    return std::string(base + child.node->key_offset, child.node->key_length);
+}
+
+namespace {
+
+// breadth first, so the children of every container get consecutive slots
+class Amf0FreezeBuilder
+{
+public:
+    struct Pending
+    {
+        Amf0Data *data;
+        uint32_t index;
+    };
+
+public:
+    uint32_t add_string(const std::string &s)
+    {
+        uint32_t offset = strings.size();
+        strings.append(s);
+        return offset;
+    }
+
+    bool fill(Amf0Data *data, const std::string *key, Amf0FrozenNode &node)
+    {
+        memset(&node, 0, sizeof(node));
+        node.marker = data->marker;
+
+        if (key) {
+            node.key_offset = add_string(*key);
+            node.key_length = key->size();
+        }
+
+        if (data->is_number()) {
+            memcpy(&node.payload, &((Amf0Number *)data)->value, 8);
+        } else if (data->is_boolean()) {
+            node.boolean = ((Amf0Boolean *)data)->value ? 1 : 0;
+        } else if (data->is_string()) {
+            Amf0String *s = (Amf0String *)data;
+            node.payload = add_string(s->value);
+            node.count = s->value.size();
+        } else if (data->is_object() || data->is_ecma_array() || data->marker == AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY) {
+            pending.push_back(Pending());
+            pending.back().data = data;
+            pending.back().index = &node - &nodes[0];
+        } else if (!data->is_null() && !data->is_undefined()) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool build(Amf0Data *root)
+    {
+        nodes.resize(1);
+        if (!fill(root, nullptr, nodes[0])) {
+            return false;
+        }
+
+        for (size_t p = 0; p < pending.size(); ++p) {
+            Amf0Data *data = pending[p].data;
+            uint32_t index = pending[p].index;
+            uint32_t first = nodes.size();
+
+            bool map = data->is_object() || data->is_ecma_array();
+            int n = map ? amf0_map_count(data) : ((Amf0StrictArray *)data)->count();
+
+            nodes[index].payload = first;
+            nodes[index].count = n;
+            nodes.resize(first + n);
+
+            for (int i = 0; i < n; ++i) {
+                bool ok;
+                if (map) {
+                    std::string key = amf0_map_key(data, i);
+                    ok = fill(amf0_map_value(data, i), &key, nodes[first + i]);
+                } else {
+                    ok = fill(((Amf0StrictArray *)data)->value_at(i), nullptr, nodes[first + i]);
+                }
+                if (!ok) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+public:
+    std::vector<Amf0FrozenNode> nodes;
+    std::vector<Pending> pending;
+    std::string strings;
+};
+
+}
+
+Amf0Frozen::Amf0Frozen(char *block, bool owned)
+    : block(block), owned(owned)
+{
+}
+
+Amf0Frozen::~Amf0Frozen()
+{
+    if (owned) {
+        amf0_deallocate(block);
+    }
+    block = nullptr;
+}
+
+Amf0Frozen *Amf0Frozen::freeze(Amf0Data *data)
+{
+    if (!data) {
+        return nullptr;
+    }
+
+    Amf0FreezeBuilder builder;
+    if (!builder.build(data)) {
+        return nullptr;
+    }
+
+    uint32_t nodes_offset = sizeof(Amf0FrozenHeader);
+    uint32_t strings_offset = nodes_offset + builder.nodes.size() * sizeof(Amf0FrozenNode);
+    uint32_t size = strings_offset + builder.strings.size();
+
+    char *block = (char *)amf0_allocate(size);
+
+    Amf0FrozenHeader *h = (Amf0FrozenHeader *)block;
+    h->magic = AMF0_FROZEN_MAGIC;
+    h->version = AMF0_FROZEN_VERSION;
+    h->size = size;
+    h->node_count = builder.nodes.size();
+    h->nodes_offset = nodes_offset;
+    h->strings_offset = strings_offset;
+    h->root = 0;
+    h->reserved = 0;
+
+    // string offsets were relative to the pool, make them block relative
+    Amf0FrozenNode *nodes = (Amf0FrozenNode *)(block + nodes_offset);
+    for (size_t i = 0; i < builder.nodes.size(); ++i) {
+        Amf0FrozenNode n = builder.nodes[i];
+        if (n.key_length > 0) {
+            n.key_offset += strings_offset;
+        }
+        if (n.marker == AMF0_MARKER::AMF0_MARKER_STRING) {
+            n.payload += strings_offset;
+        }
+        nodes[i] = n;
+    }
+    memcpy(block + strings_offset, builder.strings.data(), builder.strings.size());
+
+    return new Amf0Frozen(block, true);
+}
+
+bool Amf0Frozen::verify(const char *block, int size)
+{
+    if (!block || size < (int)sizeof(Amf0FrozenHeader)) {
+        return false;
+    }
+
+    const Amf0FrozenHeader *h = (const Amf0FrozenHeader *)block;
+    if (h->magic != AMF0_FROZEN_MAGIC || h->version != AMF0_FROZEN_VERSION || h->size != (uint32_t)size) {
+        return false;
+    }
+
+    uint64_t nodes_end = (uint64_t)h->nodes_offset + (uint64_t)h->node_count * sizeof(Amf0FrozenNode);
+    if (h->nodes_offset < sizeof(Amf0FrozenHeader) || h->nodes_offset % 8 != 0 || nodes_end > h->strings_offset
+        || h->strings_offset > h->size || h->root >= h->node_count) {
+        return false;
+    }
+
+    const Amf0FrozenNode *nodes = (const Amf0FrozenNode *)(block + h->nodes_offset);
+    for (uint32_t i = 0; i < h->node_count; ++i) {
+        const Amf0FrozenNode &n = nodes[i];
+        if (n.key_length > 0 && (n.key_offset < h->strings_offset || (uint64_t)n.key_offset + n.key_length > h->size)) {
+            return false;
+        }
+
+        switch (n.marker) {
+            case AMF0_MARKER::AMF0_MARKER_STRING:
+                // payload is 64 bits from the block, the sum could wrap
+                if (n.payload < h->strings_offset || n.payload > h->size || n.count > h->size - n.payload) {
+                    return false;
+                }
+                break;
+            case AMF0_MARKER::AMF0_MARKER_OBJECT:
+            case AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY:
+            case AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY:
+                // children always come after their parent, so there are no cycles
+                if (n.count > 0 && (n.payload <= i || n.payload > h->node_count || n.count > h->node_count - n.payload)) {
+                    return false;
+                }
+                break;
+            case AMF0_MARKER::AMF0_MARKER_NUMBER:
+            case AMF0_MARKER::AMF0_MARKER_BOOLEAN:
+            case AMF0_MARKER::AMF0_MARKER_NULL:
+            case AMF0_MARKER::AMF0_MARKER_UNDEFINED:
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+Amf0Frozen *Amf0Frozen::attach(const char *block, int size, bool owned)
+{
+    if (!verify(block, size)) {
+        return nullptr;
+    }
+
+    return new Amf0Frozen((char *)block, owned);
+}
+
+Amf0FrozenValue Amf0Frozen::root() const
+{
+    const Amf0FrozenHeader *h = (const Amf0FrozenHeader *)block;
+    const Amf0FrozenNode *nodes = (const Amf0FrozenNode *)(block + h->nodes_offset);
+    return Amf0FrozenValue(block, nodes + h->root);
+}
+
+const char *Amf0Frozen::data() const
+{
+    return block;
+}
+
+int Amf0Frozen::size() const
+{
+    return ((const Amf0FrozenHeader *)block)->size;
+}
@@ -0,0 +1,122 @@
+#ifndef __AMF0_FROZEN_H__
+#define __AMF0_FROZEN_H__
+
+#include <stdint.h>
+#include <string>
+
+class Amf0Data;
+
+#define AMF0_FROZEN_MAGIC   0x5a304641 // "AF0Z"
+#define AMF0_FROZEN_VERSION 1
+
+/**
+ * Layout of a frozen tree, one contiguous block that only refers to itself
+ * through offsets from its start, so it can be copied, shared or mapped
+ * anywhere. Integers are little endian.
+ *
+ *     header | nodes[node_count] | keys and strings
+ *
+ * The children of a container are consecutive nodes starting at
+ * first_child, each carrying its own key if the parent is an object.
+ */
+struct Amf0FrozenHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t node_count;
+    uint32_t nodes_offset;
+    uint32_t strings_offset;
+    uint32_t root;
+    uint32_t reserved;
+};
+
+struct Amf0FrozenNode
+{
+    uint8_t marker;
+    uint8_t boolean;
+    uint16_t reserved;
+    uint32_t key_offset;
+    uint32_t key_length;
+    // children of a container, bytes of a string
+    uint32_t count;
+    // the number's bits, a string's offset, a container's first child
+    uint64_t payload;
+};
+
+// read-only view of one frozen node, cheap to copy, valid while the
+// block it points into is alive
+class Amf0FrozenValue
+{
+public:
+    Amf0FrozenValue();
+    Amf0FrozenValue(const char *base, const Amf0FrozenNode *node);
+
+public:
+    bool valid() const;
+    char marker() const;
+    bool is_number() const;
+    bool is_boolean() const;
+    bool is_string() const;
+    bool is_object() const;
+    bool is_null() const;
+    bool is_undefined() const;
+    bool is_ecma_array() const;
+    bool is_strict_array() const;
+
+public:
+    double number() const;
+    bool boolean() const;
+    const char *string_data() const;
+    int string_size() const;
+    std::string string() const;
+
+public:
+    // children of objects and arrays
+    int count() const;
+    Amf0FrozenValue value_at(int index) const;
+    Amf0FrozenValue value_at(const char *key, int len) const;
+    Amf0FrozenValue value_at(const std::string &key) const;
+    std::string key_at(int index) const;
+
+private:
+    const char *base;
+    const Amf0FrozenNode *node;
+};
+
+/**
+ * Immutable snapshot of an Amf0Data tree. Nodes, keys and strings live in
+ * a single allocation that is never written after freeze(), so any number
+ * of threads can read it without atomics or locks, and it is released as
+ * one unit.
+ */
+class Amf0Frozen
+{
+public:
+    virtual ~Amf0Frozen();
+
+private:
+    Amf0Frozen(char *block, bool owned);
+    Amf0Frozen(const Amf0Frozen &);
+    Amf0Frozen &operator=(const Amf0Frozen &);
+
+public:
+    // nullptr if the tree holds a type that cannot be frozen
+    static Amf0Frozen *freeze(Amf0Data *data);
+    // validates a block produced by freeze(), e.g. read back from disk,
+    // owned says if the block is released with amf0_deallocate()
+    static Amf0Frozen *attach(const char *block, int size, bool owned);
+    // bounds and structure checks of a block of size bytes
+    static bool verify(const char *block, int size);
+
+public:
+    Amf0FrozenValue root() const;
+    const char *data() const;
+    int size() const;
+
+private:
+    char *block;
+    bool owned;
+};
+
+#endif /* __AMF0_FROZEN_H__ */
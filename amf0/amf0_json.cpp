@@ -0,0 +1,997 @@
+#include "amf0_json.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "simple_buffer.h"
+
+// guards the recursion of both directions against hostile nesting
+#define AMF0_JSON_MAX_DEPTH 128
+
+/**
+ * Grisu2, see Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers", PLDI 2010.
+ */
+namespace {
+
+struct DiyFp
+{
+    DiyFp() : f(0), e(0) {}
+    DiyFp(uint64_t fp, int exp) : f(fp), e(exp) {}
+
+    explicit DiyFp(double d)
+    {
+        uint64_t bits;
+        memcpy(&bits, &d, 8);
+
+        int biased_e = (int)((bits >> 52) & 0x7FF);
+        uint64_t significand = bits & 0x000FFFFFFFFFFFFFULL;
+        if (biased_e != 0) {
+            f = significand + 0x0010000000000000ULL;
+            e = biased_e - 1075;
+        } else {
+            f = significand;
+            e = -1074;
+        }
+    }
+
+    DiyFp operator-(const DiyFp &rhs) const
+    {
+        return DiyFp(f - rhs.f, e);
+    }
+
+    DiyFp operator*(const DiyFp &rhs) const
+    {
+        unsigned __int128 p = (unsigned __int128)f * rhs.f;
+        uint64_t h = (uint64_t)(p >> 64);
+        uint64_t l = (uint64_t)p;
+        if (l & (1ULL << 63)) {
+            h++;
+        }
+        return DiyFp(h, e + rhs.e + 64);
+    }
+
+    DiyFp normalize() const
+    {
+        int s = __builtin_clzll(f);
+        return DiyFp(f << s, e - s);
+    }
+
+    DiyFp normalize_boundary() const
+    {
+        DiyFp r = *this;
+        while (!(r.f & (0x0010000000000000ULL << 1))) {
+            r.f <<= 1;
+            r.e--;
+        }
+        r.f <<= 10;
+        r.e -= 10;
+        return r;
+    }
+
+    void normalized_boundaries(DiyFp *minus, DiyFp *plus) const
+    {
+        DiyFp pl = DiyFp((f << 1) + 1, e - 1).normalize_boundary();
+        DiyFp mi = (f == 0x0010000000000000ULL) ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+        mi.f <<= mi.e - pl.e;
+        mi.e = pl.e;
+        *plus = pl;
+        *minus = mi;
+    }
+
+    uint64_t f;
+    int e;
+};
+
+// normalized 10^k for k = -348, -340, ..., 340
+const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,};
+
+const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,};
+
+const uint64_t pow10_u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+DiyFp cached_power(int e, int *k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0) {
+        ik++;
+    }
+
+    unsigned index = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index * 8));
+
+    return DiyFp(cached_powers_f[index], cached_powers_e[index]);
+}
+
+int count_digits(uint32_t n)
+{
+    int d = 1;
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+void grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+void digit_gen(const DiyFp &w, const DiyFp &mp, uint64_t delta, char *buffer, int *len, int *k)
+{
+    const DiyFp one(1ULL << -mp.e, mp.e);
+    const DiyFp wp_w = mp - w;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = count_digits(p1);
+    *len = 0;
+
+    while (kappa > 0) {
+        uint32_t div = (uint32_t)pow10_u64[kappa - 1];
+        uint32_t d = p1 / div;
+        p1 %= div;
+        if (d || *len) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        kappa--;
+
+        uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+        if (tmp <= delta) {
+            *k += kappa;
+            grisu_round(buffer, *len, delta, tmp, pow10_u64[kappa] << -one.e, wp_w.f);
+            return;
+        }
+    }
+
+    while (true) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *len) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+
+        if (p2 < delta) {
+            *k += kappa;
+            int index = -kappa;
+            grisu_round(buffer, *len, delta, p2, one.f, wp_w.f * (index < 20 ? pow10_u64[index] : 0));
+            return;
+        }
+    }
+}
+
+void grisu2(double value, char *buffer, int *len, int *k)
+{
+    const DiyFp v(value);
+    DiyFp w_m, w_p;
+    v.normalized_boundaries(&w_m, &w_p);
+
+    const DiyFp c_mk = cached_power(w_p.e, k);
+    const DiyFp w = v.normalize() * c_mk;
+    DiyFp wp = w_p * c_mk;
+    DiyFp wm = w_m * c_mk;
+    wm.f++;
+    wp.f--;
+
+    digit_gen(w, wp, wp.f - wm.f, buffer, len, k);
+}
+
+int write_exponent(int k, char *buf)
+{
+    char *p = buf;
+    if (k < 0) {
+        *p++ = '-';
+        k = -k;
+    }
+
+    if (k >= 100) {
+        *p++ = (char)('0' + k / 100);
+        k %= 100;
+        *p++ = (char)('0' + k / 10);
+        *p++ = (char)('0' + k % 10);
+    } else if (k >= 10) {
+        *p++ = (char)('0' + k / 10);
+        *p++ = (char)('0' + k % 10);
+    } else {
+        *p++ = (char)('0' + k);
+    }
+
+    return p - buf;
+}
+
+// lays the digits out as JavaScript does: 1e21, 123.45, 0.000123, 1.5e-7
+int prettify(char *buf, int len, int k)
+{
+    int kk = len + k; // 10^(kk-1) <= v < 10^kk
+
+    if (k >= 0 && kk <= 21) {
+        for (int i = len; i < kk; i++) {
+            buf[i] = '0';
+        }
+        return kk;
+    }
+
+    if (kk > 0 && kk <= 21) {
+        memmove(&buf[kk + 1], &buf[kk], len - kk);
+        buf[kk] = '.';
+        return len + 1;
+    }
+
+    if (kk > -6 && kk <= 0) {
+        int offset = 2 - kk;
+        memmove(&buf[offset], &buf[0], len);
+        buf[0] = '0';
+        buf[1] = '.';
+        for (int i = 2; i < offset; i++) {
+            buf[i] = '0';
+        }
+        return len + offset;
+    }
+
+    if (len == 1) {
+        buf[1] = 'e';
+        return 2 + write_exponent(kk - 1, &buf[2]);
+    }
+
+    memmove(&buf[2], &buf[1], len - 1);
+    buf[1] = '.';
+    buf[len + 1] = 'e';
+    return len + 2 + write_exponent(kk - 1, &buf[len + 2]);
+}
+
+}
+
+int amf0_dtoa(double value, char *buf)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, 8);
+
+    if ((bits & 0x7FF0000000000000ULL) == 0x7FF0000000000000ULL) {
+        memcpy(buf, "null", 4);
+        return 4;
+    }
+
+    char *p = buf;
+    if (bits >> 63) {
+        *p++ = '-';
+        value = -value;
+    }
+
+    if (value == 0) {
+        *p++ = '0';
+        return p - buf;
+    }
+
+    int len = 0, k = 0;
+    grisu2(value, p, &len, &k);
+
+    return (p - buf) + prettify(p, len, k);
+}
+
+namespace {
+
+/**
+ * JSON escapes, 0 means the byte is copied as is, 'u' means \u00XX,
+ * anything else is the letter after the backslash.
+ */
+const char json_escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 'u',
+};
+
+const char hex_digits[] = "0123456789abcdef";
+
+// appends into a string that was sized up front, growing only if the
+// estimate was too small, the real size is applied by finish()
+class JsonOut
+{
+public:
+    JsonOut(std::string &s, size_t estimate) : out(s), n(s.size())
+    {
+        out.resize(n + estimate);
+    }
+
+    char *reserve(size_t k)
+    {
+        if (n + k > out.size()) {
+            out.resize(std::max(out.size() * 2, n + k));
+        }
+        return &out[n];
+    }
+
+    void put(char c)
+    {
+        *reserve(1) = c;
+        n++;
+    }
+
+    void put(const char *p, size_t k)
+    {
+        memcpy(reserve(k), p, k);
+        n += k;
+    }
+
+    void finish()
+    {
+        out.resize(n);
+    }
+
+public:
+    std::string &out;
+    size_t n;
+};
+
+int put_string(JsonOut &o, const char *s, int len)
+{
+    // worst case every byte becomes \u00XX, counted in 64 bits as a long
+    // string would overflow an int
+    uint64_t worst = (uint64_t)len * 6 + 2;
+    if (worst > o.out.max_size() - o.n) {
+        return ERROR_AMF0_INVALID;
+    }
+    char *p = o.reserve(worst);
+    char *start = p;
+
+    *p++ = '"';
+    for (int i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        char e = json_escape[c];
+        if (!e) {
+            *p++ = (char)c;
+        } else if (e == 'u') {
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = '0';
+            *p++ = '0';
+            *p++ = hex_digits[c >> 4];
+            *p++ = hex_digits[c & 0xF];
+        } else {
+            *p++ = '\\';
+            *p++ = e;
+        }
+    }
+    *p++ = '"';
+
+    o.n += p - start;
+    return ERROR_SUCCESS;
+}
+
+void put_number(JsonOut &o, double v)
+{
+    char *p = o.reserve(25);
+    o.n += amf0_dtoa(v, p);
+}
+
+double read_double(SimpleBuffer *sb)
+{
+    int64_t temp = sb->read_8bytes();
+    double v;
+    memcpy(&v, &temp, 8);
+    return v;
+}
+
+int value_to_json(SimpleBuffer *sb, JsonOut &o, int depth);
+
+// key/value pairs up to the 00 00 09 terminator
+int properties_to_json(SimpleBuffer *sb, JsonOut &o, int depth)
+{
+    int ret = ERROR_SUCCESS;
+
+    o.put('{');
+    for (bool first = true; ; first = false) {
+        if (!sb->require(3)) {
+            return ERROR_AMF0_DECODE;
+        }
+
+        int len = (uint16_t)sb->read_2bytes();
+        if (len == 0) {
+            if (sb->read_1byte() != AMF0_MARKER::AMF0_MARKER_OBJECT_END) {
+                return ERROR_AMF0_DECODE;
+            }
+            break;
+        }
+
+        if (!sb->require(len)) {
+            return ERROR_AMF0_DECODE;
+        }
+
+        if (!first) {
+            o.put(',');
+        }
+        if ((ret = put_string(o, sb->data() + sb->pos(), len)) != ERROR_SUCCESS) {
+            return ret;
+        }
+        sb->skip(len);
+        o.put(':');
+
+        if ((ret = value_to_json(sb, o, depth + 1)) != ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+    o.put('}');
+
+    return ret;
+}
+
+int value_to_json(SimpleBuffer *sb, JsonOut &o, int depth)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (depth > AMF0_JSON_MAX_DEPTH || !sb->require(1)) {
+        return ERROR_AMF0_DECODE;
+    }
+
+    char marker = sb->read_1byte();
+    switch (marker) {
+        case AMF0_MARKER::AMF0_MARKER_NUMBER: {
+            if (!sb->require(8)) {
+                return ERROR_AMF0_DECODE;
+            }
+            put_number(o, read_double(sb));
+            break;
+        }
+        case AMF0_MARKER::AMF0_MARKER_BOOLEAN: {
+            if (!sb->require(1)) {
+                return ERROR_AMF0_DECODE;
+            }
+            if (sb->read_1byte()) {
+                o.put("true", 4);
+            } else {
+                o.put("false", 5);
+            }
+            break;
+        }
+        case AMF0_MARKER::AMF0_MARKER_STRING:
+        case AMF0_MARKER::AMF0_MARKER_LONG_STRING: {
+            int len;
+            if (marker == AMF0_MARKER::AMF0_MARKER_STRING) {
+                if (!sb->require(2)) {
+                    return ERROR_AMF0_DECODE;
+                }
+                len = (uint16_t)sb->read_2bytes();
+            } else {
+                if (!sb->require(4)) {
+                    return ERROR_AMF0_DECODE;
+                }
+                len = sb->read_4bytes();
+            }
+
+            if (len < 0 || !sb->require(len)) {
+                return ERROR_AMF0_DECODE;
+            }
+            if ((ret = put_string(o, sb->data() + sb->pos(), len)) != ERROR_SUCCESS) {
+                return ret;
+            }
+            sb->skip(len);
+            break;
+        }
+        case AMF0_MARKER::AMF0_MARKER_OBJECT: {
+            ret = properties_to_json(sb, o, depth);
+            break;
+        }
+        case AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY: {
+            // the count is only a hint, the terminator ends the array
+            if (!sb->require(4)) {
+                return ERROR_AMF0_DECODE;
+            }
+            sb->skip(4);
+            ret = properties_to_json(sb, o, depth);
+            break;
+        }
+        case AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY: {
+            if (!sb->require(4)) {
+                return ERROR_AMF0_DECODE;
+            }
+
+            int32_t count = sb->read_4bytes();
+            o.put('[');
+            for (int32_t i = 0; i < count; ++i) {
+                if (i) {
+                    o.put(',');
+                }
+                if ((ret = value_to_json(sb, o, depth + 1)) != ERROR_SUCCESS) {
+                    return ret;
+                }
+            }
+            o.put(']');
+            break;
+        }
+        case AMF0_MARKER::AMF0_MARKER_NULL:
+        case AMF0_MARKER::AMF0_MARKER_UNDEFINED: {
+            o.put("null", 4);
+            break;
+        }
+        case AMF0_MARKER::AMF0_MARKER_DATE: {
+            if (!sb->require(10)) {
+                return ERROR_AMF0_DECODE;
+            }
+            put_number(o, read_double(sb));
+            sb->skip(2); // time zone, reserved
+            break;
+        }
+        default:
+            return ERROR_AMF0_DECODE;
+    }
+
+    return ret;
+}
+
+}
+
+int amf0_to_json(SimpleBuffer *sb, std::string &json)
+{
+    int remain = sb->size() - sb->pos();
+    JsonOut o(json, remain * 2 + 16);
+
+    int ret = value_to_json(sb, o, 0);
+    o.finish();
+
+    return ret;
+}
+
+namespace {
+
+const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+class JsonParser
+{
+public:
+    JsonParser(const char *json, int len, SimpleBuffer *buf)
+        : p(json), end(json + len), sb(buf)
+    {
+    }
+
+public:
+    int parse_value(int depth);
+    void skip_ws()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            p++;
+        }
+    }
+
+private:
+    int parse_string(std::string &s);
+    int parse_number();
+    int parse_literal(const char *word, int len);
+    int parse_hex4(uint32_t &cp);
+
+public:
+    const char *p;
+    const char *end;
+    SimpleBuffer *sb;
+};
+
+int JsonParser::parse_literal(const char *word, int len)
+{
+    if (end - p < len || memcmp(p, word, len) != 0) {
+        return ERROR_AMF0_INVALID;
+    }
+    p += len;
+    return ERROR_SUCCESS;
+}
+
+int JsonParser::parse_hex4(uint32_t &cp)
+{
+    if (end - p < 4) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    cp = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = *p++;
+        cp <<= 4;
+        if (c >= '0' && c <= '9') {
+            cp |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            cp |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            cp |= c - 'A' + 10;
+        } else {
+            return ERROR_AMF0_INVALID;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+int JsonParser::parse_string(std::string &s)
+{
+    int ret = ERROR_SUCCESS;
+
+    p++; // opening quote
+    s.clear();
+
+    while (true) {
+        // copy the run of plain bytes in one go
+        const char *run = p;
+        while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) {
+            p++;
+        }
+        s.append(run, p - run);
+
+        if (p >= end || (unsigned char)*p < 0x20) {
+            return ERROR_AMF0_INVALID;
+        }
+
+        if (*p == '"') {
+            p++;
+            return ret;
+        }
+
+        p++; // backslash
+        if (p >= end) {
+            return ERROR_AMF0_INVALID;
+        }
+
+        char c = *p++;
+        switch (c) {
+            case '"': s.push_back('"'); break;
+            case '\\': s.push_back('\\'); break;
+            case '/': s.push_back('/'); break;
+            case 'b': s.push_back('\b'); break;
+            case 'f': s.push_back('\f'); break;
+            case 'n': s.push_back('\n'); break;
+            case 'r': s.push_back('\r'); break;
+            case 't': s.push_back('\t'); break;
+            case 'u': {
+                uint32_t cp;
+                if ((ret = parse_hex4(cp)) != ERROR_SUCCESS) {
+                    return ret;
+                }
+
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    uint32_t lo;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+                        return ERROR_AMF0_INVALID;
+                    }
+                    p += 2;
+                    if ((ret = parse_hex4(lo)) != ERROR_SUCCESS) {
+                        return ret;
+                    }
+                    if (lo < 0xDC00 || lo > 0xDFFF) {
+                        return ERROR_AMF0_INVALID;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return ERROR_AMF0_INVALID;
+                }
+
+                if (cp < 0x80) {
+                    s.push_back((char)cp);
+                } else if (cp < 0x800) {
+                    s.push_back((char)(0xC0 | (cp >> 6)));
+                    s.push_back((char)(0x80 | (cp & 0x3F)));
+                } else if (cp < 0x10000) {
+                    s.push_back((char)(0xE0 | (cp >> 12)));
+                    s.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                    s.push_back((char)(0x80 | (cp & 0x3F)));
+                } else {
+                    s.push_back((char)(0xF0 | (cp >> 18)));
+                    s.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+                    s.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                    s.push_back((char)(0x80 | (cp & 0x3F)));
+                }
+                break;
+            }
+            default:
+                return ERROR_AMF0_INVALID;
+        }
+    }
+}
+
+int JsonParser::parse_number()
+{
+    const char *start = p;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+
+    if (*p == '-') {
+        negative = true;
+        p++;
+    }
+
+    if (p >= end || *p < '0' || *p > '9') {
+        return ERROR_AMF0_INVALID;
+    }
+
+    // leading zeros are not significant digits
+    if (*p == '0') {
+        p++;
+    } else {
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+            } else {
+                exp10++;
+            }
+            digits++;
+        }
+    }
+
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || *p < '0' || *p > '9') {
+            return ERROR_AMF0_INVALID;
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (mantissa == 0 && *p == '0') {
+                exp10--;
+                continue;
+            }
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exp10--;
+            }
+            digits++;
+        }
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool exp_negative = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            exp_negative = (*p == '-');
+            p++;
+        }
+        if (p >= end || *p < '0' || *p > '9') {
+            return ERROR_AMF0_INVALID;
+        }
+
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (e < 100000) {
+                e = e * 10 + (*p - '0');
+            }
+        }
+        exp10 += exp_negative ? -e : e;
+    }
+
+    double value;
+    if (digits <= 19 && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        // exact: both operands are representable, one rounding (Clinger)
+        value = (double)mantissa;
+        value = exp10 < 0 ? value / pow10_exact[-exp10] : value * pow10_exact[exp10];
+        if (negative) {
+            value = -value;
+        }
+    } else {
+        std::string token(start, p - start);
+        value = strtod(token.c_str(), nullptr);
+    }
+
+    int64_t temp;
+    memcpy(&temp, &value, 8);
+    sb->write_1byte(AMF0_MARKER::AMF0_MARKER_NUMBER);
+    sb->write_8bytes(temp);
+
+    return ERROR_SUCCESS;
+}
+
+int JsonParser::parse_value(int depth)
+{
+    int ret = ERROR_SUCCESS;
+
+    skip_ws();
+    if (depth > AMF0_JSON_MAX_DEPTH || p >= end) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    switch (*p) {
+        case '{': {
+            p++;
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT);
+
+            std::string key;
+            skip_ws();
+            if (p < end && *p == '}') {
+                p++;
+            } else {
+                while (true) {
+                    skip_ws();
+                    if (p >= end || *p != '"') {
+                        return ERROR_AMF0_INVALID;
+                    }
+                    if ((ret = parse_string(key)) != ERROR_SUCCESS) {
+                        return ret;
+                    }
+                    // an empty key would read as the object end marker
+                    if (key.empty() || key.size() > 0xFFFF) {
+                        return ERROR_AMF0_INVALID;
+                    }
+
+                    skip_ws();
+                    if (p >= end || *p++ != ':') {
+                        return ERROR_AMF0_INVALID;
+                    }
+
+                    sb->write_2bytes((int16_t)key.size());
+                    sb->write_string(key);
+                    if ((ret = parse_value(depth + 1)) != ERROR_SUCCESS) {
+                        return ret;
+                    }
+
+                    skip_ws();
+                    if (p < end && *p == ',') {
+                        p++;
+                        continue;
+                    }
+                    if (p < end && *p == '}') {
+                        p++;
+                        break;
+                    }
+                    return ERROR_AMF0_INVALID;
+                }
+            }
+
+            sb->write_2bytes(0x00);
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT_END);
+            break;
+        }
+        case '[': {
+            p++;
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY);
+
+            // the count is patched once the array is closed
+            int count_pos = sb->size();
+            int32_t count = 0;
+            sb->write_4bytes(0);
+
+            skip_ws();
+            if (p < end && *p == ']') {
+                p++;
+            } else {
+                while (true) {
+                    if ((ret = parse_value(depth + 1)) != ERROR_SUCCESS) {
+                        return ret;
+                    }
+                    count++;
+
+                    skip_ws();
+                    if (p < end && *p == ',') {
+                        p++;
+                        continue;
+                    }
+                    if (p < end && *p == ']') {
+                        p++;
+                        break;
+                    }
+                    return ERROR_AMF0_INVALID;
+                }
+            }
+
+            char be[4] = { (char)(count >> 24), (char)(count >> 16), (char)(count >> 8), (char)count };
+            sb->set_data(count_pos, be, 4);
+            break;
+        }
+        case '"': {
+            std::string s;
+            if ((ret = parse_string(s)) != ERROR_SUCCESS) {
+                return ret;
+            }
+
+            if (s.size() > 0xFFFF) {
+                sb->write_1byte(AMF0_MARKER::AMF0_MARKER_LONG_STRING);
+                sb->write_4bytes((int32_t)s.size());
+            } else {
+                sb->write_1byte(AMF0_MARKER::AMF0_MARKER_STRING);
+                sb->write_2bytes((int16_t)s.size());
+            }
+            sb->write_string(s);
+            break;
+        }
+        case 't': {
+            if ((ret = parse_literal("true", 4)) != ERROR_SUCCESS) {
+                return ret;
+            }
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_BOOLEAN);
+            sb->write_1byte(0x01);
+            break;
+        }
+        case 'f': {
+            if ((ret = parse_literal("false", 5)) != ERROR_SUCCESS) {
+                return ret;
+            }
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_BOOLEAN);
+            sb->write_1byte(0x00);
+            break;
+        }
+        case 'n': {
+            if ((ret = parse_literal("null", 4)) != ERROR_SUCCESS) {
+                return ret;
+            }
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_NULL);
+            break;
+        }
+        default:
+            ret = parse_number();
+            break;
+    }
+
+    return ret;
+}
+
+}
+
+int json_to_amf0(const char *json, int len, SimpleBuffer *sb)
+{
+    int ret = ERROR_SUCCESS;
+
+    JsonParser parser(json, len, sb);
+    if ((ret = parser.parse_value(0)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    parser.skip_ws();
+    if (parser.p != parser.end) {
+        return ERROR_AMF0_INVALID;
+    }
+
+    return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef __AMF0_JSON_H__
+#define __AMF0_JSON_H__
+
+#include <string>
+
+class SimpleBuffer;
+
+// converts the next AMF0 value in sb straight to JSON text appended to json,
+// objects and ECMA arrays become JSON objects, strict arrays JSON arrays,
+// null and undefined become null, dates their millisecond timestamp.
+int amf0_to_json(SimpleBuffer *sb, std::string &json);
+
+// parses one JSON value and appends its AMF0 encoding to sb,
+// objects become AMF0 objects and arrays strict arrays.
+int json_to_amf0(const char *json, int len, SimpleBuffer *sb);
+
+// shortest digits that round-trip value (Grisu2), written without a
+// terminating zero, returns the length, buf needs 25 bytes.
+// NaN and infinities are written as null since JSON cannot carry them.
+int amf0_dtoa(double value, char *buf);
+
+#endif /* __AMF0_JSON_H__ */
@@ -0,0 +1,308 @@
+#include "amf0_lazy.h"
+
+#include <assert.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0_simd.h"
+#include "amf0_stats.h"
+#include "amf0_trace.h"
+#include "simple_buffer.h"
+
+// shared_ptr control blocks come from the same allocator as the nodes
+static std::shared_ptr<Amf0Data> amf0_lazy_shared(Amf0Data *value)
+{
+    return std::shared_ptr<Amf0Data>(value, std::default_delete<Amf0Data>(), Amf0StlAllocator<Amf0Data>());
+}
+
+Amf0LazyObject::Amf0LazyObject()
+    : touched(0), validate_utf8(false)
+{
+    marker = AMF0_MARKER::AMF0_MARKER_OBJECT;
+}
+
+Amf0LazyObject::~Amf0LazyObject()
+{
+    clear();
+}
+
+void Amf0LazyObject::clear()
+{
+    slots.clear();
+    raw.clear();
+    touched = 0;
+}
+
+void Amf0LazyObject::put(std::string key, Amf0Data *value)
+{
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (key_at(i) == key) {
+            Slot &slot = slots[i];
+            if (!slot.value) {
+                touched++;
+            }
+            slot.value = amf0_lazy_shared(value);
+            return;
+        }
+    }
+
+    Slot slot;
+    slot.key_pos = -1;
+    slot.key_len = key.size();
+    slot.value_pos = -1;
+    slot.value_len = 0;
+    slot.key = key;
+    slot.value = amf0_lazy_shared(value);
+    slots.push_back(slot);
+    touched++;
+}
+
+std::string Amf0LazyObject::key_at(int index)
+{
+    assert(index >= 0 && index < (int)slots.size());
+
+    const Slot &slot = slots[index];
+    if (slot.key_pos < 0) {
+        return slot.key;
+    }
+    return std::string(raw.data() + slot.key_pos, slot.key_len);
+}
+
+Amf0Data *Amf0LazyObject::value_at(std::string key)
+{
+    const char *k = key.data();
+    int n = key.size();
+
+    for (size_t i = 0; i < slots.size(); ++i) {
+        const Slot &slot = slots[i];
+        if (slot.key_len != n) {
+            continue;
+        }
+
+        const char *name = slot.key_pos < 0 ? slot.key.data() : raw.data() + slot.key_pos;
+        if (amf0_key_equal(name, k, n)) {
+            return value_at(i);
+        }
+    }
+
+    return nullptr;
+}
+
+Amf0Data *Amf0LazyObject::value_at(int index)
+{
+    assert(index >= 0 && index < (int)slots.size());
+
+    Slot &slot = slots[index];
+    if (slot.value) {
+        return slot.value.get();
+    }
+
+    // measured by read(), so the decode cannot run short
+    SimpleBuffer sb;
+    sb.append(raw.data() + slot.value_pos, slot.value_len);
+    Amf0DecodeContext ctx;
+    ctx.validate_utf8 = validate_utf8;
+    Amf0Data *value = Amf0Data::create_amf0data(&sb, &ctx);
+    if (value) {
+        slot.value = amf0_lazy_shared(value);
+        touched++;
+    }
+
+    return value;
+}
+
+Amf0Data *Amf0LazyObject::mutable_value_at(std::string key)
+{
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (key_at(i) == key) {
+            return mutable_value_at(i);
+        }
+    }
+    return nullptr;
+}
+
+Amf0Data *Amf0LazyObject::mutable_value_at(int index)
+{
+    if (!value_at(index)) {
+        return nullptr;
+    }
+
+    // shared with a clone or the object it was cloned from
+    std::shared_ptr<Amf0Data> &value = slots[index].value;
+    if (value.use_count() > 1) {
+        value = amf0_lazy_shared(value->clone());
+    }
+    return value.get();
+}
+
+int Amf0LazyObject::count()
+{
+    return slots.size();
+}
+
+int Amf0LazyObject::materialized()
+{
+    return touched;
+}
+
+int Amf0LazyObject::read(SimpleBuffer *sb)
+{
+    return decode(sb, nullptr);
+}
+
+int Amf0LazyObject::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    AMF0_TRACE_SPAN("Amf0LazyObject::read");
+    int ret = ERROR_SUCCESS;
+
+    clear();
+
+    const char *p = sb->data() + sb->pos();
+    int n = sb->size() - sb->pos();
+    if (n < 1 || p[0] != AMF0_MARKER::AMF0_MARKER_OBJECT) {
+        ret = ERROR_AMF0_DECODE;
+        return ret;
+    }
+
+    int size = amf0_value_size(p, n);
+    if (size < 0) {
+        ret = ERROR_AMF0_DECODE;
+        return ret;
+    }
+
+    // decoded on its own it is a message of its own
+    if (ctx && ctx->depth == 0) {
+        ctx->reset();
+    }
+    if (ctx && (ret = ctx->charge(sb, 0, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    // the measure above already checked every length on the way
+    raw.assign(p, size);
+    validate_utf8 = ctx && ctx->validate_utf8;
+    int pos = 1;
+    while (true) {
+        int len = ((uint8_t)raw[pos] << 8) | (uint8_t)raw[pos + 1];
+        if (len == 0) {
+            break;
+        }
+
+        if (validate_utf8 && !amf0_utf8_valid(raw.data() + pos + 2, len)) {
+            clear();
+            ret = ERROR_AMF0_UTF8;
+            return ret;
+        }
+
+        Slot slot;
+        slot.key_pos = pos + 2;
+        slot.key_len = len;
+        slot.value_pos = slot.key_pos + len;
+        slot.value_len = amf0_value_size(raw.data() + slot.value_pos, size - slot.value_pos);
+        slots.push_back(slot);
+
+        pos = slot.value_pos + slot.value_len;
+    }
+
+    sb->skip(size);
+    return ret;
+}
+
+int Amf0LazyObject::write(SimpleBuffer *sb)
+{
+    AMF0_TRACE_SPAN("Amf0LazyObject::write");
+    AMF0_STATS_ENCODE_BEGIN(sb);
+    AMF0_STATS_ENCODED(marker);
+
+    if (touched == 0) {
+        if (raw.empty()) {
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT);
+            sb->write_2bytes(0);
+            sb->write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT_END);
+        } else {
+            sb->append(raw.data(), raw.size());
+        }
+
+        AMF0_STATS_ENCODE_END(sb);
+        return 0;
+    }
+
+    sb->write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT);
+
+    for (size_t i = 0; i < slots.size(); ++i) {
+        const Slot &slot = slots[i];
+
+        if (slot.key_pos < 0) {
+            sb->write_2bytes(slot.key_len);
+            sb->append(slot.key.data(), slot.key_len);
+        } else {
+            // the length prefix sits right before the key
+            sb->append(raw.data() + slot.key_pos - 2, slot.key_len + 2);
+        }
+
+        // a decoded value may have been changed through its pointer
+        if (slot.value) {
+            slot.value->write(sb);
+        } else {
+            sb->append(raw.data() + slot.value_pos, slot.value_len);
+        }
+    }
+
+    sb->write_2bytes(0);
+    sb->write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT_END);
+
+    AMF0_STATS_ENCODE_END(sb);
+
+    return 0;
+}
+
+Amf0Data *Amf0LazyObject::clone()
+{
+    Amf0LazyObject *copy = new Amf0LazyObject();
+    copy->raw = raw;
+    copy->slots = slots;
+    copy->touched = touched;
+    copy->validate_utf8 = validate_utf8;
+    return copy;
+}
+
+int amf0_map_count(Amf0Data *data)
+{
+    if (data->is_ecma_array()) {
+        return ((Amf0EcmaArray *)data)->count();
+    }
+    Amf0LazyObject *lazy = dynamic_cast<Amf0LazyObject *>(data);
+    return lazy ? lazy->count() : ((Amf0Object *)data)->count();
+}
+
+std::string amf0_map_key(Amf0Data *data, int index)
+{
+    if (data->is_ecma_array()) {
+        return ((Amf0EcmaArray *)data)->key_at(index);
+    }
+    Amf0LazyObject *lazy = dynamic_cast<Amf0LazyObject *>(data);
+    return lazy ? lazy->key_at(index) : ((Amf0Object *)data)->key_at(index);
+}
+
+Amf0Data *amf0_map_value(Amf0Data *data, int index)
+{
+    if (data->is_ecma_array()) {
+        return ((Amf0EcmaArray *)data)->value_at(index);
+    }
+    Amf0LazyObject *lazy = dynamic_cast<Amf0LazyObject *>(data);
+    return lazy ? lazy->value_at(index) : ((Amf0Object *)data)->value_at(index);
+}
+
+void amf0_map_put(Amf0Data *data, std::string key, Amf0Data *value)
+{
+    if (data->is_ecma_array()) {
+        ((Amf0EcmaArray *)data)->put(key, value);
+        return;
+    }
+    Amf0LazyObject *lazy = dynamic_cast<Amf0LazyObject *>(data);
+    if (lazy) {
+        lazy->put(key, value);
+    } else {
+        ((Amf0Object *)data)->put(key, value);
+    }
+}
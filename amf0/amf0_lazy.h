@@ -0,0 +1,76 @@
+#ifndef __AMF0_LAZY_H__
+#define __AMF0_LAZY_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "amf0.h"
+
+/**
+ * An object that decodes only what is asked for. read() keeps a copy of
+ * the encoded object and the position of every key and value, measured
+ * with amf0_value_size(), no node is built. A value is decoded on its
+ * first value_at() and kept. write() copies every value never handed
+ * out straight from the original bytes, and the whole object in one go
+ * while nothing was touched.
+ *
+ * Unlike Amf0Object a missing object end is an error, the values must be
+ * measured before any is decoded.
+ */
+class Amf0LazyObject : public Amf0Data
+{
+public:
+    Amf0LazyObject();
+    virtual ~Amf0LazyObject();
+
+public:
+    void put(std::string key, Amf0Data *value);
+    std::string key_at(int index);
+    Amf0Data *value_at(std::string key);
+    Amf0Data *value_at(int index);
+    // copy on write access for clones, nullptr if the key is absent
+    Amf0Data *mutable_value_at(std::string key);
+    Amf0Data *mutable_value_at(int index);
+    int count();
+    // values decoded so far, by value_at() or put()
+    int materialized();
+
+public:
+    virtual int read(SimpleBuffer *sb);
+    // charges the node and its encoded bytes, values decoded later are not
+    virtual int decode(SimpleBuffer *sb, Amf0DecodeContext *ctx);
+    virtual int write(SimpleBuffer *sb);
+    // shares the decoded values like Amf0Object::clone(), the rest stays raw
+    virtual Amf0Data *clone();
+
+private:
+    struct Slot
+    {
+        // into raw, key_pos < 0 for keys added by put()
+        int key_pos;
+        int key_len;
+        int value_pos;
+        int value_len;
+        std::string key;
+        std::shared_ptr<Amf0Data> value;
+    };
+    void clear();
+
+private:
+    std::string raw;
+    std::vector<Slot> slots;
+    int touched;
+    // values decoded later are checked like the keys were
+    bool validate_utf8;
+};
+
+// an object has the object marker whether it is an Amf0Object or an
+// Amf0LazyObject, these reach the properties of either, or of an ECMA
+// array, by the real class. data must be one of the three.
+int amf0_map_count(Amf0Data *data);
+std::string amf0_map_key(Amf0Data *data, int index);
+Amf0Data *amf0_map_value(Amf0Data *data, int index);
+void amf0_map_put(Amf0Data *data, std::string key, Amf0Data *value);
+
+#endif /* __AMF0_LAZY_H__ */
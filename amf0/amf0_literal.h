@@ -0,0 +1,252 @@
+#ifndef __AMF0_LITERAL_H__
+#define __AMF0_LITERAL_H__
+
+#include <stdint.h>
+
+#include "amf_core.h"
+
+/**
+ * AMF0 values encoded by the compiler, for messages that never change:
+ *
+ *     static constexpr auto status = amf0_lit_object(
+ *         amf0_lit_property("level", amf0_lit_string("status")),
+ *         amf0_lit_property("code", amf0_lit_string("NetStream.Data.Start")));
+ *
+ *     sb->append(status.data(), status.size());
+ *
+ * Lengths, counts, big endian numbers and object ends are all constant
+ * expressions, the result is a plain array in read-only data. Numbers
+ * must be zero or normal, -0.0 encodes as 0. A string or key longer than
+ * 65535 bytes does not compile.
+ */
+template <int N>
+struct Amf0Literal
+{
+    char bytes[N];
+
+    constexpr const char *data() const
+    {
+        return bytes;
+    }
+    constexpr int size() const
+    {
+        return N;
+    }
+    constexpr char operator[](int i) const
+    {
+        return bytes[i];
+    }
+};
+
+// the empty text of "" still needs an array to name
+template <>
+struct Amf0Literal<0>
+{
+    char bytes[1];
+
+    constexpr const char *data() const
+    {
+        return bytes;
+    }
+    constexpr int size() const
+    {
+        return 0;
+    }
+};
+
+template <int... I>
+struct amf0_seq
+{
+};
+
+template <int N, int... I>
+struct amf0_make_seq : amf0_make_seq<N - 1, N - 1, I...>
+{
+};
+
+template <int... I>
+struct amf0_make_seq<0, I...>
+{
+    typedef amf0_seq<I...> type;
+};
+
+template <int... N>
+struct amf0_sum;
+
+template <>
+struct amf0_sum<>
+{
+    static const int value = 0;
+};
+
+template <int N, int... R>
+struct amf0_sum<N, R...>
+{
+    static const int value = N + amf0_sum<R...>::value;
+};
+
+// byte i of the parts laid end to end
+template <int N>
+constexpr char amf0_literal_at(int i, const Amf0Literal<N> &a)
+{
+    return a.bytes[i];
+}
+
+template <int N, typename... R>
+constexpr char amf0_literal_at(int i, const Amf0Literal<N> &a, const R &... rest)
+{
+    return i < N ? a.bytes[i] : amf0_literal_at(i - N, rest...);
+}
+
+template <int... N, int... I>
+constexpr Amf0Literal<sizeof...(I)> amf0_concat_impl(amf0_seq<I...>, const Amf0Literal<N> &... parts)
+{
+    return Amf0Literal<sizeof...(I)>{ { amf0_literal_at(I, parts...)... } };
+}
+
+template <int... N>
+constexpr Amf0Literal<amf0_sum<N...>::value> amf0_concat(const Amf0Literal<N> &... parts)
+{
+    return amf0_concat_impl(typename amf0_make_seq<amf0_sum<N...>::value>::type(), parts...);
+}
+
+constexpr Amf0Literal<1> amf0_byte(char c)
+{
+    return Amf0Literal<1>{ { c } };
+}
+
+constexpr Amf0Literal<2> amf0_be16(uint32_t v)
+{
+    return Amf0Literal<2>{ { (char)(v >> 8), (char)v } };
+}
+
+constexpr Amf0Literal<4> amf0_be32(uint32_t v)
+{
+    return Amf0Literal<4>{ { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v } };
+}
+
+// the text of a literal without its terminating zero
+template <int N, int... I>
+constexpr Amf0Literal<N - 1> amf0_chars_impl(const char (&s)[N], amf0_seq<I...>)
+{
+    return Amf0Literal<N - 1>{ { s[I]... } };
+}
+
+template <int N>
+constexpr Amf0Literal<N - 1> amf0_chars(const char (&s)[N])
+{
+    return N - 1 <= 0xffff ? amf0_chars_impl(s, typename amf0_make_seq<N - 1>::type())
+        : throw "amf0: string longer than 65535 bytes";
+}
+
+// IEEE 754 bits without a bit cast, constexpr cannot reinterpret memory.
+// Exponents move in steps of 64 first to stay far from the recursion limit.
+constexpr double amf0_two64()
+{
+    return 18446744073709551616.0;
+}
+
+constexpr int amf0_exponent(double x, int e)
+{
+    return x >= amf0_two64() ? amf0_exponent(x / amf0_two64(), e + 64)
+        : x >= 2 ? amf0_exponent(x / 2, e + 1)
+        : x < 1 / amf0_two64() ? amf0_exponent(x * amf0_two64(), e - 64)
+        : x < 1 ? amf0_exponent(x * 2, e - 1)
+        : e;
+}
+
+constexpr double amf0_pow2(int e)
+{
+    return e >= 64 ? amf0_two64() * amf0_pow2(e - 64)
+        : e <= -64 ? amf0_pow2(e + 64) / amf0_two64()
+        : e > 0 ? 2 * amf0_pow2(e - 1)
+        : e < 0 ? amf0_pow2(e + 1) / 2
+        : 1;
+}
+
+constexpr uint64_t amf0_bits_of(double a, int e, uint64_t sign)
+{
+    return e < -1022 || e > 1023 ? throw "amf0: number must be zero or normal"
+        : sign | ((uint64_t)(e + 1023) << 52) | (uint64_t)((a / amf0_pow2(e) - 1) * 4503599627370496.0);
+}
+
+constexpr uint64_t amf0_bits(double x)
+{
+    return x != x ? throw "amf0: number must be zero or normal"
+        : x == 0 ? 0
+        : x < 0 ? amf0_bits_of(-x, amf0_exponent(-x, 0), 1ULL << 63)
+        : amf0_bits_of(x, amf0_exponent(x, 0), 0);
+}
+
+constexpr Amf0Literal<9> amf0_number_bits(uint64_t b)
+{
+    return Amf0Literal<9>{ { AMF0_MARKER::AMF0_MARKER_NUMBER, (char)(b >> 56), (char)(b >> 48), (char)(b >> 40),
+        (char)(b >> 32), (char)(b >> 24), (char)(b >> 16), (char)(b >> 8), (char)b } };
+}
+
+constexpr Amf0Literal<9> amf0_lit_number(double value)
+{
+    return amf0_number_bits(amf0_bits(value));
+}
+
+constexpr Amf0Literal<2> amf0_lit_boolean(bool value)
+{
+    return Amf0Literal<2>{ { AMF0_MARKER::AMF0_MARKER_BOOLEAN, (char)(value ? 1 : 0) } };
+}
+
+constexpr Amf0Literal<1> amf0_lit_null()
+{
+    return amf0_byte(AMF0_MARKER::AMF0_MARKER_NULL);
+}
+
+constexpr Amf0Literal<1> amf0_lit_undefined()
+{
+    return amf0_byte(AMF0_MARKER::AMF0_MARKER_UNDEFINED);
+}
+
+template <int N>
+constexpr Amf0Literal<N + 2> amf0_lit_string(const char (&s)[N])
+{
+    return amf0_concat(amf0_byte(AMF0_MARKER::AMF0_MARKER_STRING), amf0_be16(N - 1), amf0_chars(s));
+}
+
+// a key and its value, inside amf0_lit_object() or amf0_lit_ecma_array()
+template <int N, int M>
+constexpr Amf0Literal<N + 1 + M> amf0_lit_property(const char (&key)[N], const Amf0Literal<M> &value)
+{
+    static_assert(N > 1, "an empty key would read back as the object end");
+    return amf0_concat(amf0_be16(N - 1), amf0_chars(key), value);
+}
+
+constexpr Amf0Literal<3> amf0_object_end()
+{
+    return Amf0Literal<3>{ { 0, 0, AMF0_MARKER::AMF0_MARKER_OBJECT_END } };
+}
+
+template <int... N>
+constexpr Amf0Literal<amf0_sum<N...>::value + 4> amf0_lit_object(const Amf0Literal<N> &... properties)
+{
+    return amf0_concat(amf0_byte(AMF0_MARKER::AMF0_MARKER_OBJECT), properties..., amf0_object_end());
+}
+
+template <int... N>
+constexpr Amf0Literal<amf0_sum<N...>::value + 8> amf0_lit_ecma_array(const Amf0Literal<N> &... properties)
+{
+    return amf0_concat(amf0_byte(AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY), amf0_be32(sizeof...(N)), properties...,
+        amf0_object_end());
+}
+
+template <int... N>
+constexpr Amf0Literal<amf0_sum<N...>::value + 5> amf0_lit_strict_array(const Amf0Literal<N> &... values)
+{
+    return amf0_concat(amf0_byte(AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY), amf0_be32(sizeof...(N)), values...);
+}
+
+// several values back to back, e.g. a whole command message
+template <int... N>
+constexpr Amf0Literal<amf0_sum<N...>::value> amf0_lit_message(const Amf0Literal<N> &... values)
+{
+    return amf0_concat(values...);
+}
+
+#endif /* __AMF0_LITERAL_H__ */
@@ -0,0 +1,346 @@
+#include "amf0_registry.h"
+
+#include <assert.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0.h"
+#include "amf0_buffer_pool.h"
+#include "simple_buffer.h"
+
+// reclaim after this many retirements instead of on every publish
+#define AMF0_REGISTRY_RECLAIM_BATCH 64
+
+/**
+ * Epochs are shared by every registry. A reader publishes the global
+ * epoch it entered in, zero while outside a guard. Something retired in
+ * epoch e can only be reached by readers that entered in e or before,
+ * so it is freed once every active reader entered after e.
+ */
+struct Amf0EpochRecord
+{
+    std::atomic<uint64_t> epoch;
+    std::atomic<bool> in_use;
+    int depth;
+    Amf0EpochRecord *next;
+};
+
+static std::atomic<uint64_t> amf0_epoch_global(1);
+// records are pushed once and never removed, a thread that exits hands
+// its record to the next new thread
+static std::atomic<Amf0EpochRecord *> amf0_epoch_records(nullptr);
+
+class Amf0EpochLocal
+{
+public:
+    Amf0EpochLocal() : record(nullptr) {}
+    ~Amf0EpochLocal()
+    {
+        if (record) {
+            record->in_use.store(false, std::memory_order_release);
+        }
+    }
+
+public:
+    Amf0EpochRecord *get()
+    {
+        if (record) {
+            return record;
+        }
+
+        for (Amf0EpochRecord *r = amf0_epoch_records.load(std::memory_order_acquire); r; r = r->next) {
+            bool expected = false;
+            if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true)) {
+                record = r;
+                return r;
+            }
+        }
+
+        Amf0EpochRecord *r = new Amf0EpochRecord();
+        r->epoch.store(0);
+        r->in_use.store(true);
+        r->depth = 0;
+
+        Amf0EpochRecord *head = amf0_epoch_records.load(std::memory_order_relaxed);
+        do {
+            r->next = head;
+        } while (!amf0_epoch_records.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+
+        record = r;
+        return r;
+    }
+
+private:
+    Amf0EpochRecord *record;
+};
+
+static thread_local Amf0EpochLocal amf0_epoch_local;
+
+// oldest epoch an active reader entered in, UINT64_MAX if there is none
+static uint64_t amf0_epoch_oldest()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t oldest = UINT64_MAX;
+    for (Amf0EpochRecord *r = amf0_epoch_records.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t e = r->epoch.load(std::memory_order_acquire);
+        if (e != 0 && e < oldest) {
+            oldest = e;
+        }
+    }
+    return oldest;
+}
+
+Amf0RegistryGuard::Amf0RegistryGuard()
+{
+    Amf0EpochRecord *r = amf0_epoch_local.get();
+    if (r->depth++ == 0) {
+        r->epoch.store(amf0_epoch_global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        // pairs with the fence of amf0_epoch_oldest(), either the
+        // reclaimer sees this epoch or this reader sees the unlinks
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+Amf0RegistryGuard::~Amf0RegistryGuard()
+{
+    Amf0EpochRecord *r = amf0_epoch_local.get();
+    if (--r->depth == 0) {
+        r->epoch.store(0, std::memory_order_release);
+    }
+}
+
+Amf0RegistryValue::Amf0RegistryValue()
+    : frozen(nullptr), version(0)
+{
+}
+
+Amf0RegistryValue::~Amf0RegistryValue()
+{
+    freep(frozen);
+}
+
+Amf0FrozenValue Amf0RegistryValue::root() const
+{
+    return frozen->root();
+}
+
+class Amf0RegistryNode
+{
+public:
+    Amf0RegistryNode(const std::string &key, uint64_t hash) : key(key), hash(hash), value(nullptr), next(nullptr) {}
+
+public:
+    const std::string key;
+    const uint64_t hash;
+    std::atomic<Amf0RegistryValue *> value;
+    std::atomic<Amf0RegistryNode *> next;
+};
+
+class Amf0RegistryShard
+{
+public:
+    Amf0RegistryShard(int n) : buckets(n)
+    {
+        for (int i = 0; i < n; ++i) {
+            buckets[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    // writers only, readers never take it
+    std::mutex mutex;
+    std::vector<std::atomic<Amf0RegistryNode *>> buckets;
+};
+
+// FNV-1a, the low bits pick the shard and the rest the bucket
+static uint64_t amf0_registry_hash(const std::string &key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); ++i) {
+        h = (h ^ (uint8_t)key[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+Amf0Registry::Amf0Registry(int buckets)
+    : buckets(buckets > 0 ? buckets : 1), entries(0)
+{
+    for (int i = 0; i < AMF0_REGISTRY_SHARDS; ++i) {
+        shards[i] = new Amf0RegistryShard(this->buckets);
+    }
+}
+
+Amf0Registry::~Amf0Registry()
+{
+    for (int i = 0; i < AMF0_REGISTRY_SHARDS; ++i) {
+        for (size_t b = 0; b < shards[i]->buckets.size(); ++b) {
+            Amf0RegistryNode *node = shards[i]->buckets[b].load(std::memory_order_relaxed);
+            while (node) {
+                Amf0RegistryNode *next = node->next.load(std::memory_order_relaxed);
+                delete node->value.load(std::memory_order_relaxed);
+                delete node;
+                node = next;
+            }
+        }
+        freep(shards[i]);
+    }
+
+    for (size_t i = 0; i < retire_list.size(); ++i) {
+        delete retire_list[i].value;
+        delete retire_list[i].node;
+    }
+}
+
+int Amf0Registry::publish(const std::string &key, Amf0Data *value)
+{
+    // reclaim() frees it on whatever thread, long after the caller's scope
+    Amf0AllocatorScope scope(Amf0Allocator::default_allocator());
+
+    Amf0RegistryValue *v = new Amf0RegistryValue();
+    v->frozen = Amf0Frozen::freeze(value);
+    if (!v->frozen) {
+        delete v;
+        return ERROR_AMF0_INVALID;
+    }
+
+    Amf0PooledBuffer sb;
+    value->write(sb.get());
+    v->encoded.assign(sb->data(), sb->size());
+
+    uint64_t hash = amf0_registry_hash(key);
+    Amf0RegistryShard *shard = shards[hash % AMF0_REGISTRY_SHARDS];
+    std::atomic<Amf0RegistryNode *> &bucket = shard->buckets[(hash / AMF0_REGISTRY_SHARDS) % buckets];
+
+    Amf0RegistryValue *old = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+
+        Amf0RegistryNode *node = bucket.load(std::memory_order_relaxed);
+        while (node && (node->hash != hash || node->key != key)) {
+            node = node->next.load(std::memory_order_relaxed);
+        }
+
+        if (node) {
+            old = node->value.load(std::memory_order_relaxed);
+            v->version = old->version + 1;
+            node->value.store(v, std::memory_order_release);
+        } else {
+            // fully built before the release store makes it reachable
+            node = new Amf0RegistryNode(key, hash);
+            v->version = 1;
+            node->value.store(v, std::memory_order_relaxed);
+            node->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(node, std::memory_order_release);
+            entries.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (old) {
+        retire(old, nullptr);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+bool Amf0Registry::remove(const std::string &key)
+{
+    uint64_t hash = amf0_registry_hash(key);
+    Amf0RegistryShard *shard = shards[hash % AMF0_REGISTRY_SHARDS];
+    std::atomic<Amf0RegistryNode *> *link = &shard->buckets[(hash / AMF0_REGISTRY_SHARDS) % buckets];
+
+    Amf0RegistryNode *node = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+
+        node = link->load(std::memory_order_relaxed);
+        while (node && (node->hash != hash || node->key != key)) {
+            link = &node->next;
+            node = link->load(std::memory_order_relaxed);
+        }
+
+        if (!node) {
+            return false;
+        }
+
+        // readers standing on node still reach the rest of the list
+        link->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+        entries.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    retire(node->value.load(std::memory_order_relaxed), node);
+    return true;
+}
+
+const Amf0RegistryValue *Amf0Registry::find(const std::string &key)
+{
+    assert(amf0_epoch_local.get()->depth > 0);
+
+    uint64_t hash = amf0_registry_hash(key);
+    Amf0RegistryShard *shard = shards[hash % AMF0_REGISTRY_SHARDS];
+    Amf0RegistryNode *node = shard->buckets[(hash / AMF0_REGISTRY_SHARDS) % buckets].load(std::memory_order_acquire);
+
+    while (node) {
+        if (node->hash == hash && node->key == key) {
+            return node->value.load(std::memory_order_acquire);
+        }
+        node = node->next.load(std::memory_order_acquire);
+    }
+
+    return nullptr;
+}
+
+int Amf0Registry::count()
+{
+    return entries.load(std::memory_order_relaxed);
+}
+
+void Amf0Registry::retire(Amf0RegistryValue *value, Amf0RegistryNode *node)
+{
+    Retired r;
+    r.value = value;
+    r.node = node;
+    // readers entering from now on cannot reach it any more
+    r.epoch = amf0_epoch_global.fetch_add(1);
+
+    bool full = false;
+    {
+        std::unique_lock<std::mutex> lock(retire_mutex);
+        retire_list.push_back(r);
+        full = retire_list.size() >= AMF0_REGISTRY_RECLAIM_BATCH;
+    }
+
+    if (full) {
+        reclaim();
+    }
+}
+
+void Amf0Registry::reclaim()
+{
+    std::vector<Retired> ready;
+    {
+        std::unique_lock<std::mutex> lock(retire_mutex);
+
+        uint64_t oldest = amf0_epoch_oldest();
+        size_t kept = 0;
+        for (size_t i = 0; i < retire_list.size(); ++i) {
+            if (retire_list[i].epoch < oldest) {
+                ready.push_back(retire_list[i]);
+            } else {
+                retire_list[kept++] = retire_list[i];
+            }
+        }
+        retire_list.resize(kept);
+    }
+
+    for (size_t i = 0; i < ready.size(); ++i) {
+        delete ready[i].value;
+        delete ready[i].node;
+    }
+}
+
+int Amf0Registry::retired()
+{
+    std::unique_lock<std::mutex> lock(retire_mutex);
+    return retire_list.size();
+}
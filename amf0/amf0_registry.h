@@ -0,0 +1,100 @@
+#ifndef __AMF0_REGISTRY_H__
+#define __AMF0_REGISTRY_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "amf0_frozen.h"
+
+class Amf0Data;
+class Amf0RegistryNode;
+class Amf0RegistryShard;
+
+#define AMF0_REGISTRY_SHARDS 64
+
+// one published version, never changed once readers can reach it
+class Amf0RegistryValue
+{
+public:
+    Amf0RegistryValue();
+    virtual ~Amf0RegistryValue();
+
+public:
+    Amf0FrozenValue root() const;
+
+public:
+    Amf0Frozen *frozen;
+    // the value as written by Amf0Data::write(), ready to send
+    std::string encoded;
+    // increases with every publish() of the key, starting at 1
+    uint64_t version;
+};
+
+/**
+ * Marks the calling thread as reading, every value found while one is
+ * alive stays valid until it is destroyed. Entering and leaving is a
+ * few stores, guards may nest.
+ */
+class Amf0RegistryGuard
+{
+public:
+    Amf0RegistryGuard();
+    virtual ~Amf0RegistryGuard();
+
+    Amf0RegistryGuard(const Amf0RegistryGuard &) = delete;
+    Amf0RegistryGuard &operator=(const Amf0RegistryGuard &) = delete;
+};
+
+/**
+ * Latest metadata of every stream, e.g. onMetaData and @setDataFrame by
+ * stream name. Keys hash to shards of fixed bucket lists. Readers never
+ * lock or wait: they walk the lists and load the current version under
+ * an Amf0RegistryGuard. Writers lock their shard, swap the version in
+ * atomically and retire the old one, which is freed once every guard
+ * that could have seen it is gone (epoch based reclamation).
+ */
+class Amf0Registry
+{
+public:
+    // buckets per shard, fixed for the registry's lifetime
+    Amf0Registry(int buckets = 256);
+    // no guard may be alive
+    virtual ~Amf0Registry();
+
+public:
+    // freezes and encodes value under key, replacing the previous version
+    int publish(const std::string &key, Amf0Data *value);
+    // false if the key is not present
+    bool remove(const std::string &key);
+    // nullptr if absent, the caller must hold an Amf0RegistryGuard
+    const Amf0RegistryValue *find(const std::string &key);
+    int count();
+
+public:
+    // frees what no reader can still see, publish() calls it as it goes
+    void reclaim();
+    // values and nodes waiting for readers to leave
+    int retired();
+
+private:
+    struct Retired
+    {
+        Amf0RegistryValue *value;
+        Amf0RegistryNode *node;
+        uint64_t epoch;
+    };
+    void retire(Amf0RegistryValue *value, Amf0RegistryNode *node);
+
+private:
+    Amf0RegistryShard *shards[AMF0_REGISTRY_SHARDS];
+    int buckets;
+    std::atomic<int> entries;
+
+    std::mutex retire_mutex;
+    std::vector<Retired> retire_list;
+};
+
+#endif /* __AMF0_REGISTRY_H__ */
@@ -0,0 +1,159 @@
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "amf0.h"
+#include "amf0_registry.h"
+
+using namespace std;
+
+static Amf0EcmaArray *make_metadata(int seed)
+{
+    Amf0EcmaArray *meta = new Amf0EcmaArray();
+    meta->put("duration", new Amf0Number(0));
+    meta->put("width", new Amf0Number(1280));
+    meta->put("height", new Amf0Number(720));
+    meta->put("videodatarate", new Amf0Number(2500 + seed % 100));
+    meta->put("framerate", new Amf0Number(30));
+    meta->put("videocodecid", new Amf0Number(7));
+    meta->put("audiocodecid", new Amf0Number(10));
+    meta->put("encoder", new Amf0String("obs-output module"));
+    return meta;
+}
+
+static string stream_key(int i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "live/stream%d", i);
+    return buf;
+}
+
+// the mutex protected map the registry replaces, for reference
+class LockedMap
+{
+public:
+    void put(const string &key, const string &bytes)
+    {
+        unique_lock<mutex> lock(m);
+        values[key] = bytes;
+    }
+    size_t get(const string &key)
+    {
+        unique_lock<mutex> lock(m);
+        map<string, string>::iterator it = values.find(key);
+        return it == values.end() ? 0 : it->second.size();
+    }
+
+private:
+    mutex m;
+    map<string, string> values;
+};
+
+// lookups per second of readers threads while one writer republishes
+template<typename Lookup, typename Publish>
+static double run(int readers, int seconds_ms, int streams, const vector<string> &keys, Lookup lookup, Publish publish)
+{
+    atomic<bool> stop(false);
+    atomic<uint64_t> total(0);
+
+    thread writer([&] {
+        int i = 0;
+        while (!stop.load(memory_order_relaxed)) {
+            publish(i++ % streams);
+        }
+    });
+
+    vector<thread> pool;
+    for (int t = 0; t < readers; ++t) {
+        pool.push_back(thread([&, t] {
+            uint64_t n = 0, bytes = 0;
+            unsigned seed = t * 7919 + 1;
+            while (!stop.load(memory_order_relaxed)) {
+                for (int k = 0; k < 256; ++k) {
+                    seed = seed * 1103515245 + 12345;
+                    bytes += lookup(keys[(seed >> 8) % streams]);
+                }
+                n += 256;
+            }
+            total.fetch_add(n + (bytes == 0), memory_order_relaxed);
+        }));
+    }
+
+    this_thread::sleep_for(chrono::milliseconds(seconds_ms));
+    stop.store(true);
+    writer.join();
+    for (size_t i = 0; i < pool.size(); ++i) {
+        pool[i].join();
+    }
+
+    return total.load() * 1000.0 / seconds_ms;
+}
+
+int main(int argc, char **argv)
+{
+    int streams = argc > 1 ? atoi(argv[1]) : 10000;
+    int ms = argc > 2 ? atoi(argv[2]) : 500;
+    int max_threads = thread::hardware_concurrency();
+    if (max_threads <= 0) {
+        max_threads = 1;
+    }
+
+    vector<string> keys;
+    for (int i = 0; i < streams; ++i) {
+        keys.push_back(stream_key(i));
+    }
+
+    Amf0Registry registry(1024);
+    LockedMap locked;
+    vector<Amf0EcmaArray *> metadata;
+    for (int i = 0; i < streams; ++i) {
+        metadata.push_back(make_metadata(i));
+        registry.publish(keys[i], metadata[i]);
+
+        const Amf0RegistryValue *v = nullptr;
+        {
+            Amf0RegistryGuard guard;
+            v = registry.find(keys[i]);
+            locked.put(keys[i], v->encoded);
+        }
+    }
+
+    printf("%d streams, one writer republishing, %d hardware threads\n", streams, max_threads);
+    printf("%8s %16s %16s %9s\n", "readers", "registry op/s", "mutex map op/s", "scaling");
+
+    double base = 0;
+    for (int readers = 1; readers <= max_threads; readers *= 2) {
+        double rcu = run(readers, ms, streams, keys,
+            [&](const string &key) -> size_t {
+                Amf0RegistryGuard guard;
+                const Amf0RegistryValue *v = registry.find(key);
+                return v ? v->encoded.size() : 0;
+            },
+            [&](int i) { registry.publish(keys[i], metadata[i]); });
+
+        double mtx = run(readers, ms, streams, keys,
+            [&](const string &key) -> size_t { return locked.get(key); },
+            [&](int i) { locked.put(keys[i], string(100, 'x')); });
+
+        if (readers == 1) {
+            base = rcu;
+        }
+        printf("%8d %16.0f %16.0f %8.2fx\n", readers, rcu, mtx, rcu / base);
+
+        if (readers < max_threads && readers * 2 > max_threads) {
+            readers = max_threads / 2;
+        }
+    }
+
+    for (size_t i = 0; i < metadata.size(); ++i) {
+        delete metadata[i];
+    }
+
+    return 0;
+}
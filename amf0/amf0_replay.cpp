@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "simple_buffer.h"
+#include "amf0.h"
+#include "amf0_allocator.h"
+#include "amf0_cache.h"
+#include "amf0_capture.h"
+#include "amf0_chunk.h"
+#include "amf0_lazy.h"
+#include "amf0_shape.h"
+
+using namespace std;
+
+static int usage()
+{
+    fprintf(stderr, "usage: amf0_replay run <in.cap> [-m tree|lazy|shape|cache] [-t threads] [-r rounds]\n");
+    fprintf(stderr, "       amf0_replay gen <out.cap> [messages]\n");
+    return 1;
+}
+
+enum ReplayMode
+{
+    REPLAY_TREE,
+    REPLAY_LAZY,
+    REPLAY_SHAPE,
+    REPLAY_CACHE,
+};
+
+// nanoseconds in log-linear buckets, 32 per power of two, so a quantile
+// is within 3% and recording costs a count
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() : counts(64 + 58 * 32, 0), total(0) {}
+
+public:
+    void add(uint64_t ns)
+    {
+        counts[index(ns)]++;
+        total++;
+    }
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+    }
+    // lower bound of the bucket holding quantile q
+    uint64_t quantile(double q)
+    {
+        uint64_t rank = (uint64_t)(q * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return lower(i);
+            }
+        }
+        return 0;
+    }
+
+private:
+    static int index(uint64_t ns)
+    {
+        if (ns < 64) {
+            return ns;
+        }
+        int e = 63 - __builtin_clzll(ns);
+        return 64 + (e - 6) * 32 + ((ns >> (e - 5)) & 31);
+    }
+    static uint64_t lower(int i)
+    {
+        if (i < 64) {
+            return i;
+        }
+        int e = (i - 64) / 32 + 6;
+        return (1ULL << e) | ((uint64_t)((i - 64) % 32) << (e - 5));
+    }
+
+private:
+    vector<uint64_t> counts;
+    uint64_t total;
+};
+
+struct ReplayWorker
+{
+    ReplayWorker() : messages(0), bytes(0), errors(0) {}
+
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t errors;
+    LatencyHistogram latency;
+    // counts what a message allocates and frees within its replay
+    Amf0CountingAllocator counting;
+};
+
+// decodes every value of in and encodes it into out
+static bool replay_message(ReplayMode mode, SimpleBuffer *in, SimpleBuffer *out, Amf0ShapeDecoder *shapes,
+    Amf0DecodeCache *cache)
+{
+    while (!in->empty()) {
+        if (mode == REPLAY_SHAPE) {
+            Amf0Data *value = shapes->decode(in);
+            if (!value) {
+                return false;
+            }
+            value->write(out);
+        } else if (mode == REPLAY_CACHE) {
+            shared_ptr<Amf0Data> value = cache->decode(in);
+            if (!value) {
+                return false;
+            }
+            value->write(out);
+        } else if (mode == REPLAY_LAZY && in->peek_1byte() == AMF0_MARKER::AMF0_MARKER_OBJECT) {
+            Amf0LazyObject value;
+            if (value.read(in) != ERROR_SUCCESS) {
+                return false;
+            }
+            value.write(out);
+        } else {
+            Amf0Data *value = Amf0Data::create_amf0data(in);
+            if (!value) {
+                return false;
+            }
+            value->write(out);
+            delete value;
+        }
+    }
+    return true;
+}
+
+// every message whose index is index modulo threads, streamed from the file
+static void replay_thread(const char *path, ReplayMode mode, int index, int threads, int rounds,
+    Amf0DecodeCache *cache, ReplayWorker *worker)
+{
+    Amf0CaptureReader *reader = Amf0CaptureReader::open(path);
+    if (!reader) {
+        return;
+    }
+
+    SimpleBuffer in, out;
+    Amf0ShapeDecoder shapes;
+
+    for (int r = 0; r < rounds; ++r) {
+        reader->rewind();
+
+        Amf0CaptureMessage message;
+        for (uint64_t i = 0; reader->next(message); ++i) {
+            if ((int)(i % threads) != index) {
+                continue;
+            }
+
+            in.clear();
+            in.append(message.data, message.size);
+            out.clear();
+
+            auto start = chrono::steady_clock::now();
+            bool ok;
+            {
+                Amf0AllocatorScope scope(&worker->counting);
+                ok = replay_message(mode, &in, &out, &shapes, cache);
+            }
+            uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+            worker->latency.add(ns);
+            worker->messages++;
+            worker->bytes += message.size;
+            worker->errors += !ok;
+        }
+    }
+
+    freep(reader);
+}
+
+static int run(const char *path, ReplayMode mode, int threads, int rounds)
+{
+    Amf0CaptureReader *reader = Amf0CaptureReader::open(path);
+    if (!reader) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        return 1;
+    }
+    // read it in once, so the first round does not time the disk
+    uint64_t count = 0;
+    Amf0CaptureMessage message;
+    while (reader->next(message)) {
+        count++;
+    }
+    if (reader->truncated()) {
+        fprintf(stderr, "%s: damaged record after %llu messages\n", path, (unsigned long long)count);
+    }
+    uint64_t file_size = reader->size();
+    freep(reader);
+
+    vector<unique_ptr<ReplayWorker>> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.push_back(unique_ptr<ReplayWorker>(new ReplayWorker()));
+    }
+    Amf0DecodeCache cache;
+    vector<thread> pool;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < threads; ++i) {
+        pool.push_back(thread(replay_thread, path, mode, i, threads, rounds, &cache, workers[i].get()));
+    }
+    for (size_t i = 0; i < pool.size(); ++i) {
+        pool[i].join();
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ReplayWorker total;
+    uint64_t allocations = 0;
+    for (int i = 0; i < threads; ++i) {
+        total.messages += workers[i]->messages;
+        total.bytes += workers[i]->bytes;
+        total.errors += workers[i]->errors;
+        total.latency.merge(workers[i]->latency);
+        allocations += workers[i]->counting.allocations();
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%s: %llu bytes, %llu messages, %d threads, %d rounds\n", path, (unsigned long long)file_size,
+        (unsigned long long)count, threads, rounds);
+    printf("%12.0f msg/s %10.1f MB/s\n", total.messages / sec, total.bytes / sec / 1e6);
+    printf("latency p50 %.2f us, p99 %.2f us, p999 %.2f us\n", total.latency.quantile(0.5) / 1e3,
+        total.latency.quantile(0.99) / 1e3, total.latency.quantile(0.999) / 1e3);
+    // the cache and the shape decoder keep what they decode past the
+    // message, so that comes from the default allocator and is not counted
+    const char *uncounted = "";
+    if (mode == REPLAY_CACHE) {
+        uncounted = " (cache misses not counted)";
+    } else if (mode == REPLAY_SHAPE) {
+        uncounted = " (shape decoder not counted)";
+    }
+    printf("%.2f allocations/msg%s, peak rss %ld KB, %llu failed\n",
+        total.messages ? (double)allocations / total.messages : 0.0, uncounted, usage.ru_maxrss,
+        (unsigned long long)total.errors);
+
+    return total.errors ? 1 : 0;
+}
+
+// a play session: connect, createStream and play commands, status
+// replies, then metadata and cue points as data messages
+static int gen(const char *path, int count)
+{
+    Amf0CaptureWriter *writer = Amf0CaptureWriter::open(path);
+    if (!writer) {
+        fprintf(stderr, "%s: cannot create\n", path);
+        return 1;
+    }
+
+    srand(1);
+    SimpleBuffer sb;
+    for (int i = 0; i < count; ++i) {
+        sb.clear();
+        uint8_t type = RTMP_MSG_AMF0_COMMAND;
+        int kind = rand() % 10;
+
+        if (kind == 0) {
+            Amf0String("connect").write(&sb);
+            Amf0Number(1).write(&sb);
+            Amf0Object command;
+            command.put("app", new Amf0String("live"));
+            command.put("flashVer", new Amf0String("FMLE/3.0 (compatible; FMSc/1.0)"));
+            command.put("tcUrl", new Amf0String("rtmp://edge.example.com/live"));
+            command.put("fpad", new Amf0Boolean(false));
+            command.put("capabilities", new Amf0Number(239));
+            command.put("audioCodecs", new Amf0Number(3575));
+            command.put("videoCodecs", new Amf0Number(252));
+            command.put("videoFunction", new Amf0Number(1));
+            command.write(&sb);
+        } else if (kind <= 2) {
+            Amf0String(kind == 1 ? "createStream" : "play").write(&sb);
+            Amf0Number(2 + rand() % 8).write(&sb);
+            Amf0Null().write(&sb);
+            if (kind == 2) {
+                Amf0String("stream" + to_string(rand() % 1000)).write(&sb);
+            }
+        } else if (kind <= 5) {
+            Amf0String("onStatus").write(&sb);
+            Amf0Number(0).write(&sb);
+            Amf0Null().write(&sb);
+            Amf0Object status;
+            status.put("level", new Amf0String("status"));
+            status.put("code", new Amf0String("NetStream.Play.Start"));
+            status.put("description", new Amf0String("Started playing stream" + to_string(rand() % 1000) + "."));
+            status.put("clientid", new Amf0Number(rand()));
+            status.write(&sb);
+        } else if (kind <= 7) {
+            type = RTMP_MSG_AMF0_DATA;
+            Amf0String("@setDataFrame").write(&sb);
+            Amf0String("onMetaData").write(&sb);
+            Amf0EcmaArray meta;
+            meta.put("duration", new Amf0Number(0));
+            meta.put("width", new Amf0Number(rand() % 2 ? 1280 : 1920));
+            meta.put("height", new Amf0Number(rand() % 2 ? 720 : 1080));
+            meta.put("videodatarate", new Amf0Number(2500 + rand() % 1000));
+            meta.put("framerate", new Amf0Number(30));
+            meta.put("videocodecid", new Amf0Number(7));
+            meta.put("audiodatarate", new Amf0Number(128));
+            meta.put("audiosamplerate", new Amf0Number(44100));
+            meta.put("stereo", new Amf0Boolean(true));
+            meta.put("audiocodecid", new Amf0Number(10));
+            meta.put("encoder", new Amf0String("obs-output module (libobs version 27.2.4)"));
+            meta.write(&sb);
+        } else {
+            type = RTMP_MSG_AMF0_DATA;
+            Amf0String("onCuePoint").write(&sb);
+            Amf0Object cue;
+            cue.put("name", new Amf0String("ad" + to_string(rand() % 100)));
+            cue.put("time", new Amf0Number((rand() % 36000) / 10.0));
+            cue.put("type", new Amf0String("event"));
+            Amf0EcmaArray *parameters = new Amf0EcmaArray();
+            parameters->put("duration", new Amf0Number(15 + rand() % 45));
+            parameters->put("url", new Amf0String("https://ads.example.com/" + to_string(rand())));
+            cue.put("parameters", parameters);
+            cue.write(&sb);
+        }
+
+        writer->write(type, sb.data(), sb.size());
+    }
+
+    int ret = writer->close();
+    freep(writer);
+    if (ret != ERROR_SUCCESS) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return 1;
+    }
+    printf("%s: %d messages\n", path, count);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "gen") == 0) {
+        return gen(argv[2], argc > 3 ? atoi(argv[3]) : 100000);
+    }
+    if (argc < 3 || strcmp(argv[1], "run") != 0) {
+        return usage();
+    }
+
+    ReplayMode mode = REPLAY_TREE;
+    int threads = 1, rounds = 1;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-m") == 0) {
+            string m = argv[i + 1];
+            if (m == "tree") {
+                mode = REPLAY_TREE;
+            } else if (m == "lazy") {
+                mode = REPLAY_LAZY;
+            } else if (m == "shape") {
+                mode = REPLAY_SHAPE;
+            } else if (m == "cache") {
+                mode = REPLAY_CACHE;
+            } else {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "-t") == 0) {
+            threads = max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "-r") == 0) {
+            rounds = max(1, atoi(argv[i + 1]));
+        } else {
+            return usage();
+        }
+    }
+    if ((argc - 3) % 2 != 0) {
+        return usage();
+    }
+
+    return run(argv[2], mode, threads, rounds);
+}
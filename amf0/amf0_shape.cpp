@@ -0,0 +1,267 @@
+#include "amf0_shape.h"
+
+#include <string.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "amf0.h"
+#include "amf0_simd.h"
+#include "amf0_stats.h"
+#include "simple_buffer.h"
+
+class Amf0Shape
+{
+public:
+    struct Field
+    {
+        // constant bytes before the value: key length, key and marker,
+        // for the first field the container header as well
+        int offset;
+        int length;
+        char marker;
+    };
+
+public:
+    Amf0Shape() : value(nullptr), utf8(false) {}
+    ~Amf0Shape()
+    {
+        freep(value);
+    }
+
+public:
+    // reads sb into the slots if it has this skeleton, false otherwise
+    bool fill(const char *p, int n, bool validate_utf8, int &size);
+
+private:
+    // the node of a field, a copy when a clone of an earlier result still
+    // shares it, so the clone keeps its values
+    Amf0Data *slot(int index);
+
+public:
+    std::string skeleton;
+    std::vector<Field> fields;
+    Amf0Data *value;
+    // learned from a decode that checked the keys as UTF-8
+    bool utf8;
+};
+
+static inline uint16_t amf0_shape_be16(const char *p)
+{
+    return ((uint8_t)p[0] << 8) | (uint8_t)p[1];
+}
+
+Amf0Data *Amf0Shape::slot(int index)
+{
+    if (value->is_ecma_array()) {
+        return ((Amf0EcmaArray *)value)->mutable_value_at(index);
+    }
+    return ((Amf0Object *)value)->mutable_value_at(index);
+}
+
+bool Amf0Shape::fill(const char *p, int n, bool validate_utf8, int &size)
+{
+    if (validate_utf8 && !utf8) {
+        return false;
+    }
+
+    const char *s = skeleton.data();
+    int pos = 0;
+
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const Field &f = fields[i];
+        if (pos + f.length > n || memcmp(p + pos, s + f.offset, f.length) != 0) {
+            return false;
+        }
+        pos += f.length;
+
+        switch (f.marker) {
+            case AMF0_MARKER::AMF0_MARKER_NUMBER: {
+                if (pos + 8 > n) {
+                    return false;
+                }
+                uint64_t bits;
+                memcpy(&bits, p + pos, 8);
+                bits = __builtin_bswap64(bits);
+                memcpy(&((Amf0Number *)slot(i))->value, &bits, 8);
+                pos += 8;
+                break;
+            }
+            case AMF0_MARKER::AMF0_MARKER_BOOLEAN:
+                if (pos + 1 > n) {
+                    return false;
+                }
+                ((Amf0Boolean *)slot(i))->value = p[pos] != 0;
+                pos += 1;
+                break;
+            case AMF0_MARKER::AMF0_MARKER_STRING: {
+                if (pos + 2 > n) {
+                    return false;
+                }
+                int len = amf0_shape_be16(p + pos);
+                if (pos + 2 + len > n) {
+                    return false;
+                }
+                if (validate_utf8 && !amf0_utf8_valid(p + pos + 2, len)) {
+                    return false;
+                }
+                // keeps the node's capacity, no allocation once it is big enough
+                ((Amf0String *)slot(i))->value.assign(p + pos + 2, len);
+                pos += 2 + len;
+                break;
+            }
+            default:
+                // null and undefined carry nothing
+                break;
+        }
+    }
+
+    if (pos + 3 > n || p[pos] != 0 || p[pos + 1] != 0 || p[pos + 2] != AMF0_MARKER::AMF0_MARKER_OBJECT_END) {
+        return false;
+    }
+
+    size = pos + 3;
+    return true;
+}
+
+Amf0ShapeDecoder::Amf0ShapeDecoder(int max_shapes)
+    : max_shapes(max_shapes > 0 ? max_shapes : 1), last(nullptr), _hits(0), _misses(0)
+{
+}
+
+Amf0ShapeDecoder::~Amf0ShapeDecoder()
+{
+    for (size_t i = 0; i < cache.size(); ++i) {
+        freep(cache[i]);
+    }
+    freep(last);
+}
+
+Amf0Data *Amf0ShapeDecoder::decode(SimpleBuffer *sb, Amf0DecodeContext *ctx)
+{
+    // learned trees stay for the connection, they must not live in an
+    // allocator the caller may drop before the decoder
+    Amf0AllocatorScope scope(Amf0Allocator::default_allocator());
+
+    freep(last);
+
+    const char *p = sb->data() + sb->pos();
+    int n = sb->size() - sb->pos();
+    bool container = n > 0 && (p[0] == AMF0_MARKER::AMF0_MARKER_OBJECT || p[0] == AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY);
+
+    bool validate_utf8 = ctx && ctx->validate_utf8;
+    if (container) {
+        for (size_t i = 0; i < cache.size(); ++i) {
+            int size = 0;
+            if (!cache[i]->fill(p, n, validate_utf8, size)) {
+                continue;
+            }
+
+            Amf0Shape *shape = cache[i];
+            cache.erase(cache.begin() + i);
+            cache.insert(cache.begin(), shape);
+
+            _hits++;
+            AMF0_STATS_DECODED(p[0]);
+            sb->skip(size);
+            return shape->value;
+        }
+        _misses++;
+    }
+
+    int start = sb->pos();
+    Amf0Data *value = Amf0Data::create_amf0data(sb, ctx);
+    if (!value || !container) {
+        last = value;
+        return value;
+    }
+
+    Amf0Shape *shape = learn(p, sb->pos() - start, value);
+    if (!shape) {
+        last = value;
+        return value;
+    }
+    shape->utf8 = validate_utf8;
+
+    if ((int)cache.size() >= max_shapes) {
+        freep(cache.back());
+        cache.pop_back();
+    }
+    cache.insert(cache.begin(), shape);
+
+    return value;
+}
+
+Amf0Shape *Amf0ShapeDecoder::learn(const char *p, int size, Amf0Data *value)
+{
+    // the slots are refilled through the real classes, a lazy object has
+    // the object marker but nothing to refill
+    bool ecma = value->is_ecma_array();
+    if (!ecma && !dynamic_cast<Amf0Object *>(value)) {
+        return nullptr;
+    }
+    int count = ecma ? ((Amf0EcmaArray *)value)->count() : ((Amf0Object *)value)->count();
+    if (count == 0 || count > AMF0_SHAPE_MAX_FIELDS) {
+        return nullptr;
+    }
+
+    Amf0Shape *shape = new Amf0Shape();
+    int pos = ecma ? 5 : 1;
+    int head = pos;
+
+    for (int i = 0; i < count; ++i) {
+        int len = amf0_shape_be16(p + pos);
+        char marker = p[pos + 2 + len];
+
+        Amf0Data *slot = ecma ? ((Amf0EcmaArray *)value)->value_at(i) : ((Amf0Object *)value)->value_at(i);
+        bool scalar = marker == AMF0_MARKER::AMF0_MARKER_NUMBER || marker == AMF0_MARKER::AMF0_MARKER_BOOLEAN
+            || marker == AMF0_MARKER::AMF0_MARKER_STRING || marker == AMF0_MARKER::AMF0_MARKER_NULL
+            || marker == AMF0_MARKER::AMF0_MARKER_UNDEFINED;
+
+        // a repeated key leaves fewer properties than the wire has, and the
+        // slots must line up with the wire order
+        if (!scalar || len == 0 || !slot || slot->marker != marker
+            || (ecma ? ((Amf0EcmaArray *)value)->key_at(i) : ((Amf0Object *)value)->key_at(i)) != std::string(p + pos + 2, len)) {
+            freep(shape);
+            return nullptr;
+        }
+
+        Amf0Shape::Field f;
+        f.offset = shape->skeleton.size();
+        f.length = 2 + len + 1;
+        f.marker = marker;
+
+        if (i == 0) {
+            shape->skeleton.append(p, head);
+            f.offset = 0;
+            f.length += head;
+        }
+        shape->skeleton.append(p + pos, 2 + len + 1);
+        shape->fields.push_back(f);
+
+        pos += 2 + len;
+        pos += amf0_value_size(p + pos, size - pos);
+    }
+
+    if (pos + 3 != size) {
+        freep(shape);
+        return nullptr;
+    }
+
+    shape->value = value;
+    return shape;
+}
+
+uint64_t Amf0ShapeDecoder::hits()
+{
+    return _hits;
+}
+
+uint64_t Amf0ShapeDecoder::misses()
+{
+    return _misses;
+}
+
+int Amf0ShapeDecoder::shapes()
+{
+    return cache.size();
+}
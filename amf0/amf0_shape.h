@@ -0,0 +1,61 @@
+#ifndef __AMF0_SHAPE_H__
+#define __AMF0_SHAPE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class Amf0Data;
+class Amf0DecodeContext;
+class SimpleBuffer;
+class Amf0Shape;
+
+// most properties a learned layout may have
+#define AMF0_SHAPE_MAX_FIELDS 64
+
+/**
+ * Decoder for one connection, or one player build, that learns the
+ * layouts it keeps seeing. An object or ECMA array holding only numbers,
+ * booleans, strings, null and undefined is decoded the generic way once,
+ * its key/marker skeleton recorded and the decoded tree kept. When the
+ * same skeleton arrives again it is checked with one memcmp per key and
+ * the values are read straight into the kept tree's nodes, nothing is
+ * allocated. Anything else, or a skeleton that differs anywhere, takes
+ * the generic path.
+ *
+ * Every returned value belongs to the decoder and is valid until the
+ * next decode(). Values are allocated from the default allocator, never
+ * the current one, as the learned trees live as long as the decoder. A
+ * clone() of a value keeps its contents: a node it still shares is
+ * copied before the next hit writes to it.
+ */
+class Amf0ShapeDecoder
+{
+public:
+    Amf0ShapeDecoder(int max_shapes = 16);
+    virtual ~Amf0ShapeDecoder();
+
+public:
+    // nullptr if the value cannot be decoded, ctx limits the generic path,
+    // the learned one allocates nothing to charge
+    Amf0Data *decode(SimpleBuffer *sb, Amf0DecodeContext *ctx = nullptr);
+
+public:
+    uint64_t hits();
+    uint64_t misses();
+    int shapes();
+
+private:
+    Amf0Shape *learn(const char *p, int size, Amf0Data *value);
+
+private:
+    int max_shapes;
+    // most recently used first
+    std::vector<Amf0Shape *> cache;
+    // a value of the generic path, kept until the next decode()
+    Amf0Data *last;
+    uint64_t _hits;
+    uint64_t _misses;
+};
+
+#endif /* __AMF0_SHAPE_H__ */
@@ -0,0 +1,88 @@
+#include "amf0_simd.h"
+
+// length of the UTF-8 sequence at p, 0 if it is malformed or truncated
+static int utf8_sequence(const uint8_t *p, const uint8_t *end)
+{
+    uint8_t c = p[0];
+
+    if (c < 0x80) {
+        return 1;
+    }
+
+    if (c < 0xC2) {
+        // continuation byte or overlong 2-byte lead
+        return 0;
+    }
+
+    if (c < 0xE0) {
+        if (end - p < 2 || (p[1] & 0xC0) != 0x80)
+            return 0;
+        return 2;
+    }
+
+    if (c < 0xF0) {
+        if (end - p < 3)
+            return 0;
+
+        // reject overlongs (E0) and surrogates (ED)
+        uint8_t lo = (c == 0xE0) ? 0xA0 : 0x80;
+        uint8_t hi = (c == 0xED) ? 0x9F : 0xBF;
+        if (p[1] < lo || p[1] > hi || (p[2] & 0xC0) != 0x80)
+            return 0;
+        return 3;
+    }
+
+    if (c < 0xF5) {
+        if (end - p < 4)
+            return 0;
+
+        // reject overlongs (F0) and code points above U+10FFFF (F4)
+        uint8_t lo = (c == 0xF0) ? 0x90 : 0x80;
+        uint8_t hi = (c == 0xF4) ? 0x8F : 0xBF;
+        if (p[1] < lo || p[1] > hi || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80)
+            return 0;
+        return 4;
+    }
+
+    return 0;
+}
+
+bool amf0_utf8_valid(const char *data, int len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + len;
+
+    while (p < end) {
+#if defined(__SSE2__)
+        while (end - p >= 16) {
+            int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p));
+            if (mask == 0) {
+                p += 16;
+                continue;
+            }
+
+            p += __builtin_ctz(mask);
+            break;
+        }
+
+        if (p >= end) {
+            break;
+        }
+#endif
+
+        if (*p < 0x80) {
+            p++;
+            continue;
+        }
+
+        // validate the whole non-ASCII run before going back to vectors
+        while (p < end && *p >= 0x80) {
+            int n = utf8_sequence(p, end);
+            if (n == 0)
+                return false;
+            p += n;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef __AMF0_SIMD_H__
+#define __AMF0_SIMD_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// returns true if [data, data + len) is well-formed UTF-8, runs of ASCII
+// are checked 16 bytes at a time, multi-byte sequences fall back to scalar
+bool amf0_utf8_valid(const char *data, int len);
+
+// equality of two buffers of the same length n, used by key lookups
+inline bool amf0_key_equal(const char *a, const char *b, size_t n)
+{
+#if defined(__SSE2__)
+    if (n >= 16) {
+        size_t i = 0;
+        for (; i + 16 < n; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+            __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+                return false;
+        }
+
+        // the last block overlaps the previous one instead of a scalar tail
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + n - 16));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + n - 16));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xffff;
+    }
+#endif
+
+    if (n >= 8) {
+        uint64_t x0, y0, x1, y1;
+        memcpy(&x0, a, 8);
+        memcpy(&y0, b, 8);
+        memcpy(&x1, a + n - 8, 8);
+        memcpy(&y1, b + n - 8, 8);
+        return ((x0 ^ y0) | (x1 ^ y1)) == 0;
+    }
+
+    if (n >= 4) {
+        uint32_t x0, y0, x1, y1;
+        memcpy(&x0, a, 4);
+        memcpy(&y0, b, 4);
+        memcpy(&x1, a + n - 4, 4);
+        memcpy(&y1, b + n - 4, 4);
+        return ((x0 ^ y0) | (x1 ^ y1)) == 0;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i])
+            return false;
+    }
+
+    return true;
+}
+
+#endif /* __AMF0_SIMD_H__ */
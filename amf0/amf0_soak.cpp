@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "amf_core.h"
+#include "simple_buffer.h"
+#include "amf0.h"
+#include "amf0_allocator.h"
+#include "amf0_writer.h"
+
+using namespace std;
+
+static int usage()
+{
+    fprintf(stderr, "usage: amf0_soak [-h hours] [-i sample seconds] [-w warmup seconds] [-t threads]\n");
+    fprintf(stderr, "                 [-c connections per thread] [-g max growth MB]\n");
+    return 1;
+}
+
+struct SoakOptions
+{
+    double hours;
+    double interval;
+    double warmup;
+    int threads;
+    int connections;
+    double max_growth;
+};
+
+// what a long lived connection keeps between messages
+struct SoakConnection
+{
+    SoakConnection() : metadata(nullptr), messages(0) {}
+    ~SoakConnection()
+    {
+        delete metadata;
+    }
+
+    SimpleBuffer in;
+    SimpleBuffer out;
+    // the last @setDataFrame, replaced by the next one
+    Amf0Data *metadata;
+    uint64_t messages;
+};
+
+// keys and strings come from a fixed vocabulary plus random suffixes,
+// like real property names and stream names
+static const char *soak_words[] = { "app", "tcUrl", "flashVer", "code", "level", "description", "duration",
+    "width", "height", "framerate", "encoder", "videocodecid", "audiocodecid", "stereo", "clientid", "objectEncoding",
+    "NetStream.Play.Start", "status", "live", "rtmp://edge.example.com/live" };
+
+static string soak_text(mt19937 &rng, int max_len)
+{
+    string s = soak_words[rng() % (sizeof(soak_words) / sizeof(soak_words[0]))];
+    if (rng() % 4 == 0) {
+        s.append(rng() % max_len, 'a' + rng() % 26);
+    }
+    return s;
+}
+
+static void soak_value(Amf0Writer &w, mt19937 &rng, int depth)
+{
+    int kind = rng() % (depth < 3 ? 8 : 5);
+    switch (kind) {
+        case 0:
+            w.number((double)(rng() % 100000) / 7);
+            break;
+        case 1:
+            w.boolean(rng() % 2);
+            break;
+        case 2:
+            w.string(soak_text(rng, 200));
+            break;
+        case 3:
+            w.null();
+            break;
+        case 4:
+            w.undefined();
+            break;
+        case 5:
+        case 6: {
+            bool ecma = kind == 6;
+            ecma ? w.begin_ecma_array() : w.begin_object();
+            for (int i = rng() % 10; i > 0; --i) {
+                w.key(soak_text(rng, 24));
+                soak_value(w, rng, depth + 1);
+            }
+            ecma ? w.end_ecma_array() : w.end_object();
+            break;
+        }
+        default:
+            w.begin_strict_array();
+            for (int i = rng() % 8; i > 0; --i) {
+                soak_value(w, rng, depth + 1);
+            }
+            w.end_strict_array();
+            break;
+    }
+}
+
+// a command, a data message or now and then one very large message
+static bool soak_message(SimpleBuffer *sb, mt19937 &rng)
+{
+    Amf0Writer w(sb);
+    int kind = rng() % 20000;
+
+    if (kind == 0) {
+        // short strings only, up to about 1 MB of them
+        w.string("onTextData");
+        w.begin_strict_array();
+        string text(8192, 'x');
+        for (int i = 8 + rng() % 120; i > 0; --i) {
+            w.string(text);
+        }
+        w.end_strict_array();
+    } else if (kind < 2000) {
+        w.string("@setDataFrame");
+        w.string("onMetaData");
+        soak_value(w, rng, 3);
+        return true;
+    } else {
+        w.string(kind < 10000 ? "onStatus" : soak_text(rng, 16));
+        w.number(rng() % 16);
+        w.null();
+        for (int i = rng() % 3; i >= 0; --i) {
+            soak_value(w, rng, 0);
+        }
+    }
+    return false;
+}
+
+static void soak_thread(const SoakOptions &opts, int seed, Amf0Allocator *allocator, atomic<bool> *stop,
+    atomic<uint64_t> *messages)
+{
+    Amf0AllocatorScope scope(allocator);
+    mt19937 rng(seed);
+    vector<SoakConnection *> connections;
+    for (int i = 0; i < opts.connections; ++i) {
+        connections.push_back(new SoakConnection());
+    }
+
+    while (!stop->load(std::memory_order_relaxed)) {
+        for (int n = 0; n < 256; ++n) {
+            int index = rng() % connections.size();
+            SoakConnection *c = connections[index];
+
+            c->in.clear();
+            bool metadata = soak_message(&c->in, rng);
+
+            c->out.clear();
+            vector<Amf0Data *> values;
+            while (!c->in.empty()) {
+                Amf0Data *value = Amf0Data::create_amf0data(&c->in);
+                if (!value) {
+                    break;
+                }
+                value->write(&c->out);
+                values.push_back(value);
+            }
+
+            // the metadata is kept as a copy on write clone, the rest dies
+            if (metadata && values.size() == 3) {
+                delete c->metadata;
+                c->metadata = values[2]->clone();
+            }
+            for (size_t i = 0; i < values.size(); ++i) {
+                delete values[i];
+            }
+
+            // a reconnect gives the buffers back
+            if (++c->messages > 2000 + rng() % 20000) {
+                delete c;
+                connections[index] = new SoakConnection();
+            }
+        }
+        messages->fetch_add(256, std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < connections.size(); ++i) {
+        delete connections[i];
+    }
+}
+
+static double soak_rss_mb()
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+struct SoakHeap
+{
+    // from the heap arena and from mmap, in use and free in the arena
+    double arena;
+    double mmapped;
+    double used;
+    double free;
+};
+
+static SoakHeap soak_heap()
+{
+    SoakHeap heap = { 0, 0, 0, 0 };
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    heap.arena = mi.arena / (1024.0 * 1024);
+    heap.mmapped = mi.hblkhd / (1024.0 * 1024);
+    heap.used = mi.uordblks / (1024.0 * 1024);
+    heap.free = mi.fordblks / (1024.0 * 1024);
+#endif
+    return heap;
+}
+
+int main(int argc, char **argv)
+{
+    SoakOptions opts;
+    opts.hours = 1;
+    opts.interval = 10;
+    opts.warmup = 60;
+    opts.threads = max(1, (int)std::thread::hardware_concurrency());
+    opts.connections = 64;
+    opts.max_growth = 32;
+
+    if (argc % 2 != 1) {
+        return usage();
+    }
+    for (int i = 1; i + 1 < argc; i += 2) {
+        double v = atof(argv[i + 1]);
+        if (strcmp(argv[i], "-h") == 0) {
+            opts.hours = v;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            opts.interval = max(0.1, v);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            opts.warmup = v;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            opts.threads = max(1, (int)v);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            opts.connections = max(1, (int)v);
+        } else if (strcmp(argv[i], "-g") == 0) {
+            opts.max_growth = v;
+        } else {
+            return usage();
+        }
+    }
+
+    // every node, container and buffer of the run, live counts are what is kept
+    Amf0CountingAllocator counting;
+
+    double seconds = opts.hours * 3600;
+    printf("soak %.0f s, %d threads, %d connections each, warmup %.0f s, max growth %.1f MB\n", seconds,
+        opts.threads, opts.connections, opts.warmup, opts.max_growth);
+    printf("%8s %12s %9s %9s %9s %9s %7s %10s %9s\n", "seconds", "messages", "rss MB", "arena MB", "mmap MB",
+        "free MB", "frag", "live nodes", "live MB");
+
+    atomic<bool> stop(false);
+    atomic<uint64_t> messages(0);
+    vector<thread> pool;
+    for (int i = 0; i < opts.threads; ++i) {
+        pool.push_back(thread(soak_thread, std::cref(opts), i + 1, &counting, &stop, &messages));
+    }
+
+    auto start = chrono::steady_clock::now();
+    double baseline_rss = -1, baseline_live = 0, rss = 0;
+    int ret = 0;
+
+    for (;;) {
+        this_thread::sleep_for(chrono::duration<double>(opts.interval));
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        rss = soak_rss_mb();
+        SoakHeap heap = soak_heap();
+        double live = counting.live_bytes() / (1024.0 * 1024);
+        // free bytes the arena holds on to, the share that cannot be returned
+        double frag = heap.arena > 0 ? heap.free / heap.arena : 0;
+
+        printf("%8.0f %12llu %9.1f %9.1f %9.1f %9.1f %6.1f%% %10llu %9.1f\n", elapsed,
+            (unsigned long long)messages.load(), rss, heap.arena, heap.mmapped, heap.free, frag * 100,
+            (unsigned long long)counting.live_allocations(), live);
+        fflush(stdout);
+
+        if (elapsed >= opts.warmup) {
+            if (baseline_rss < 0) {
+                baseline_rss = rss;
+                baseline_live = live;
+            } else if (rss - baseline_rss > opts.max_growth || live - baseline_live > opts.max_growth) {
+                printf("FAIL: rss grew %.1f MB and live memory %.1f MB after warmup, limit %.1f MB\n",
+                    rss - baseline_rss, live - baseline_live, opts.max_growth);
+                ret = 1;
+                break;
+            }
+        }
+        if (elapsed >= seconds) {
+            break;
+        }
+    }
+
+    stop.store(true);
+    for (size_t i = 0; i < pool.size(); ++i) {
+        pool[i].join();
+    }
+
+    if (ret == 0) {
+        printf("PASS: rss grew %.1f MB after warmup\n", baseline_rss < 0 ? 0 : rss - baseline_rss);
+    }
+    return ret;
+}
@@ -0,0 +1,117 @@
+#include "amf0_stats.h"
+
+#include <string.h>
+
+#include "amf_errno.h"
+
+#ifdef AMF0_ENABLE_STATS
+
+// every thread's counters, pushed once and never removed, so totals
+// survive thread exit and readers can walk the list without locks
+static std::atomic<Amf0StatsCounters *> amf0_stats_threads(nullptr);
+static std::atomic<uint64_t> amf0_stats_failure_seq(0);
+static thread_local Amf0StatsCounters *amf0_stats_tls = nullptr;
+
+Amf0StatsCounters *amf0_stats_local()
+{
+    if (amf0_stats_tls) {
+        return amf0_stats_tls;
+    }
+
+    // value-initialized, every counter starts at zero
+    Amf0StatsCounters *c = new Amf0StatsCounters();
+    c->last_failure_code.store(ERROR_SUCCESS);
+    c->last_failure_offset.store(-1);
+
+    Amf0StatsCounters *head = amf0_stats_threads.load(std::memory_order_relaxed);
+    do {
+        c->next = head;
+    } while (!amf0_stats_threads.compare_exchange_weak(head, c, std::memory_order_release, std::memory_order_relaxed));
+
+    amf0_stats_tls = c;
+    return c;
+}
+
+void Amf0StatsCounters::failure(int code, int offset)
+{
+    int index = code - ERROR_AMF0_DECODE;
+    if (index < 0 || index >= AMF0_STATS_ERRORS) {
+        index = AMF0_STATS_ERRORS - 1;
+    }
+    add(decode_failures[index], 1);
+
+    last_failure_code.store(code, std::memory_order_relaxed);
+    last_failure_offset.store(offset, std::memory_order_relaxed);
+    last_failure_seq.store(amf0_stats_failure_seq.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Amf0StatsCounters::fail(int code, int offset)
+{
+    if (decode_depth == 0) {
+        failure(code, offset);
+    } else if (pending_failure_code == ERROR_SUCCESS) {
+        pending_failure_code = code;
+        pending_failure_offset = offset;
+    }
+}
+
+void Amf0StatsCounters::latency(std::atomic<uint64_t> *histogram, int64_t ns)
+{
+    int bucket = ns > 0 ? 63 - __builtin_clzll((uint64_t)ns) : 0;
+    if (bucket >= AMF0_STATS_LATENCY_BUCKETS) {
+        bucket = AMF0_STATS_LATENCY_BUCKETS - 1;
+    }
+    add(histogram[bucket], 1);
+}
+
+void amf0_stats_snapshot(Amf0StatsSnapshot *s)
+{
+    memset(s, 0, sizeof(Amf0StatsSnapshot));
+    s->last_failure_offset = -1;
+
+    uint64_t latest = 0;
+    for (Amf0StatsCounters *c = amf0_stats_threads.load(std::memory_order_acquire); c; c = c->next) {
+        for (int i = 0; i < AMF0_STATS_MARKERS; ++i) {
+            s->decoded[i] += c->decoded[i].load(std::memory_order_relaxed);
+            s->encoded[i] += c->encoded[i].load(std::memory_order_relaxed);
+        }
+        s->bytes_decoded += c->bytes_decoded.load(std::memory_order_relaxed);
+        s->bytes_encoded += c->bytes_encoded.load(std::memory_order_relaxed);
+        s->nodes_allocated += c->nodes_allocated.load(std::memory_order_relaxed);
+        s->strings_allocated += c->strings_allocated.load(std::memory_order_relaxed);
+        for (int i = 0; i < AMF0_STATS_ERRORS; ++i) {
+            s->decode_failures[i] += c->decode_failures[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < AMF0_STATS_LATENCY_BUCKETS; ++i) {
+            s->decode_latency[i] += c->decode_latency[i].load(std::memory_order_relaxed);
+            s->encode_latency[i] += c->encode_latency[i].load(std::memory_order_relaxed);
+        }
+
+        uint64_t seq = c->last_failure_seq.load(std::memory_order_acquire);
+        if (seq > latest) {
+            latest = seq;
+            s->last_failure_code = c->last_failure_code.load(std::memory_order_relaxed);
+            s->last_failure_offset = c->last_failure_offset.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool amf0_stats_enabled()
+{
+    return true;
+}
+
+#else
+
+void amf0_stats_snapshot(Amf0StatsSnapshot *s)
+{
+    memset(s, 0, sizeof(Amf0StatsSnapshot));
+    s->last_failure_offset = -1;
+}
+
+bool amf0_stats_enabled()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef __AMF0_STATS_H__
+#define __AMF0_STATS_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+// one slot per marker 0x00 - 0x10
+#define AMF0_STATS_MARKERS          17
+// one slot per error code from ERROR_AMF0_DECODE on
+#define AMF0_STATS_ERRORS           8
+// bucket i counts calls that took [2^i, 2^(i+1)) nanoseconds
+#define AMF0_STATS_LATENCY_BUCKETS  40
+
+struct Amf0StatsSnapshot
+{
+    uint64_t decoded[AMF0_STATS_MARKERS];
+    uint64_t encoded[AMF0_STATS_MARKERS];
+    uint64_t bytes_decoded;
+    uint64_t bytes_encoded;
+    uint64_t nodes_allocated;
+    uint64_t strings_allocated;
+    uint64_t decode_failures[AMF0_STATS_ERRORS];
+    // the most recent failure of any thread that reported one
+    int last_failure_code;
+    int last_failure_offset;
+    uint64_t decode_latency[AMF0_STATS_LATENCY_BUCKETS];
+    uint64_t encode_latency[AMF0_STATS_LATENCY_BUCKETS];
+};
+
+// sums the counters of every thread that ever touched the codec, without
+// locking or stopping them, totals only grow so exporters can take deltas.
+// all zero unless built with AMF0_ENABLE_STATS.
+void amf0_stats_snapshot(Amf0StatsSnapshot *snapshot);
+
+// true when the library was built with AMF0_ENABLE_STATS
+bool amf0_stats_enabled();
+
+#ifdef AMF0_ENABLE_STATS
+
+class Amf0StatsCounters;
+
+// counters of the calling thread, registered on first use
+Amf0StatsCounters *amf0_stats_local();
+
+class Amf0StatsCounters
+{
+public:
+    // only the owning thread writes, so a plain load/store pair is enough
+    static void add(std::atomic<uint64_t> &c, uint64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void failure(int code, int offset);
+    // a failure during a decode is only counted when the outermost call
+    // returns, and only the first one, where the innermost call gave up
+    void fail(int code, int offset);
+    void latency(std::atomic<uint64_t> *histogram, int64_t ns);
+
+public:
+    std::atomic<uint64_t> decoded[AMF0_STATS_MARKERS];
+    std::atomic<uint64_t> encoded[AMF0_STATS_MARKERS];
+    std::atomic<uint64_t> bytes_decoded;
+    std::atomic<uint64_t> bytes_encoded;
+    std::atomic<uint64_t> nodes_allocated;
+    std::atomic<uint64_t> strings_allocated;
+    std::atomic<uint64_t> decode_failures[AMF0_STATS_ERRORS];
+    std::atomic<int> last_failure_code;
+    std::atomic<int> last_failure_offset;
+    std::atomic<uint64_t> last_failure_seq;
+    std::atomic<uint64_t> decode_latency[AMF0_STATS_LATENCY_BUCKETS];
+    std::atomic<uint64_t> encode_latency[AMF0_STATS_LATENCY_BUCKETS];
+
+    // nesting of create_amf0data/write, only the outermost call is timed
+    int decode_depth;
+    int encode_depth;
+    // first failure of the decode in progress, ERROR_SUCCESS if none
+    int pending_failure_code;
+    int pending_failure_offset;
+
+    Amf0StatsCounters *next;
+};
+
+// times the outermost decode or encode of a thread and counts its bytes
+class Amf0StatsScope
+{
+public:
+    Amf0StatsScope(bool decode, int position)
+        : c(amf0_stats_local()), is_decode(decode), start_pos(position)
+    {
+        int &depth = is_decode ? c->decode_depth : c->encode_depth;
+        if (depth++ == 0) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    void finish(int position)
+    {
+        int &depth = is_decode ? c->decode_depth : c->encode_depth;
+        if (--depth != 0) {
+            return;
+        }
+
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if (is_decode && c->pending_failure_code != 0) {
+            c->failure(c->pending_failure_code, c->pending_failure_offset);
+            c->pending_failure_code = 0;
+        }
+        if (is_decode) {
+            Amf0StatsCounters::add(c->bytes_decoded, position - start_pos);
+            c->latency(c->decode_latency, ns);
+        } else {
+            Amf0StatsCounters::add(c->bytes_encoded, position - start_pos);
+            c->latency(c->encode_latency, ns);
+        }
+    }
+
+private:
+    Amf0StatsCounters *c;
+    bool is_decode;
+    int start_pos;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define AMF0_STATS_DECODE_BEGIN(sb) Amf0StatsScope amf0_stats_scope(true, (sb)->pos())
+#define AMF0_STATS_DECODE_END(sb) amf0_stats_scope.finish((sb)->pos())
+#define AMF0_STATS_ENCODE_BEGIN(sb) Amf0StatsScope amf0_stats_scope(false, (sb)->size())
+#define AMF0_STATS_ENCODE_END(sb) amf0_stats_scope.finish((sb)->size())
+#define AMF0_STATS_DECODED(marker) Amf0StatsCounters::add(amf0_stats_local()->decoded[(uint8_t)(marker) % AMF0_STATS_MARKERS], 1)
+#define AMF0_STATS_ENCODED(marker) Amf0StatsCounters::add(amf0_stats_local()->encoded[(uint8_t)(marker) % AMF0_STATS_MARKERS], 1)
+#define AMF0_STATS_NODE() Amf0StatsCounters::add(amf0_stats_local()->nodes_allocated, 1)
+#define AMF0_STATS_STRING() Amf0StatsCounters::add(amf0_stats_local()->strings_allocated, 1)
+#define AMF0_STATS_FAILURE(code, offset) amf0_stats_local()->fail(code, offset)
+
+#else
+
+#define AMF0_STATS_DECODE_BEGIN(sb) (void)0
+#define AMF0_STATS_DECODE_END(sb) (void)0
+#define AMF0_STATS_ENCODE_BEGIN(sb) (void)0
+#define AMF0_STATS_ENCODE_END(sb) (void)0
+#define AMF0_STATS_DECODED(marker) (void)0
+#define AMF0_STATS_ENCODED(marker) (void)0
+#define AMF0_STATS_NODE() (void)0
+#define AMF0_STATS_STRING() (void)0
+#define AMF0_STATS_FAILURE(code, offset) (void)0
+
+#endif
+
+#endif /* __AMF0_STATS_H__ */
@@ -0,0 +1,182 @@
+#include "amf0_trace.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "amf_errno.h"
+
+#ifdef AMF0_ENABLE_TRACE
+
+// every ring, pushed once and never removed, so a dump still shows
+// threads that exited until their events are overwritten
+static std::atomic<Amf0TraceRing *> amf0_trace_threads(nullptr);
+static std::atomic<int> amf0_trace_tids(0);
+static thread_local Amf0TraceRing *amf0_trace_tls = nullptr;
+static thread_local bool amf0_trace_exited = false;
+
+// gives the ring back when its thread exits, so threads coming and going
+// reuse rings instead of adding one each. An adopted ring keeps its tid.
+class Amf0TraceLocal
+{
+public:
+    Amf0TraceLocal() : ring(nullptr) {}
+    ~Amf0TraceLocal()
+    {
+        if (ring) {
+            // spans of later thread exit handlers record nothing
+            amf0_trace_tls = nullptr;
+            amf0_trace_exited = true;
+            ring->in_use.store(false, std::memory_order_release);
+            ring = nullptr;
+        }
+    }
+
+public:
+    Amf0TraceRing *ring;
+};
+
+static thread_local Amf0TraceLocal amf0_trace_holder;
+
+// a tick and a clock reading taken together, ticks are converted to
+// microseconds with the rate seen between this and the dump
+static uint64_t amf0_trace_origin_ticks = amf0_trace_now();
+static std::chrono::steady_clock::time_point amf0_trace_origin = std::chrono::steady_clock::now();
+
+Amf0TraceRing *amf0_trace_local()
+{
+    if (amf0_trace_tls || amf0_trace_exited) {
+        return amf0_trace_tls;
+    }
+
+    Amf0TraceRing *r = nullptr;
+    for (Amf0TraceRing *c = amf0_trace_threads.load(std::memory_order_acquire); c; c = c->next) {
+        bool expected = false;
+        if (!c->in_use.load(std::memory_order_relaxed) && c->in_use.compare_exchange_strong(expected, true)) {
+            r = c;
+            break;
+        }
+    }
+
+    if (!r) {
+        r = new Amf0TraceRing();
+        r->head.store(0);
+        r->floor.store(0);
+        r->tid = amf0_trace_tids.fetch_add(1) + 1;
+        r->in_use.store(true);
+
+        Amf0TraceRing *head = amf0_trace_threads.load(std::memory_order_relaxed);
+        do {
+            r->next = head;
+        } while (!amf0_trace_threads.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    amf0_trace_holder.ring = r;
+    amf0_trace_tls = r;
+    return r;
+}
+
+// events of r still in the ring and not overwritten while copied
+static void amf0_trace_copy(Amf0TraceRing *r, std::vector<Amf0TraceEvent> &events)
+{
+    uint64_t head = r->head.load(std::memory_order_acquire);
+    uint64_t first = r->floor.load(std::memory_order_relaxed);
+    if (head > AMF0_TRACE_RING_SIZE && first < head - AMF0_TRACE_RING_SIZE) {
+        first = head - AMF0_TRACE_RING_SIZE;
+    }
+
+    events.clear();
+    for (uint64_t i = first; i < head; ++i) {
+        events.push_back(r->events[i & (AMF0_TRACE_RING_SIZE - 1)]);
+    }
+
+    // the owner may be writing event after right now, into the slot of
+    // after - AMF0_TRACE_RING_SIZE, so that one is gone as well
+    uint64_t after = r->head.load(std::memory_order_acquire);
+    if (after >= AMF0_TRACE_RING_SIZE && after - AMF0_TRACE_RING_SIZE >= first) {
+        uint64_t lost = std::min<uint64_t>(after - AMF0_TRACE_RING_SIZE - first + 1, events.size());
+        events.erase(events.begin(), events.begin() + lost);
+    }
+}
+
+void amf0_trace_json(std::string &json)
+{
+    uint64_t ticks = amf0_trace_now() - amf0_trace_origin_ticks;
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - amf0_trace_origin).count();
+    double us_per_tick = ticks > 0 ? us / ticks : 0;
+
+    json = "{\"traceEvents\":[";
+    bool first = true;
+    char line[256];
+
+    std::vector<Amf0TraceEvent> events;
+    for (Amf0TraceRing *r = amf0_trace_threads.load(std::memory_order_acquire); r; r = r->next) {
+        amf0_trace_copy(r, events);
+
+        for (size_t i = 0; i < events.size(); ++i) {
+            const Amf0TraceEvent &e = events[i];
+            double ts = (int64_t)(e.ticks - amf0_trace_origin_ticks) * us_per_tick;
+
+            // instants are scoped to their thread, a number goes into args
+            int n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                first ? "" : ",", e.name, e.phase, e.phase == 'i' ? "\"s\":\"t\"," : "", ts, r->tid);
+            if (e.phase == 'i' || (e.phase == 'B' && e.arg != 0)) {
+                n += snprintf(line + n, sizeof(line) - n, ",\"args\":{\"value\":%d}}", e.arg);
+            } else {
+                n += snprintf(line + n, sizeof(line) - n, "}");
+            }
+            json.append(line, std::min<int>(n, sizeof(line) - 1));
+            first = false;
+        }
+    }
+
+    json += "],\"displayTimeUnit\":\"ns\"}";
+}
+
+void amf0_trace_reset()
+{
+    for (Amf0TraceRing *r = amf0_trace_threads.load(std::memory_order_acquire); r; r = r->next) {
+        r->floor.store(r->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+bool amf0_trace_enabled()
+{
+    return true;
+}
+
+#else
+
+void amf0_trace_json(std::string &json)
+{
+    json = "{\"traceEvents\":[]}";
+}
+
+void amf0_trace_reset()
+{
+}
+
+bool amf0_trace_enabled()
+{
+    return false;
+}
+
+#endif
+
+int amf0_trace_write(const std::string &path)
+{
+    std::string json;
+    amf0_trace_json(json);
+
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return ERROR_AMF0_IO;
+    }
+
+    bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size();
+    if (fclose(fp) != 0 || !ok) {
+        return ERROR_AMF0_IO;
+    }
+    return ERROR_SUCCESS;
+}
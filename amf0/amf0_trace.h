@@ -0,0 +1,129 @@
+#ifndef __AMF0_TRACE_H__
+#define __AMF0_TRACE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// events one thread keeps, older ones are overwritten, a power of two
+#define AMF0_TRACE_RING_SIZE 65536
+
+// the spans recorded so far by every thread as Chrome trace JSON, for
+// chrome://tracing or Perfetto. Empty unless built with AMF0_ENABLE_TRACE.
+void amf0_trace_json(std::string &json);
+// amf0_trace_json() into a file
+int amf0_trace_write(const std::string &path);
+// forgets what was recorded, e.g. right before the payload to look at
+void amf0_trace_reset();
+
+// true when the library was built with AMF0_ENABLE_TRACE
+bool amf0_trace_enabled();
+
+#ifdef AMF0_ENABLE_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// ticks of the time stamp counter, nanoseconds where there is none
+inline uint64_t amf0_trace_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct Amf0TraceEvent
+{
+    uint64_t ticks;
+    // a string literal, only the pointer is stored
+    const char *name;
+    // 'B' begin, 'E' end or 'i' instant
+    char phase;
+    int32_t arg;
+};
+
+/**
+ * Events of one thread. Only the owner writes, it stores the event and
+ * then publishes it by bumping head. A reader copies what it wants and
+ * checks head again, an event the owner may have overwritten meanwhile
+ * is dropped instead of waited for.
+ */
+class Amf0TraceRing
+{
+public:
+    void add(const char *name, char phase, int32_t arg)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        Amf0TraceEvent &e = events[h & (AMF0_TRACE_RING_SIZE - 1)];
+        e.ticks = amf0_trace_now();
+        e.name = name;
+        e.phase = phase;
+        e.arg = arg;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+public:
+    Amf0TraceEvent events[AMF0_TRACE_RING_SIZE];
+    std::atomic<uint64_t> head;
+    // events before it were reset
+    std::atomic<uint64_t> floor;
+    int tid;
+    // owned by a live thread, a free ring is adopted by the next new one
+    std::atomic<bool> in_use;
+    Amf0TraceRing *next;
+};
+
+// ring of the calling thread, registered on first use, nullptr once the
+// thread is exiting and gave its ring back
+Amf0TraceRing *amf0_trace_local();
+
+class Amf0TraceSpan
+{
+public:
+    Amf0TraceSpan(const char *name, int32_t arg = 0) : ring(amf0_trace_local()), name(name)
+    {
+        if (ring) {
+            ring->add(name, 'B', arg);
+        }
+    }
+    ~Amf0TraceSpan()
+    {
+        if (ring) {
+            ring->add(name, 'E', 0);
+        }
+    }
+
+private:
+    Amf0TraceRing *ring;
+    const char *name;
+};
+
+#define AMF0_TRACE_CONCAT2(a, b) a##b
+#define AMF0_TRACE_CONCAT(a, b) AMF0_TRACE_CONCAT2(a, b)
+// from here to the end of the scope, name must be a string literal
+#define AMF0_TRACE_SPAN(name) Amf0TraceSpan AMF0_TRACE_CONCAT(amf0_trace_span_, __LINE__)(name)
+// a span showing one number in its args, e.g. the capacity a buffer grows to
+#define AMF0_TRACE_SPAN_ARG(name, arg) Amf0TraceSpan AMF0_TRACE_CONCAT(amf0_trace_span_, __LINE__)(name, (int32_t)(arg))
+// a point in time with one number, e.g. the capacity a buffer grew to
+#define AMF0_TRACE_INSTANT(name, arg) \
+    do { \
+        Amf0TraceRing *amf0_trace_ring = amf0_trace_local(); \
+        if (amf0_trace_ring) \
+            amf0_trace_ring->add(name, 'i', (int32_t)(arg)); \
+    } while (0)
+
+#else
+
+#define AMF0_TRACE_SPAN(name) (void)0
+#define AMF0_TRACE_SPAN_ARG(name, arg) (void)0
+#define AMF0_TRACE_INSTANT(name, arg) (void)0
+
+#endif
+
+#endif /* __AMF0_TRACE_H__ */
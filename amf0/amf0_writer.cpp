@@ -0,0 +1,235 @@
+#include "amf0_writer.h"
+
+#include <string.h>
+
+#include "amf_core.h"
+#include "amf_errno.h"
+#include "simple_buffer.h"
+
+Amf0Writer::Amf0Writer(SimpleBuffer *sb)
+    : sb(sb), depth(0), _error(ERROR_SUCCESS)
+{
+}
+
+Amf0Writer::~Amf0Writer()
+{
+}
+
+void Amf0Writer::fail()
+{
+    if (_error == ERROR_SUCCESS) {
+        _error = ERROR_AMF0_INVALID;
+    }
+}
+
+bool Amf0Writer::value()
+{
+    if (_error != ERROR_SUCCESS) {
+        return false;
+    }
+
+    if (depth == 0) {
+        return true;
+    }
+
+    Frame &f = stack[depth - 1];
+    if (f.marker == AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY) {
+        f.count++;
+        return true;
+    }
+
+    // objects and ECMA arrays need a key before every value
+    if (!f.has_key) {
+        fail();
+        return false;
+    }
+    f.has_key = false;
+    return true;
+}
+
+void Amf0Writer::number(double value)
+{
+    if (!this->value()) {
+        return;
+    }
+
+    int64_t temp;
+    memcpy(&temp, &value, 8);
+    sb->write_1byte(AMF0_MARKER::AMF0_MARKER_NUMBER);
+    sb->write_8bytes(temp);
+}
+
+void Amf0Writer::boolean(bool value)
+{
+    if (!this->value()) {
+        return;
+    }
+
+    sb->write_1byte(AMF0_MARKER::AMF0_MARKER_BOOLEAN);
+    sb->write_1byte(value ? 0x01 : 0x00);
+}
+
+void Amf0Writer::string(const char *value, int len)
+{
+    if (len < 0) {
+        fail();
+        return;
+    }
+    if (!this->value()) {
+        return;
+    }
+
+    if (len > 0xFFFF) {
+        sb->write_1byte(AMF0_MARKER::AMF0_MARKER_LONG_STRING);
+        sb->write_4bytes(len);
+    } else {
+        sb->write_1byte(AMF0_MARKER::AMF0_MARKER_STRING);
+        sb->write_2bytes(len);
+    }
+    sb->append(value, len);
+}
+
+void Amf0Writer::string(const char *value)
+{
+    string(value, strlen(value));
+}
+
+void Amf0Writer::string(const std::string &value)
+{
+    string(value.data(), value.size());
+}
+
+void Amf0Writer::null()
+{
+    if (!value()) {
+        return;
+    }
+    sb->write_1byte(AMF0_MARKER::AMF0_MARKER_NULL);
+}
+
+void Amf0Writer::undefined()
+{
+    if (!value()) {
+        return;
+    }
+    sb->write_1byte(AMF0_MARKER::AMF0_MARKER_UNDEFINED);
+}
+
+void Amf0Writer::key(const char *name, int len)
+{
+    if (_error != ERROR_SUCCESS) {
+        return;
+    }
+
+    // an empty name would read back as the object end
+    if (len <= 0 || len > 0xFFFF || depth == 0) {
+        fail();
+        return;
+    }
+
+    Frame &f = stack[depth - 1];
+    if (f.marker == AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY || f.has_key) {
+        fail();
+        return;
+    }
+    f.has_key = true;
+    f.count++;
+
+    sb->write_2bytes(len);
+    sb->append(name, len);
+}
+
+void Amf0Writer::key(const char *name)
+{
+    key(name, strlen(name));
+}
+
+void Amf0Writer::key(const std::string &name)
+{
+    key(name.data(), name.size());
+}
+
+void Amf0Writer::push(char marker)
+{
+    if (_error == ERROR_SUCCESS && depth >= AMF0_WRITER_MAX_DEPTH) {
+        fail();
+    }
+    if (!value()) {
+        return;
+    }
+
+    Frame &f = stack[depth++];
+    f.marker = marker;
+    f.count_pos = -1;
+    f.count = 0;
+    f.has_key = false;
+
+    sb->write_1byte(marker);
+    if (marker != AMF0_MARKER::AMF0_MARKER_OBJECT) {
+        f.count_pos = sb->size();
+        sb->write_4bytes(0);
+    }
+}
+
+void Amf0Writer::pop(char marker)
+{
+    if (_error != ERROR_SUCCESS) {
+        return;
+    }
+
+    if (depth == 0 || stack[depth - 1].marker != marker || stack[depth - 1].has_key) {
+        fail();
+        return;
+    }
+
+    Frame &f = stack[--depth];
+    if (f.count_pos >= 0) {
+        char be[4] = { (char)(f.count >> 24), (char)(f.count >> 16), (char)(f.count >> 8), (char)f.count };
+        sb->set_data(f.count_pos, be, 4);
+    }
+
+    if (marker != AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY) {
+        sb->write_2bytes(0x00);
+        sb->write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT_END);
+    }
+}
+
+void Amf0Writer::begin_object()
+{
+    push(AMF0_MARKER::AMF0_MARKER_OBJECT);
+}
+
+void Amf0Writer::end_object()
+{
+    pop(AMF0_MARKER::AMF0_MARKER_OBJECT);
+}
+
+void Amf0Writer::begin_ecma_array()
+{
+    push(AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY);
+}
+
+void Amf0Writer::end_ecma_array()
+{
+    pop(AMF0_MARKER::AMF0_MARKER_ECMA_ARRAY);
+}
+
+void Amf0Writer::begin_strict_array()
+{
+    push(AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY);
+}
+
+void Amf0Writer::end_strict_array()
+{
+    pop(AMF0_MARKER::AMF0_MARKER_STRICT_ARRAY);
+}
+
+bool Amf0Writer::done()
+{
+    return _error == ERROR_SUCCESS && depth == 0;
+}
+
+int Amf0Writer::error()
+{
+    return _error;
+}
@@ -0,0 +1,90 @@
+#ifndef __AMF0_WRITER_H__
+#define __AMF0_WRITER_H__
+
+#include <stdint.h>
+#include <string>
+
+class SimpleBuffer;
+
+// deepest nesting a writer can track
+#define AMF0_WRITER_MAX_DEPTH 32
+
+/**
+ * Forward-only encoder that emits AMF0 straight into a SimpleBuffer,
+ * without building Amf0Data nodes:
+ *
+ *     Amf0Writer w(&sb);
+ *     w.string("onStatus");
+ *     w.number(0);
+ *     w.null();
+ *     w.begin_object();
+ *     w.key("code");
+ *     w.string("NetStream.Play.Start");
+ *     w.end_object();
+ *
+ * ECMA and strict array counts are patched when the array is closed.
+ * Strings longer than 65535 bytes are written as long strings.
+ *
+ * A misplaced key or value, an end that does not match its begin, nesting
+ * deeper than AMF0_WRITER_MAX_DEPTH or a key longer than 65535 bytes puts
+ * the writer in an error state: nothing more is written and error()
+ * returns ERROR_AMF0_INVALID.
+ */
+class Amf0Writer
+{
+public:
+    Amf0Writer(SimpleBuffer *sb);
+    virtual ~Amf0Writer();
+
+public:
+    void number(double value);
+    void boolean(bool value);
+    void string(const char *value, int len);
+    void string(const char *value);
+    void string(const std::string &value);
+    void null();
+    void undefined();
+
+public:
+    // property name inside an object or ECMA array
+    void key(const char *name, int len);
+    void key(const char *name);
+    void key(const std::string &name);
+
+    void begin_object();
+    void end_object();
+    void begin_ecma_array();
+    void end_ecma_array();
+    void begin_strict_array();
+    void end_strict_array();
+
+public:
+    // nothing is left open
+    bool done();
+    // ERROR_SUCCESS, or the first misuse
+    int error();
+
+private:
+    bool value();
+    void fail();
+    void push(char marker);
+    void pop(char marker);
+
+private:
+    struct Frame
+    {
+        char marker;
+        // where the array count goes and what it will be
+        int count_pos;
+        int32_t count;
+        // a key was written and its value is still missing
+        bool has_key;
+    };
+
+    SimpleBuffer *sb;
+    Frame stack[AMF0_WRITER_MAX_DEPTH];
+    int depth;
+    int _error;
+};
+
+#endif /* __AMF0_WRITER_H__ */
@@ -15,4 +15,28 @@
             } \
     (void)0
 
+class AMF0_MARKER
+{
+public:
+    static const char AMF0_MARKER_NUMBER        = 0x00;
+    static const char AMF0_MARKER_BOOLEAN       = 0x01;
+    static const char AMF0_MARKER_STRING        = 0x02;
+    static const char AMF0_MARKER_OBJECT        = 0x03;
+    static const char AMF0_MARKER_MOVIECLIP     = 0x04; // reserved, not used
+    static const char AMF0_MARKER_NULL          = 0x05;
+    static const char AMF0_MARKER_UNDEFINED     = 0x06;
+    static const char AMF0_MARKER_REFERENCE     = 0x07;
+    static const char AMF0_MARKER_ECMA_ARRAY    = 0x08;
+    static const char AMF0_MARKER_OBJECT_END    = 0x09;
+    static const char AMF0_MARKER_STRICT_ARRAY  = 0x0A;
+    static const char AMF0_MARKER_DATE          = 0x0B;
+    static const char AMF0_MARKER_LONG_STRING   = 0x0C;
+    static const char AMF0_MARKER_UNSUPPORTED   = 0x0D;
+    static const char AMF0_MARKER_RECORDSET     = 0x0E; // reserved, not used
+    static const char AMF0_MARKER_XML_DOC       = 0x0F;
+    static const char AMF0_MARKER_TYPED_OBJECT  = 0x10;
+
+    static const char AMF0_MARKER_INVALID       = 0xff;
+};
+
 #endif
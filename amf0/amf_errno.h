@@ -5,5 +5,10 @@
 
 #define ERROR_AMF0_DECODE              2000
 #define ERROR_AMF0_INVALID             2001
+#define ERROR_AMF0_UTF8                2002
+#define ERROR_AMF0_DEPTH               2003
+#define ERROR_AMF0_NODES               2004
+#define ERROR_AMF0_BUDGET              2005
+#define ERROR_AMF0_IO                  2006
 
 #endif
@@ -1,156 +1,163 @@
 #include "simple_buffer.h"
 
 #include <assert.h>
-//#include <algorithm>
-#include <iterator>
+#include <algorithm>
+
+#include "amf0_trace.h"
+
+// first heap allocation, small enough for command messages
+#define SIMPLE_BUFFER_MIN_CAPACITY 256
 
 SimpleBuffer::SimpleBuffer()
-    : _pos(0)
+    : _data(nullptr), _size(0), _capacity(0), _limit(0), _boundary(INT32_MAX), _pos(0), _inline(nullptr), _fixed(false)
 {
 }
 
 SimpleBuffer::SimpleBuffer(int32_t size, int8_t value)
-    : _pos(0)
+    : _data(nullptr), _size(0), _capacity(0), _limit(0), _boundary(INT32_MAX), _pos(0), _inline(nullptr), _fixed(false)
 {
-    _data = std::vector<char>(size, value);
+    reserve(size);
+    memset(_data, value, size);
+    _size = size;
 }
 
-SimpleBuffer::~SimpleBuffer()
+SimpleBuffer::SimpleBuffer(char *storage, int capacity, bool fixed)
+    : _data(storage), _size(0), _capacity(capacity), _limit(capacity), _boundary(INT32_MAX), _pos(0), _inline(storage), _fixed(fixed)
 {
 }
 
-void SimpleBuffer::write_1byte(int8_t val)
+SimpleBuffer::SimpleBuffer(const SimpleBuffer &other)
+    : _data(nullptr), _size(0), _capacity(0), _limit(0), _boundary(INT32_MAX), _pos(0), _inline(nullptr), _fixed(false)
 {
-    _data.push_back(val);
+    *this = other;
 }
 
-void SimpleBuffer::write_2bytes(int16_t val)
+SimpleBuffer &SimpleBuffer::operator=(const SimpleBuffer &other)
 {
-    char *p = (char *)&val;
-
-    for (int i = 1; i >= 0; --i) {
-        _data.push_back(p[i]);
+    if (this != &other) {
+        _size = 0;
+        reserve(other._size);
+        // an overflowed fixed buffer counts bytes it never held
+        int n = std::min(std::min(other._size, other._capacity), _capacity);
+        if (n > 0) {
+            memcpy(_data, other._data, n);
+        }
+        _size = n;
+        _pos = other._pos;
     }
+
+    return *this;
 }
 
-void SimpleBuffer::write_3bytes(int32_t val)
+SimpleBuffer::~SimpleBuffer()
 {
-    char *p = (char *)&val;
-
-    for (int i = 2; i >= 0; --i) {
-        _data.push_back(p[i]);
-    }
+    release();
 }
 
-void SimpleBuffer::write_4bytes(int32_t val)
+void SimpleBuffer::release()
 {
-    char *p = (char *)&val;
-
-    for (int i = 3; i >= 0; --i) {
-        _data.push_back(p[i]);
+    if (_data != _inline) {
+        amf0_deallocate(_data);
     }
+    _data = _inline;
 }
 
-void SimpleBuffer::write_8bytes(int64_t val)
+bool SimpleBuffer::grow(int n)
 {
-    char *p = (char *)&val;
+    if (_fixed) {
+        return false;
+    }
 
-    for (int i = 7; i >= 0; --i) {
-        _data.push_back(p[i]);
+    // in 64 bits, doubling past 1GB would wrap an int
+    int64_t required = (int64_t)_size + n;
+    if (required > INT32_MAX) {
+        return false;
     }
-}
 
-void SimpleBuffer::write_string(std::string val)
-{
-    std::copy(val.begin(), val.end(), std::back_inserter(_data));
+    int64_t capacity = (int64_t)_capacity * 2;
+    if (capacity < SIMPLE_BUFFER_MIN_CAPACITY) {
+        capacity = SIMPLE_BUFFER_MIN_CAPACITY;
+    }
+    if (capacity < required) {
+        capacity = required;
+    }
+    if (capacity > INT32_MAX) {
+        capacity = INT32_MAX;
+    }
+
+    reserve((int)capacity);
+    return true;
 }
 
-void SimpleBuffer::append(const char* bytes, int size)
+void SimpleBuffer::reserve(int capacity)
 {
-    if (!bytes || size <= 0)
+    if (capacity <= _capacity || _fixed) {
         return;
+    }
 
-    _data.insert(_data.end(), bytes, bytes + size);
+    // the allocation and the copy of what was written so far
+    AMF0_TRACE_SPAN_ARG("SimpleBuffer::grow", capacity);
+    char *p = (char *)amf0_allocate(capacity);
+    if (_size > 0) {
+        memcpy(p, _data, _size);
+    }
+
+    release();
+    _data = p;
+    _capacity = capacity;
+    _limit = std::min(_capacity, _boundary);
 }
 
-int8_t SimpleBuffer::read_1byte()
+void SimpleBuffer::set_boundary(int pos)
 {
-    assert(require(1));
-
-    int8_t val = _data.at(0 + _pos);
-    _pos++;
-
-    return val;
+    _boundary = pos;
+    _limit = std::min(_capacity, _boundary);
 }
 
-int16_t SimpleBuffer::read_2bytes()
+void SimpleBuffer::write_slow(const char *bytes, int n)
 {
-    assert(require(2));
-
-    int16_t val = 0;
-    char *p = (char *)&val;
-
-    for (int i = 1; i >= 0; --i) {
-        p[i] = _data.at(0 + _pos);
-        _pos++;
+    if ((int64_t)_size + n > _capacity && !grow(n)) {
+        // stays past the capacity, so overflowed() reports it
+        _size = (int)std::min<int64_t>((int64_t)_size + n, INT32_MAX);
+        return;
     }
 
-    return val;
+    memcpy(_data + _size, bytes, n);
+    _size += n;
 }
 
-int32_t SimpleBuffer::read_3bytes()
+int SimpleBuffer::capacity()
 {
-    assert(require(3));
-
-    int32_t val = 0;
-    char *p = (char *)&val;
-
-    for (int i = 2; i >= 0; --i) {
-        p[i] = _data.at(0 + _pos);
-        _pos++;
-    }
-
-    return val;
+    return _capacity;
 }
 
-int32_t SimpleBuffer::read_4bytes()
+bool SimpleBuffer::is_inline()
 {
-    assert(require(4));
-
-    int32_t val = 0;
-    char *p = (char *)&val;
-
-    for (int i = 3; i >= 0; --i) {
-        p[i] = _data.at(0 + _pos);
-        _pos++;
-    }
-
-    return val;
+    return _inline && _data == _inline;
 }
 
-int64_t SimpleBuffer::read_8bytes()
+bool SimpleBuffer::overflowed()
 {
-    assert(require(8));
-
-    int64_t val = 0;
-    char *p = (char *)&val;
-
-    for (int i = 7; i >= 0; --i) {
-        p[i] = _data.at(0 + _pos);
-        _pos++;
-    }
+    return _size > _capacity;
+}
 
-    return val;
+void SimpleBuffer::write_string(const std::string &val)
+{
+    append(val.data(), val.size());
 }
 
-std::string SimpleBuffer::read_string(int len)
+void SimpleBuffer::append(const char* bytes, int size)
 {
-    assert(require(len));
+    if (!bytes || size <= 0)
+        return;
 
-    std::string val(&_data[0] + _pos, len);
-    _pos += len;
+    if (_size + size > _limit) {
+        write_slow(bytes, size);
+        return;
+    }
 
-    return val;
+    memcpy(_data + _size, bytes, size);
+    _size += size;
 }
 
 void SimpleBuffer::skip(int size)
@@ -158,21 +165,14 @@ void SimpleBuffer::skip(int size)
     _pos += size;
 }
 
-bool SimpleBuffer::require(int required_size)
-{
-    assert(required_size >= 0);
-
-    return required_size <= _data.size() - _pos;
-}
-
 bool SimpleBuffer::empty()
 {
-    return _pos >= _data.size();
+    return _pos >= _size;
 }
 
 int SimpleBuffer::size()
 {
-    return _data.size();
+    return _size;
 }
 
 int SimpleBuffer::pos()
@@ -182,13 +182,13 @@ int SimpleBuffer::pos()
 
 char *SimpleBuffer::data()
 {
-    return (size() == 0) ? nullptr : &_data[0];
+    return (size() == 0) ? nullptr : _data;
 }
 
 void SimpleBuffer::clear()
 {
     _pos = 0;
-    _data.clear();
+    _size = 0;
 }
 
 void SimpleBuffer::set_data(int pos, const char *data, int len)
@@ -196,16 +196,14 @@ void SimpleBuffer::set_data(int pos, const char *data, int len)
     if (!data)
         return;
 
-    if (pos + len > size()) {
+    if (pos + len > size() || pos + len > _capacity) {
         return;
     }
 
-    for (int i = 0; i < len; i++) {
-        _data[pos + i] = data[i];
-    }
+    memcpy(_data + pos, data, len);
 }
 
 std::string SimpleBuffer::to_string()
 {
-    return std::string(_data.begin(), _data.end());
+    return _size ? std::string(_data, std::min(_size, _capacity)) : std::string();
 }
@@ -1,9 +1,12 @@
 #ifndef __SIMPLE_BUFFER_H__
 #define __SIMPLE_BUFFER_H__
 
-#include <vector>
 #include <string>
 #include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "amf0_allocator.h"
 
 // only support little endian
 class SimpleBuffer
@@ -11,15 +14,22 @@ class SimpleBuffer
 public:
     SimpleBuffer();
     SimpleBuffer(int32_t size, int8_t value);
+    SimpleBuffer(const SimpleBuffer &other);
+    SimpleBuffer &operator=(const SimpleBuffer &other);
     virtual ~SimpleBuffer();
 
+protected:
+    // starts out in caller owned storage, see InlineSimpleBuffer, a fixed
+    // buffer never leaves it, see FixedSimpleBuffer
+    SimpleBuffer(char *storage, int capacity, bool fixed = false);
+
 public:
     void write_1byte(int8_t val);
     void write_2bytes(int16_t val);
     void write_3bytes(int32_t val);
     void write_4bytes(int32_t val);
     void write_8bytes(int64_t val);
-    void write_string(std::string val);
+    void write_string(const std::string &val);
     void append(const char* bytes, int size);
 
 public:
@@ -29,6 +39,7 @@ public:
     int32_t read_4bytes();
     int64_t read_8bytes();
     std::string read_string(int len);
+    int8_t peek_1byte();
 
 public:
     void skip(int size);
@@ -38,14 +49,231 @@ public:
     int pos();
     char *data();
     void clear();
-    void set_data(int pos, const char *data, int len);
+    // overwrites len bytes at pos of what was written, e.g. a count
+    virtual void set_data(int pos, const char *data, int len);
+    void reserve(int capacity);
+    int capacity();
+    // true while the bytes still live in the inline storage
+    bool is_inline();
+    // true once a fixed buffer was asked for more than its capacity,
+    // size() then tells how much it would have taken
+    bool overflowed();
 
 public:
     std::string to_string();
 
+protected:
+    // every write that does not fit below the limit ends up here
+    virtual void write_slow(const char *bytes, int n);
+    // lowers the limit to buffer position pos, so that writes reaching
+    // it go through write_slow(), INT32_MAX puts it back at the capacity
+    void set_boundary(int pos);
+
 private:
-    std::vector<char> _data;
+    // makes room for n more bytes, false for a full fixed buffer, which
+    // then only counts what it cannot hold
+    bool grow(int n);
+    void release();
+
+protected:
+    char *_data;
+    int _size;
+
+private:
+    int _capacity;
+    // writes below it take the inline path, min(_capacity, _boundary)
+    int _limit;
+    int _boundary;
     int _pos;
+    char *_inline;
+    bool _fixed;
+};
+
+// keeps the first N bytes in place, e.g. on the stack, and only moves to
+// the heap when a message outgrows them
+template <int N>
+class InlineSimpleBuffer : public SimpleBuffer
+{
+public:
+    InlineSimpleBuffer() : SimpleBuffer(_storage, N) {}
+    virtual ~InlineSimpleBuffer() {}
+
+private:
+    InlineSimpleBuffer(const InlineSimpleBuffer &);
+    InlineSimpleBuffer &operator=(const InlineSimpleBuffer &);
+
+private:
+    char _storage[N];
+};
+
+// encodes into caller owned memory, e.g. a registered send buffer, and
+// never allocates: writes past the capacity are dropped and only counted
+class FixedSimpleBuffer : public SimpleBuffer
+{
+public:
+    FixedSimpleBuffer(char *data, int capacity) : SimpleBuffer(data, capacity, true) {}
+    virtual ~FixedSimpleBuffer() {}
+
+private:
+    FixedSimpleBuffer(const FixedSimpleBuffer &);
+    FixedSimpleBuffer &operator=(const FixedSimpleBuffer &);
+};
+
+// reads bytes owned by someone else in place, e.g. a slice of a batch or
+// a mapped file, they are never copied or written to
+class ViewSimpleBuffer : public SimpleBuffer
+{
+public:
+    ViewSimpleBuffer(const char *data, int size) : SimpleBuffer((char *)data, size, true)
+    {
+        _size = size;
+    }
+    virtual ~ViewSimpleBuffer() {}
+
+public:
+    virtual void set_data(int pos, const char *data, int len) {}
+
+private:
+    ViewSimpleBuffer(const ViewSimpleBuffer &);
+    ViewSimpleBuffer &operator=(const ViewSimpleBuffer &);
 };
 
+inline void SimpleBuffer::write_1byte(int8_t val)
+{
+    if (_size + 1 > _limit) {
+        write_slow((const char *)&val, 1);
+        return;
+    }
+
+    _data[_size++] = val;
+}
+
+inline void SimpleBuffer::write_2bytes(int16_t val)
+{
+    uint16_t be = __builtin_bswap16((uint16_t)val);
+    if (_size + 2 > _limit) {
+        write_slow((const char *)&be, 2);
+        return;
+    }
+
+    memcpy(_data + _size, &be, 2);
+    _size += 2;
+}
+
+inline void SimpleBuffer::write_3bytes(int32_t val)
+{
+    if (_size + 3 > _limit) {
+        char be[3] = { (char)(val >> 16), (char)(val >> 8), (char)val };
+        write_slow(be, 3);
+        return;
+    }
+
+    _data[_size++] = (char)(val >> 16);
+    _data[_size++] = (char)(val >> 8);
+    _data[_size++] = (char)val;
+}
+
+inline void SimpleBuffer::write_4bytes(int32_t val)
+{
+    uint32_t be = __builtin_bswap32((uint32_t)val);
+    if (_size + 4 > _limit) {
+        write_slow((const char *)&be, 4);
+        return;
+    }
+
+    memcpy(_data + _size, &be, 4);
+    _size += 4;
+}
+
+inline void SimpleBuffer::write_8bytes(int64_t val)
+{
+    uint64_t be = __builtin_bswap64((uint64_t)val);
+    if (_size + 8 > _limit) {
+        write_slow((const char *)&be, 8);
+        return;
+    }
+
+    memcpy(_data + _size, &be, 8);
+    _size += 8;
+}
+
+/**
+ * The readers do not check bounds themselves: callers reserve a whole run of
+ * fields with one require() and then read through a raw pointer. Debug builds
+ * still assert on every read, -DNDEBUG leaves a plain load.
+ */
+inline bool SimpleBuffer::require(int required_size)
+{
+    assert(required_size >= 0);
+
+    return required_size <= _size - _pos;
+}
+
+inline int8_t SimpleBuffer::read_1byte()
+{
+    assert(require(1));
+
+    return _data[_pos++];
+}
+
+inline int8_t SimpleBuffer::peek_1byte()
+{
+    assert(require(1));
+
+    return _data[_pos];
+}
+
+inline int16_t SimpleBuffer::read_2bytes()
+{
+    assert(require(2));
+
+    uint16_t val;
+    memcpy(&val, _data + _pos, 2);
+    _pos += 2;
+
+    return (int16_t)__builtin_bswap16(val);
+}
+
+inline int32_t SimpleBuffer::read_3bytes()
+{
+    assert(require(3));
+
+    const uint8_t *p = (const uint8_t *)_data + _pos;
+    _pos += 3;
+
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+inline int32_t SimpleBuffer::read_4bytes()
+{
+    assert(require(4));
+
+    uint32_t val;
+    memcpy(&val, _data + _pos, 4);
+    _pos += 4;
+
+    return (int32_t)__builtin_bswap32(val);
+}
+
+inline int64_t SimpleBuffer::read_8bytes()
+{
+    assert(require(8));
+
+    uint64_t val;
+    memcpy(&val, _data + _pos, 8);
+    _pos += 8;
+
+    return (int64_t)__builtin_bswap64(val);
+}
+
+inline std::string SimpleBuffer::read_string(int len)
+{
+    assert(require(len));
+
+    std::string val(_data + _pos, len);
+    _pos += len;
+
+    return val;
+}
+
 #endif /* __SIMPLE_BUFFER_H__ */
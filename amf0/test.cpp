@@ -1,8 +1,34 @@
 #include <iostream>
+#include <thread>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include "amf_core.h"
+#include "amf_errno.h"
 #include "simple_buffer.h"
 #include "amf0.h"
+#include "amf0_batch.h"
+#include "amf0_simd.h"
+#include "amf0_json.h"
+#include "amf0_stats.h"
+#include "amf0_allocator.h"
+#include "amf0_writer.h"
+#include "amf0_frozen.h"
+#include "amf0_catalog.h"
+#include "amf0_flv.h"
+#include "amf0_registry.h"
+#include "amf0_cache.h"
+#include "amf0_literal.h"
+#include "amf0_lazy.h"
+#include "amf0_chunk.h"
+#include "amf0_shape.h"
+#include "amf0_buffer_pool.h"
+#include "amf0_diff.h"
+#include "amf0_capture.h"
+#include "amf0_trace.h"
 
 using namespace std;
 
@@ -23,6 +49,24 @@ static int test_pass = 0;
 
 #define EXPECT_EQ_STRING(expect, actual) EXPECT_EQ_BASE((expect) == (actual), expect, actual)
 
+// global news on this thread, the allocator counters miss std::string and friends
+static thread_local uint64_t global_news = 0;
+
+void *operator new(size_t size)
+{
+    global_news++;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
 static void test_parse_number()
 {
     SimpleBuffer expect, actual;
@@ -51,15 +95,1828 @@ static void test_parse_boolean()
     EXPECT_EQ_STRING(expect.to_string(), actual.to_string());
 }
 
+static void test_parse_string()
+{
+    SimpleBuffer expect, actual;
+
+    // lengths above 32767 must not turn negative
+    Amf0String expect_string(string(40000, 'x'));
+    expect_string.write(&expect);
+
+    Amf0String actual_string;
+    EXPECT_EQ_BASE(actual_string.read(&expect) == 0, true, false);
+    actual_string.write(&actual);
+
+    EXPECT_EQ_STRING(expect.to_string(), actual.to_string());
+}
+
+static void test_parse_strict_array()
+{
+    SimpleBuffer expect, actual;
+
+    Amf0StrictArray expect_array;
+    expect_array.put(new Amf0Number(1));
+    expect_array.put(new Amf0String("two"));
+    expect_array.put(new Amf0Null());
+    expect_array.write(&expect);
+
+    Amf0Data *actual_array = Amf0Data::create_amf0data(&expect);
+    EXPECT_EQ_BASE(actual_array != nullptr, true, false);
+    if (actual_array) {
+        actual_array->write(&actual);
+        delete actual_array;
+    }
+
+    EXPECT_EQ_STRING(expect.to_string(), actual.to_string());
+
+    // the count promises three elements, the last one is cut off
+    SimpleBuffer truncated;
+    truncated.append(actual.data(), actual.size() - 1);
+    Amf0Data *short_array = Amf0Data::create_amf0data(&truncated);
+    EXPECT_EQ_BASE(short_array == nullptr, true, false);
+    delete short_array;
+}
+
+static void test_parse_truncated()
+{
+    SimpleBuffer full;
+    Amf0Object object;
+    object.put("app", new Amf0String("live"));
+    object.put("fpad", new Amf0Boolean(false));
+    object.put("audioCodecs", new Amf0Number(3575));
+    Amf0EcmaArray *nested = new Amf0EcmaArray();
+    nested->put("list", new Amf0StrictArray());
+    object.put("nested", nested);
+    object.write(&full);
+
+    // no prefix may read past the end, a cut at a property boundary is
+    // accepted since a missing object end is tolerated for compatibility
+    int decoded = 0;
+    for (int len = 0; len <= full.size(); ++len) {
+        SimpleBuffer sb;
+        sb.append(full.data(), len);
+        Amf0Data *data = Amf0Data::create_amf0data(&sb);
+        if (data) {
+            decoded++;
+            EXPECT_EQ_BASE(sb.empty(), true, len);
+        }
+        delete data;
+    }
+    EXPECT_EQ_BASE(decoded == 8, true, decoded);
+}
+
 static void test_parse()
 {
     test_parse_number();
     test_parse_boolean();
+    test_parse_string();
+    test_parse_strict_array();
+    test_parse_truncated();
+}
+
+static void test_batch()
+{
+    vector<string> messages;
+    for (int i = 0; i < 100; ++i) {
+        SimpleBuffer sb;
+        Amf0String name("onMetaData");
+        name.write(&sb);
+
+        Amf0EcmaArray meta;
+        meta.put("duration", new Amf0Number(i));
+        meta.put("encoder", new Amf0String("amf0"));
+        meta.write(&sb);
+
+        messages.push_back(sb.to_string());
+    }
+    // truncated message must fail on its own without affecting the others
+    messages[7].resize(messages[7].size() - 4);
+
+    vector<Amf0Slice> slices;
+    for (size_t i = 0; i < messages.size(); ++i) {
+        Amf0Slice slice = { messages[i].data(), (int)messages[i].size() };
+        slices.push_back(slice);
+    }
+
+    Amf0BatchCodec codec(4);
+    vector<Amf0BatchItem> items;
+    EXPECT_EQ_BASE(1 == codec.decode(slices, items), 1, "decode failures");
+
+    vector<Amf0Data *> values;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (i == 7)
+            continue;
+        EXPECT_EQ_BASE(items[i].values.size() == 2, 2, items[i].values.size());
+        values.push_back(items[i].values[0]);
+        values.push_back(items[i].values[1]);
+    }
+
+    vector<string> encoded;
+    codec.encode(values, encoded);
+    for (size_t i = 0, j = 0; i < messages.size(); ++i) {
+        if (i == 7)
+            continue;
+        EXPECT_EQ_STRING(messages[i], encoded[j] + encoded[j + 1]);
+        j += 2;
+    }
+
+    // every worker decodes from an arena over the codec's allocator, the
+    // values may outlive the codec and the arenas go with the last of them
+    Amf0CountingAllocator counting;
+    {
+        Amf0BatchCodec counted(4, &counting);
+        EXPECT_EQ_BASE(1 == counted.decode(slices, items), 1, "decode failures");
+        EXPECT_EQ_BASE(counting.allocations() > 0 && counting.allocations() < 99 * 4, true, counting.allocations());
+    }
+    EXPECT_EQ_BASE(counting.live_allocations() > 0, true, counting.live_allocations());
+    std::thread other([&items]() { items.clear(); });
+    other.join();
+    EXPECT_EQ_BASE(counting.live_allocations() == 0, true, counting.live_allocations());
+}
+
+#define EXPECT_UTF8(valid, literal) \
+    EXPECT_EQ_BASE(amf0_utf8_valid(literal, sizeof(literal) - 1) == valid, valid, literal)
+
+static void test_utf8()
+{
+    EXPECT_UTF8(true, "");
+    EXPECT_UTF8(true, "plain ascii that is longer than sixteen bytes");
+    EXPECT_UTF8(true, "caf\xc3\xa9 \xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x8e\xa5 and more ascii text");
+    EXPECT_UTF8(false, "bad continuation \x80 here");
+    EXPECT_UTF8(false, "overlong \xc0\xaf");
+    EXPECT_UTF8(false, "surrogate \xed\xa0\x80");
+    EXPECT_UTF8(false, "too large \xf4\x90\x80\x80");
+    EXPECT_UTF8(false, "truncated sequence at end \xe4\xb8");
+
+    SimpleBuffer sb;
+    Amf0String bad(string("a\xff", 2));
+    bad.write(&sb);
+
+    Amf0String actual;
+    EXPECT_EQ_BASE(actual.read(&sb) == 0, true, false);
+
+    // checked per context, other decodes are not affected
+    Amf0DecodeContext ctx;
+    ctx.validate_utf8 = true;
+    SimpleBuffer again;
+    bad.write(&again);
+    EXPECT_EQ_BASE(actual.decode(&again, &ctx) == ERROR_AMF0_UTF8, true, false);
+    SimpleBuffer key;
+    Amf0Object object;
+    object.put(string("k\xff", 2), new Amf0Null());
+    object.write(&key);
+    Amf0Data *value = Amf0Data::create_amf0data(&key, &ctx);
+    EXPECT_EQ_BASE(value == nullptr && ctx.error == ERROR_AMF0_UTF8, true, ctx.error);
+    key.skip(-key.pos());
+    value = Amf0Data::create_amf0data(&key);
+    EXPECT_EQ_BASE(value != nullptr, true, false);
+    delete value;
+}
+
+static void test_key_lookup()
+{
+    Amf0Object object;
+    object.put("a", new Amf0Number(1));
+    object.put("code", new Amf0Number(2));
+    object.put("description", new Amf0Number(3));
+    object.put("objectEncoding", new Amf0Number(4));
+    object.put("a key that is longer than 16 bytes", new Amf0Number(5));
+    object.put("a key that is longer than 16 bytez", new Amf0Number(6));
+
+    const char *keys[] = { "a", "code", "description", "objectEncoding",
+        "a key that is longer than 16 bytes", "a key that is longer than 16 bytez" };
+    for (int i = 0; i < 6; ++i) {
+        Amf0Number *n = (Amf0Number *)object.value_at(string(keys[i]));
+        EXPECT_EQ_BASE(n && n->value == i + 1, i + 1, keys[i]);
+    }
+
+    EXPECT_EQ_BASE(object.value_at(string("cod")) == nullptr, true, false);
+    EXPECT_EQ_BASE(object.value_at(string("codf")) == nullptr, true, false);
+}
+
+static void test_dtoa()
+{
+    const double values[] = { 0, 1, -1, 0.1, 1.5, 1280, 44100, 2500.5, 1e21, 1e22, 1.5e-7,
+        0.000123, 123456789012345680000.0, 5e-324, 1.7976931348623157e308, 29.97002997002997 };
+    const char *expects[] = { "0", "1", "-1", "0.1", "1.5", "1280", "44100", "2500.5", "1e21", "1e22", "1.5e-7",
+        "0.000123", "123456789012345680000", "5e-324", "1.7976931348623157e308", "29.97002997002997" };
+
+    char buf[32];
+    for (int i = 0; i < (int)(sizeof(values) / sizeof(values[0])); ++i) {
+        int len = amf0_dtoa(values[i], buf);
+        EXPECT_EQ_STRING(string(expects[i]), string(buf, len));
+    }
+
+    // every output must parse back to the same bits
+    srand(1);
+    for (int i = 0; i < 100000; ++i) {
+        uint64_t bits = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ rand();
+        double v;
+        memcpy(&v, &bits, 8);
+        if (v != v || v - v != 0)
+            continue;
+
+        int len = amf0_dtoa(v, buf);
+        buf[len] = 0;
+        double back = strtod(buf, nullptr);
+        if (memcmp(&back, &v, 8) != 0) {
+            EXPECT_EQ_BASE(false, v, buf);
+            break;
+        }
+    }
+}
+
+static void test_json()
+{
+    const char *json = "{\"level\":\"status\",\"code\":\"NetStream.Play.Start\","
+        "\"description\":\"tab\\there \\\"quoted\\\" \\u00e9\\ud83c\\udfa5\","
+        "\"duration\":29.97,\"empty\":{},\"list\":[1,-2.5,true,false,null,[]],\"big\":1e300}";
+
+    SimpleBuffer sb;
+    EXPECT_EQ_BASE(json_to_amf0(json, strlen(json), &sb) == 0, true, false);
+
+    // the AMF0 bytes decode with the regular reader too
+    const char *simple = "{\"code\":\"NetStream.Play.Start\",\"level\":\"status\"}";
+    SimpleBuffer copy;
+    json_to_amf0(simple, strlen(simple), &copy);
+    Amf0Object object;
+    EXPECT_EQ_BASE(object.read(&copy) == 0, true, false);
+    Amf0String *code = (Amf0String *)object.value_at(string("code"));
+    EXPECT_EQ_STRING(string("NetStream.Play.Start"), (code ? code->value : string()));
+
+    string out;
+    EXPECT_EQ_BASE(amf0_to_json(&sb, out) == 0, true, false);
+    EXPECT_EQ_STRING(string("{\"level\":\"status\",\"code\":\"NetStream.Play.Start\","
+        "\"description\":\"tab\\there \\\"quoted\\\" \xc3\xa9\xf0\x9f\x8e\xa5\","
+        "\"duration\":29.97,\"empty\":{},\"list\":[1,-2.5,true,false,null,[]],\"big\":1e300}"), out);
+
+    // ECMA arrays come out as objects
+    SimpleBuffer ecma;
+    Amf0EcmaArray meta;
+    meta.put("width", new Amf0Number(1280));
+    meta.put("stereo", new Amf0Boolean(true));
+    meta.put("ctl", new Amf0String(string("\x01", 1)));
+    meta.write(&ecma);
+    out.clear();
+    EXPECT_EQ_BASE(amf0_to_json(&ecma, out) == 0, true, false);
+    EXPECT_EQ_STRING(string("{\"width\":1280,\"stereo\":true,\"ctl\":\"\\u0001\"}"), out);
+
+    const char *bad[] = { "{\"a\":}", "[1,]", "\"open", "tru", "{\"\":1}", "1 2", "01x", "-" };
+    for (int i = 0; i < 8; ++i) {
+        SimpleBuffer b;
+        EXPECT_EQ_BASE(json_to_amf0(bad[i], strlen(bad[i]), &b) != 0, true, bad[i]);
+    }
+}
+
+static void test_stats()
+{
+    Amf0StatsSnapshot before, after;
+    amf0_stats_snapshot(&before);
+
+    SimpleBuffer sb;
+    Amf0Object object;
+    object.put("code", new Amf0String("NetStream.Play.Start"));
+    object.put("level", new Amf0Number(1));
+    object.write(&sb);
+
+    Amf0Data *decoded = Amf0Data::create_amf0data(&sb);
+    delete decoded;
+
+    SimpleBuffer bad;
+    bad.write_1byte(0x7f);
+    EXPECT_EQ_BASE(Amf0Data::create_amf0data(&bad) == nullptr, true, false);
+
+    amf0_stats_snapshot(&after);
+    if (!amf0_stats_enabled()) {
+        EXPECT_EQ_BASE(after.bytes_decoded == 0 && after.nodes_allocated == 0, true, false);
+        return;
+    }
+
+    EXPECT_EQ_BASE(after.decoded[3] - before.decoded[3] == 1, 1, after.decoded[3] - before.decoded[3]);
+    EXPECT_EQ_BASE(after.decoded[2] - before.decoded[2] == 1, 1, after.decoded[2] - before.decoded[2]);
+    EXPECT_EQ_BASE(after.encoded[0] - before.encoded[0] == 1, 1, after.encoded[0] - before.encoded[0]);
+    EXPECT_EQ_BASE(after.bytes_decoded - before.bytes_decoded == (uint64_t)sb.size(), sb.size(), after.bytes_decoded - before.bytes_decoded);
+    EXPECT_EQ_BASE(after.bytes_encoded - before.bytes_encoded == (uint64_t)sb.size(), sb.size(), after.bytes_encoded - before.bytes_encoded);
+    EXPECT_EQ_BASE(after.nodes_allocated - before.nodes_allocated == 3, 3, after.nodes_allocated - before.nodes_allocated);
+    EXPECT_EQ_BASE(after.strings_allocated - before.strings_allocated == 3, 3, after.strings_allocated - before.strings_allocated);
+    EXPECT_EQ_BASE(after.decode_failures[0] - before.decode_failures[0] == 1, 1, after.decode_failures[0] - before.decode_failures[0]);
+    EXPECT_EQ_BASE(after.last_failure_code == ERROR_AMF0_DECODE && after.last_failure_offset == 0, ERROR_AMF0_DECODE, after.last_failure_code);
+
+    // a failure deep inside counts once, at the offset it happened
+    SimpleBuffer nested;
+    Amf0Object outer;
+    Amf0Object *inner = new Amf0Object();
+    inner->put("b", new Amf0Null());
+    outer.put("a", inner);
+    outer.write(&nested);
+    int bad_pos = 1 + 2 + 1 + 1 + 2 + 1;
+    nested.data()[bad_pos] = 0x7f;
+    Amf0StatsSnapshot deep;
+    EXPECT_EQ_BASE(Amf0Data::create_amf0data(&nested) == nullptr, true, false);
+    amf0_stats_snapshot(&deep);
+    EXPECT_EQ_BASE(deep.decode_failures[0] - after.decode_failures[0] == 1, 1, deep.decode_failures[0] - after.decode_failures[0]);
+    EXPECT_EQ_BASE(deep.last_failure_offset == bad_pos, bad_pos, deep.last_failure_offset);
+
+    uint64_t timed = 0;
+    for (int i = 0; i < AMF0_STATS_LATENCY_BUCKETS; ++i) {
+        timed += after.decode_latency[i] - before.decode_latency[i];
+    }
+    // two top level calls, the nested string and number are not timed
+    EXPECT_EQ_BASE(timed == 2, 2, timed);
+}
+
+static void test_allocator()
+{
+    SimpleBuffer encoded;
+    Amf0EcmaArray meta;
+    meta.put("encoder", new Amf0String("a string that does not fit in place"));
+    meta.put("width", new Amf0Number(1280));
+    meta.write(&encoded);
+
+    Amf0CountingAllocator counting;
+    {
+        Amf0AllocatorScope scope(&counting);
+
+        SimpleBuffer sb;
+        sb.append(encoded.data(), encoded.size());
+        Amf0Data *decoded = Amf0Data::create_amf0data(&sb);
+        EXPECT_EQ_BASE(decoded != nullptr, true, false);
+        EXPECT_EQ_BASE(counting.live_allocations() > 0, true, counting.live_allocations());
+
+        SimpleBuffer again;
+        decoded->write(&again);
+        EXPECT_EQ_STRING(encoded.to_string(), again.to_string());
+        delete decoded;
+    }
+    EXPECT_EQ_BASE(counting.live_allocations() == 0, 0, counting.live_allocations());
+    EXPECT_EQ_BASE(counting.live_bytes() == 0, 0, counting.live_bytes());
+    EXPECT_EQ_BASE(counting.peak_bytes() > 0, true, counting.peak_bytes());
+
+    // a connection pool on top of the counter, nothing escapes to upstream
+    Amf0CountingAllocator upstream;
+    {
+        Amf0PoolAllocator pool(&upstream, 4096);
+        Amf0AllocatorScope scope(&pool);
+
+        for (int i = 0; i < 100; ++i) {
+            SimpleBuffer sb;
+            sb.append(encoded.data(), encoded.size());
+            delete Amf0Data::create_amf0data(&sb);
+        }
+        // freed blocks are reused, so one upstream block is enough
+        EXPECT_EQ_BASE(upstream.allocations() == 1, 1, upstream.allocations());
+        EXPECT_EQ_BASE(pool.retained() == 4096, 4096, pool.retained());
+    }
+    EXPECT_EQ_BASE(upstream.live_allocations() == 0, 0, upstream.live_allocations());
+
+    // a block too small for the largest pooled size is raised to it
+    {
+        Amf0PoolAllocator tiny(&upstream, 16);
+        void *p = tiny.allocate(500);
+        memset(p, 0, 500);
+        EXPECT_EQ_BASE(tiny.retained() == 512, 512, tiny.retained());
+        tiny.deallocate(p, 500);
+    }
+
+    // memory allocated in a scope can be released after it ended
+    Amf0Data *outlives = nullptr;
+    {
+        Amf0AllocatorScope scope(&counting);
+        outlives = new Amf0String("kept");
+    }
+    EXPECT_EQ_BASE(counting.live_allocations() == 1, 1, counting.live_allocations());
+    delete outlives;
+    EXPECT_EQ_BASE(counting.live_allocations() == 0, 0, counting.live_allocations());
+}
+
+static void test_inline_buffer()
+{
+    Amf0Object info;
+    info.put("level", new Amf0String("status"));
+    info.put("code", new Amf0String("NetStream.Play.Start"));
+    info.put("description", new Amf0String("Started playing stream."));
+
+    SimpleBuffer heap;
+    info.write(&heap);
+
+    Amf0CountingAllocator counting;
+    {
+        Amf0AllocatorScope scope(&counting);
+
+        InlineSimpleBuffer<256> sb;
+        info.write(&sb);
+        EXPECT_EQ_BASE(sb.is_inline(), true, false);
+        EXPECT_EQ_STRING(heap.to_string(), sb.to_string());
+
+        Amf0Object copy;
+        EXPECT_EQ_BASE(copy.read(&sb) == 0, true, false);
+
+        // spilling keeps what was written so far
+        InlineSimpleBuffer<16> small;
+        info.write(&small);
+        EXPECT_EQ_BASE(!small.is_inline(), true, false);
+        EXPECT_EQ_STRING(heap.to_string(), small.to_string());
+    }
+    // only the spilled buffer and the decoded copy touched the heap
+    EXPECT_EQ_BASE(counting.live_allocations() == 0, 0, counting.live_allocations());
+
+    SimpleBuffer assigned;
+    assigned = heap;
+    EXPECT_EQ_STRING(heap.to_string(), assigned.to_string());
+}
+
+static void test_writer()
+{
+    SimpleBuffer expect;
+    Amf0String name("onStatus");
+    name.write(&expect);
+    Amf0Number transaction(0);
+    transaction.write(&expect);
+    Amf0Null null;
+    null.write(&expect);
+    Amf0Object info;
+    info.put("level", new Amf0String("status"));
+    info.put("code", new Amf0String("NetStream.Play.Start"));
+    Amf0EcmaArray *meta = new Amf0EcmaArray();
+    meta->put("width", new Amf0Number(1280));
+    meta->put("stereo", new Amf0Boolean(true));
+    info.put("meta", meta);
+    Amf0StrictArray *list = new Amf0StrictArray();
+    list->put(new Amf0Number(1));
+    list->put(new Amf0Undefined());
+    info.put("list", list);
+    info.write(&expect);
+
+    Amf0CountingAllocator counting;
+    InlineSimpleBuffer<256> actual;
+    uint64_t news = global_news;
+    {
+        Amf0AllocatorScope scope(&counting);
+
+        Amf0Writer w(&actual);
+        w.string("onStatus");
+        w.number(0);
+        w.null();
+        w.begin_object();
+        w.key("level");
+        w.string("status");
+        w.key("code");
+        w.string("NetStream.Play.Start");
+        w.key("meta");
+        w.begin_ecma_array();
+        w.key("width");
+        w.number(1280);
+        w.key("stereo");
+        w.boolean(true);
+        w.end_ecma_array();
+        w.key("list");
+        w.begin_strict_array();
+        w.number(1);
+        w.undefined();
+        w.end_strict_array();
+        w.end_object();
+        EXPECT_EQ_BASE(w.done(), true, false);
+    }
+    news = global_news - news;
+
+    EXPECT_EQ_STRING(expect.to_string(), actual.to_string());
+    EXPECT_EQ_BASE(counting.allocations() == 0, 0, counting.allocations());
+    EXPECT_EQ_BASE(news == 0, 0, news);
+
+    // past 65535 bytes a string needs the long string marker
+    SimpleBuffer long_string;
+    Amf0Writer l(&long_string);
+    l.string(string(70000, 'x'));
+    EXPECT_EQ_BASE(l.done() && long_string.size() == 1 + 4 + 70000, true, long_string.size());
+    EXPECT_EQ_BASE(long_string.data()[0] == AMF0_MARKER::AMF0_MARKER_LONG_STRING, true, false);
+
+    // nesting past the stack stops the writer instead of running off it
+    SimpleBuffer deep;
+    Amf0Writer d(&deep);
+    for (int i = 0; i < AMF0_WRITER_MAX_DEPTH + 8; ++i) {
+        d.begin_strict_array();
+    }
+    int written = deep.size();
+    d.number(1);
+    EXPECT_EQ_BASE(d.error() == ERROR_AMF0_INVALID, ERROR_AMF0_INVALID, d.error());
+    EXPECT_EQ_BASE(!d.done() && written == AMF0_WRITER_MAX_DEPTH * 5 && deep.size() == written, true, deep.size());
+
+    // so does a key outside an object, a value without a key or an unmatched end
+    SimpleBuffer misuse;
+    Amf0Writer k(&misuse);
+    k.key("orphan");
+    EXPECT_EQ_BASE(k.error() == ERROR_AMF0_INVALID && misuse.size() == 0, true, k.error());
+
+    Amf0Writer v(&misuse);
+    v.begin_object();
+    v.number(1);
+    EXPECT_EQ_BASE(v.error() == ERROR_AMF0_INVALID && misuse.size() == 1, true, v.error());
+
+    SimpleBuffer unmatched;
+    Amf0Writer e(&unmatched);
+    e.begin_object();
+    e.end_strict_array();
+    e.end_object();
+    EXPECT_EQ_BASE(e.error() == ERROR_AMF0_INVALID && unmatched.size() == 1, true, e.error());
+}
+
+static void test_decode_limits()
+{
+    // 100 nested objects {"a":{"a":...null}}
+    SimpleBuffer deep;
+    for (int i = 0; i < 100; ++i) {
+        deep.write_1byte(0x03);
+        deep.write_2bytes(1);
+        deep.write_string("a");
+    }
+    deep.write_1byte(0x05);
+    for (int i = 0; i < 100; ++i) {
+        deep.write_2bytes(0);
+        deep.write_1byte(0x09);
+    }
+
+    Amf0DecodeContext ctx;
+    Amf0Data *data = Amf0Data::create_amf0data(&deep, &ctx);
+    EXPECT_EQ_BASE(data == nullptr, true, false);
+    EXPECT_EQ_BASE(ctx.error == ERROR_AMF0_DEPTH, ERROR_AMF0_DEPTH, ctx.error);
+    EXPECT_EQ_BASE(ctx.error_pos == 64 * 4, 64 * 4, ctx.error_pos);
+
+    SimpleBuffer again;
+    again.append(deep.data(), deep.size());
+    ctx.reset();
+    ctx.max_depth = 0;
+    data = Amf0Data::create_amf0data(&again, &ctx);
+    EXPECT_EQ_BASE(data != nullptr, true, false);
+    EXPECT_EQ_BASE(ctx.nodes == 101, 101, ctx.nodes);
+    delete data;
+
+    // node limit
+    SimpleBuffer many;
+    Amf0Writer m(&many);
+    m.begin_strict_array();
+    for (int i = 0; i < 1000; ++i) {
+        m.number(i);
+    }
+    m.end_strict_array();
+
+    ctx.reset();
+    ctx.max_nodes = 100;
+    EXPECT_EQ_BASE(Amf0Data::create_amf0data(&many, &ctx) == nullptr, true, false);
+    EXPECT_EQ_BASE(ctx.error == ERROR_AMF0_NODES && ctx.nodes == 100, ERROR_AMF0_NODES, ctx.error);
+
+    // byte budget covers the string before it is copied
+    SimpleBuffer big;
+    Amf0String huge(string(60000, 'x'));
+    huge.write(&big);
+
+    Amf0CountingAllocator counting;
+    {
+        Amf0AllocatorScope scope(&counting);
+        Amf0DecodeContext budget;
+        budget.max_bytes = 4096;
+        EXPECT_EQ_BASE(Amf0Data::create_amf0data(&big, &budget) == nullptr, true, false);
+        EXPECT_EQ_BASE(budget.error == ERROR_AMF0_BUDGET && budget.error_pos == 0, ERROR_AMF0_BUDGET, budget.error);
+    }
+    EXPECT_EQ_BASE(counting.allocations() == 0, 0, counting.allocations());
+
+    // the budget is per message, a connection keeps its context for good
+    Amf0DecodeContext conn;
+    conn.max_bytes = 1000;
+    int decoded = 0;
+    for (int i = 0; i < 100; ++i) {
+        SimpleBuffer sb;
+        Amf0String("NetConnection.Connect.Success").write(&sb);
+        Amf0Data *d = Amf0Data::create_amf0data(&sb, &conn);
+        if (!d)
+            break;
+        decoded++;
+        delete d;
+    }
+    int64_t one = conn.bytes;
+    EXPECT_EQ_BASE(decoded == 100 && one > 0 && one <= 1000, true, decoded);
+
+    // a failed message does not hold back the next one
+    SimpleBuffer after;
+    after.append(big.data(), big.size());
+    EXPECT_EQ_BASE(Amf0Data::create_amf0data(&after, &conn) == nullptr, true, false);
+    EXPECT_EQ_BASE(conn.error == ERROR_AMF0_BUDGET, ERROR_AMF0_BUDGET, conn.error);
+    SimpleBuffer next;
+    Amf0String("NetConnection.Connect.Success").write(&next);
+    Amf0Data *d = Amf0Data::create_amf0data(&next, &conn);
+    EXPECT_EQ_BASE(d != nullptr && conn.error == ERROR_SUCCESS && conn.bytes == one, true, conn.error);
+    delete d;
+
+    // no context still caps the nesting at the default depth
+    SimpleBuffer unlimited;
+    unlimited.append(deep.data(), deep.size());
+    EXPECT_EQ_BASE(Amf0Data::create_amf0data(&unlimited) == nullptr, true, false);
+
+    // a container decoded on its own keeps the limits over its children
+    SimpleBuffer props;
+    Amf0Writer pw(&props);
+    pw.begin_object();
+    for (int i = 0; i < 10; ++i) {
+        pw.key(string(1, 'a' + i));
+        pw.number(i);
+    }
+    pw.end_object();
+
+    Amf0DecodeContext direct;
+    direct.max_nodes = 3;
+    Amf0Object obj;
+    int ret = obj.decode(&props, &direct);
+    EXPECT_EQ_BASE(ret == ERROR_AMF0_NODES && direct.nodes == 3, ERROR_AMF0_NODES, ret);
+    EXPECT_EQ_BASE(direct.depth == 0, 0, direct.depth);
+
+    // and starts a message of its own
+    direct.max_nodes = 10;
+    props.skip(-props.pos());
+    Amf0Object again_obj;
+    ret = again_obj.decode(&props, &direct);
+    EXPECT_EQ_BASE(ret == ERROR_SUCCESS && direct.nodes == 10, ERROR_SUCCESS, ret);
+}
+
+static void test_frozen()
+{
+    Amf0EcmaArray meta;
+    meta.put("duration", new Amf0Number(29.97));
+    meta.put("stereo", new Amf0Boolean(true));
+    meta.put("encoder", new Amf0String("Lavf58.29.100"));
+    meta.put("empty", new Amf0Null());
+    Amf0Object *codec = new Amf0Object();
+    codec->put("id", new Amf0Number(7));
+    codec->put("profile", new Amf0String("high"));
+    meta.put("video", codec);
+    Amf0StrictArray *times = new Amf0StrictArray();
+    times->put(new Amf0Number(0));
+    times->put(new Amf0Number(2.5));
+    meta.put("times", times);
+
+    Amf0Frozen *frozen = Amf0Frozen::freeze(&meta);
+    EXPECT_EQ_BASE(frozen != nullptr, true, false);
+    if (!frozen)
+        return;
+
+    // a copy at another address reads the same, nothing is a pointer
+    string copy(frozen->data(), frozen->size());
+    Amf0Frozen *moved = Amf0Frozen::attach(copy.data(), copy.size(), false);
+    delete frozen;
+    EXPECT_EQ_BASE(moved != nullptr, true, false);
+    if (!moved)
+        return;
+
+    Amf0FrozenValue root = moved->root();
+    EXPECT_EQ_BASE(root.is_ecma_array() && root.count() == 6, 6, root.count());
+    EXPECT_EQ_BASE(root.value_at(string("duration")).number() == 29.97, 29.97, root.value_at(string("duration")).number());
+    EXPECT_EQ_BASE(root.value_at(string("stereo")).boolean(), true, false);
+    EXPECT_EQ_STRING(string("Lavf58.29.100"), root.value_at(string("encoder")).string());
+    EXPECT_EQ_BASE(root.value_at(string("empty")).is_null(), true, false);
+    EXPECT_EQ_STRING(string("high"), root.value_at(string("video")).value_at(string("profile")).string());
+    EXPECT_EQ_BASE(root.value_at(string("times")).value_at(1).number() == 2.5, 2.5, false);
+    EXPECT_EQ_STRING(string("video"), root.key_at(4));
+    EXPECT_EQ_BASE(!root.value_at(string("missing")).valid(), true, false);
+    EXPECT_EQ_BASE(!root.value_at(string("encoder")).value_at(string("x")).valid(), true, false);
+
+    // readers share the block without any synchronization
+    int found[4] = { 0, 0, 0, 0 };
+    vector<thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.push_back(thread([&, t]() {
+            for (int i = 0; i < 10000; ++i) {
+                if (root.value_at(string("video")).value_at(string("id")).number() == 7)
+                    found[t]++;
+            }
+        }));
+    }
+    for (size_t t = 0; t < readers.size(); ++t) {
+        readers[t].join();
+    }
+    EXPECT_EQ_BASE(found[0] + found[1] + found[2] + found[3] == 40000, 40000, found[0]);
+    delete moved;
+
+    // broken blocks are refused
+    string corrupt = copy;
+    corrupt[sizeof(Amf0FrozenHeader) + 8] = 0x7f;
+    EXPECT_EQ_BASE(!Amf0Frozen::verify(corrupt.data(), corrupt.size()), true, false);
+    EXPECT_EQ_BASE(!Amf0Frozen::verify(copy.data(), copy.size() - 1), true, false);
+
+    // a payload near 2^64 must not wrap around the bounds checks
+    const Amf0FrozenHeader *h = (const Amf0FrozenHeader *)copy.data();
+    char markers[2] = { AMF0_MARKER::AMF0_MARKER_STRING, AMF0_MARKER::AMF0_MARKER_OBJECT };
+    for (int k = 0; k < 2; ++k) {
+        string forged = copy;
+        Amf0FrozenNode *nodes = (Amf0FrozenNode *)&forged[h->nodes_offset];
+        for (uint32_t i = 0; i < h->node_count; ++i) {
+            if (nodes[i].marker == markers[k]) {
+                nodes[i].payload = ~0ULL;
+                nodes[i].count = k + 1;
+                break;
+            }
+        }
+        EXPECT_EQ_BASE(!Amf0Frozen::verify(forged.data(), forged.size()), true, k);
+    }
+}
+
+static void test_catalog()
+{
+    const char *path = "amf0_test_catalog.bin";
+
+    {
+        Amf0CatalogWriter writer;
+        for (int i = 0; i < 500; ++i) {
+            char name[64];
+            snprintf(name, sizeof(name), "vod/%04d.flv", (i * 7) % 500);
+
+            Amf0EcmaArray meta;
+            meta.put("duration", new Amf0Number(i));
+            meta.put("name", new Amf0String(name));
+            EXPECT_EQ_BASE(writer.add(name, &meta) == 0, true, name);
+        }
+        EXPECT_EQ_BASE(writer.write(path) == 0, true, false);
+    }
+
+    Amf0Catalog *catalog = Amf0Catalog::open(path);
+    EXPECT_EQ_BASE(catalog != nullptr, true, false);
+    if (catalog) {
+        EXPECT_EQ_BASE(catalog->count() == 500, 500, catalog->count());
+        EXPECT_EQ_BASE(catalog->verify(), true, false);
+
+        int matched = 0;
+        for (int i = 0; i < 500; ++i) {
+            char name[64];
+            snprintf(name, sizeof(name), "vod/%04d.flv", i);
+            Amf0FrozenValue meta = catalog->find(name);
+            if (meta.valid() && meta.value_at(string("name")).string() == name)
+                matched++;
+        }
+        EXPECT_EQ_BASE(matched == 500, 500, matched);
+        EXPECT_EQ_BASE(!catalog->find("vod/0500.flv").valid(), true, false);
+        EXPECT_EQ_BASE(!catalog->find("").valid(), true, false);
+        delete catalog;
+    }
+
+    // an index entry whose offset wraps around is refused as well
+    for (int k = 0; k < 2; ++k) {
+        FILE *f = fopen(path, "r+b");
+        if (!f)
+            break;
+        Amf0CatalogHeader h;
+        Amf0CatalogEntry e;
+        fread(&h, sizeof(h), 1, f);
+        fseek(f, h.entries_offset, SEEK_SET);
+        fread(&e, sizeof(e), 1, f);
+        Amf0CatalogEntry forged = e;
+        if (k == 0) {
+            forged.key_offset = ~0ULL;
+        } else {
+            forged.block_offset = ~0ULL - 7;
+        }
+        fseek(f, h.entries_offset, SEEK_SET);
+        fwrite(&forged, sizeof(forged), 1, f);
+        fflush(f);
+        EXPECT_EQ_BASE(Amf0Catalog::open(path) == nullptr, true, k);
+        fseek(f, h.entries_offset, SEEK_SET);
+        fwrite(&e, sizeof(e), 1, f);
+        fclose(f);
+    }
+
+    // a truncated file is refused instead of read past its end
+    FILE *f = fopen(path, "r+b");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fclose(f);
+        EXPECT_EQ_BASE(truncate(path, size / 2) == 0, true, false);
+    }
+    EXPECT_EQ_BASE(Amf0Catalog::open(path) == nullptr, true, false);
+    remove(path);
+}
+
+static void write_flv_tag(SimpleBuffer *sb, int type, int timestamp, const string &data)
+{
+    sb->write_1byte(type);
+    sb->write_3bytes(data.size());
+    sb->write_3bytes(timestamp & 0xffffff);
+    sb->write_1byte(timestamp >> 24);
+    sb->write_3bytes(0);
+    sb->write_string(data);
+    sb->write_4bytes(11 + data.size());
+}
+
+static void test_flv_rewrite(bool with_metadata)
+{
+    const char *in = "amf0_test_in.flv";
+    const char *out = "amf0_test_out.flv";
+
+    SimpleBuffer file;
+    file.write_string(string("FLV\x01\x05\x00\x00\x00\x09\x00\x00\x00\x00", 13));
+
+    if (with_metadata) {
+        SimpleBuffer script;
+        Amf0String name("onMetaData");
+        name.write(&script);
+        Amf0EcmaArray old;
+        old.put("encoder", new Amf0String("old"));
+        old.write(&script);
+        write_flv_tag(&file, AMF0_FLV_TAG_SCRIPT, 0, script.to_string());
+    }
+
+    vector<string> media;
+    for (int i = 0; i < 40; ++i) {
+        string video(100 + i, (char)i);
+        video[0] = (i % 10 == 0) ? 0x17 : 0x27;
+        string audio(30, (char)(i + 1));
+        audio[0] = (char)0xaf;
+        write_flv_tag(&file, AMF0_FLV_TAG_VIDEO, i * 40, video);
+        write_flv_tag(&file, AMF0_FLV_TAG_AUDIO, i * 40, audio);
+        media.push_back(video);
+        media.push_back(audio);
+    }
+
+    FILE *f = fopen(in, "wb");
+    fwrite(file.data(), 1, file.size(), f);
+    fclose(f);
+
+    Amf0EcmaArray meta;
+    meta.put("duration", new Amf0Number(1.56));
+    EXPECT_EQ_BASE(amf0_flv_write_metadata(in, out, &meta, AMF0_FLV_KEYFRAMES | AMF0_FLV_FILESIZE) == 0, true, false);
+
+    // in place is refused, under another name too, and in is left whole
+    string alias = string("./") + in;
+    EXPECT_EQ_BASE(amf0_flv_write_metadata(in, alias, &meta, 0) == ERROR_AMF0_INVALID, true, false);
+    struct stat st;
+    EXPECT_EQ_BASE(stat(in, &st) == 0 && st.st_size == file.size(), true, false);
+
+    Amf0FlvReader *reader = Amf0FlvReader::open(out);
+    EXPECT_EQ_BASE(reader != nullptr, true, false);
+    if (!reader) {
+        return;
+    }
+
+    // the new tag comes first, every media tag follows untouched
+    Amf0FlvTag tag;
+    EXPECT_EQ_BASE(reader->next(tag) && tag.on_metadata(), true, false);
+
+    vector<Amf0Data *> values;
+    EXPECT_EQ_BASE(Amf0FlvReader::decode_script(tag, values) == 0 && values.size() == 2, true, false);
+    Amf0EcmaArray *written = values.size() == 2 ? dynamic_cast<Amf0EcmaArray *>(values[1]) : nullptr;
+    EXPECT_EQ_BASE(written != nullptr, true, false);
+
+    size_t same = 0;
+    vector<uint64_t> keyframes;
+    while (reader->next(tag)) {
+        if (same < media.size() && string(tag.data, tag.data_size) == media[same])
+            same++;
+        if (tag.keyframe())
+            keyframes.push_back(tag.offset);
+    }
+    EXPECT_EQ_BASE(same == media.size(), true, false);
+    EXPECT_EQ_BASE(!reader->truncated(), true, false);
+
+    if (written) {
+        Amf0Number *filesize = dynamic_cast<Amf0Number *>(written->value_at(string("filesize")));
+        EXPECT_EQ_BASE(filesize && filesize->value == reader->size(), true, false);
+        EXPECT_EQ_BASE(written->value_at(string("encoder")) == nullptr, true, false);
+
+        Amf0Object *index = dynamic_cast<Amf0Object *>(written->value_at(string("keyframes")));
+        Amf0StrictArray *positions = index ? dynamic_cast<Amf0StrictArray *>(index->value_at(string("filepositions"))) : nullptr;
+        Amf0StrictArray *times = index ? dynamic_cast<Amf0StrictArray *>(index->value_at(string("times"))) : nullptr;
+        EXPECT_EQ_BASE(positions && times && positions->count() == 4 && times->count() == 4, true, false);
+
+        int matched = 0;
+        for (int i = 0; positions && times && i < positions->count() && i < (int)keyframes.size(); ++i) {
+            Amf0Number *pos = dynamic_cast<Amf0Number *>(positions->value_at(i));
+            Amf0Number *time = dynamic_cast<Amf0Number *>(times->value_at(i));
+            if (pos && time && pos->value == keyframes[i] && time->value == i * 400 / 1000.0)
+                matched++;
+        }
+        EXPECT_EQ_BASE(matched == 4, 4, matched);
+    }
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        delete values[i];
+    }
+    delete reader;
+    remove(in);
+    remove(out);
+}
+
+static void test_flv()
+{
+    test_flv_rewrite(true);
+    test_flv_rewrite(false);
+
+    EXPECT_EQ_BASE(Amf0FlvReader::open("amf0_test_missing.flv") == nullptr, true, false);
+}
+
+static void test_registry()
+{
+    Amf0Registry registry(4);
+
+    for (int i = 0; i < 100; ++i) {
+        Amf0EcmaArray meta;
+        meta.put("id", new Amf0Number(i));
+        EXPECT_EQ_BASE(registry.publish("live/" + to_string(i), &meta) == 0, true, false);
+    }
+    EXPECT_EQ_BASE(registry.count() == 100, 100, registry.count());
+
+    {
+        Amf0RegistryGuard guard;
+        const Amf0RegistryValue *v = registry.find("live/42");
+        EXPECT_EQ_BASE(v && v->version == 1 && v->root().value_at(string("id")).number() == 42, true, false);
+        EXPECT_EQ_BASE(registry.find("live/100") == nullptr, true, false);
+
+        // a held version survives being replaced until the guard goes
+        Amf0EcmaArray meta;
+        meta.put("id", new Amf0Number(-42));
+        registry.publish("live/42", &meta);
+        registry.reclaim();
+        EXPECT_EQ_BASE(registry.retired() == 1, 1, registry.retired());
+        EXPECT_EQ_BASE(v->root().value_at(string("id")).number() == 42, true, false);
+
+        const Amf0RegistryValue *latest = registry.find("live/42");
+        EXPECT_EQ_BASE(latest && latest->version == 2 && latest->root().value_at(string("id")).number() == -42, true, false);
+    }
+    registry.reclaim();
+    EXPECT_EQ_BASE(registry.retired() == 0, 0, registry.retired());
+
+    // what is published outlives the publisher's allocator
+    Amf0CountingAllocator counting;
+    {
+        Amf0EcmaArray meta;
+        meta.put("id", new Amf0Number(7));
+        Amf0AllocatorScope scope(&counting);
+        registry.publish("live/7", &meta);
+    }
+    EXPECT_EQ_BASE(counting.allocations() == 0, 0, counting.allocations());
+
+    EXPECT_EQ_BASE(registry.remove("live/7"), true, false);
+    EXPECT_EQ_BASE(!registry.remove("live/7"), true, false);
+    EXPECT_EQ_BASE(registry.count() == 99, 99, registry.count());
+
+    // readers check every version they see is whole while it is replaced
+    std::atomic<bool> stop(false);
+    std::atomic<int> torn(0);
+    vector<thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.push_back(thread([&] {
+            while (!stop.load()) {
+                Amf0RegistryGuard guard;
+                for (int i = 0; i < 100; ++i) {
+                    const Amf0RegistryValue *v = registry.find("live/" + to_string(i));
+                    if (!v)
+                        continue;
+
+                    SimpleBuffer sb;
+                    sb.append(v->encoded.data(), v->encoded.size());
+                    Amf0Data *decoded = Amf0Data::create_amf0data(&sb);
+                    Amf0EcmaArray *meta = dynamic_cast<Amf0EcmaArray *>(decoded);
+                    Amf0Number *id = meta ? dynamic_cast<Amf0Number *>(meta->value_at(string("id"))) : nullptr;
+                    if (!id || id->value != v->root().value_at(string("id")).number())
+                        torn++;
+                    delete decoded;
+                }
+            }
+        }));
+    }
+
+    for (int round = 0; round < 2000; ++round) {
+        Amf0EcmaArray meta;
+        meta.put("id", new Amf0Number(round));
+        registry.publish("live/" + to_string(round % 100), &meta);
+        if (round % 10 == 0)
+            registry.remove("live/" + to_string((round / 10) % 100));
+    }
+    stop.store(true);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        readers[i].join();
+    }
+
+    EXPECT_EQ_BASE(torn.load() == 0, 0, torn.load());
+    registry.reclaim();
+    EXPECT_EQ_BASE(registry.retired() == 0, 0, registry.retired());
+}
+
+static void test_decode_cache()
+{
+    // reference values of xxHash64 with seed 0
+    EXPECT_EQ_BASE(amf0_hash("", 0) == 0xEF46DB3751D8E999ULL, true, false);
+    EXPECT_EQ_BASE(amf0_hash("a", 1) == 0xD24EC4F1A98C6E5BULL, true, false);
+    EXPECT_EQ_BASE(amf0_hash("abc", 3) == 0x44BC2CF5AD770999ULL, true, false);
+
+    SimpleBuffer message;
+    Amf0String name("connect");
+    name.write(&message);
+    Amf0Number txid(1);
+    txid.write(&message);
+    Amf0Object command;
+    command.put("app", new Amf0String("live"));
+    command.put("flashVer", new Amf0String("LNX 9,0,124,2"));
+    command.put("tcUrl", new Amf0String("rtmp://localhost/live"));
+    command.write(&message);
+
+    Amf0DecodeCache cache(2);
+    std::shared_ptr<Amf0Data> first;
+    for (int i = 0; i < 3; ++i) {
+        SimpleBuffer sb;
+        sb.append(message.data(), message.size());
+
+        std::shared_ptr<Amf0Data> s = cache.decode(&sb);
+        std::shared_ptr<Amf0Data> n = cache.decode(&sb);
+        std::shared_ptr<Amf0Data> o = cache.decode(&sb);
+        EXPECT_EQ_BASE(s && s->is_string() && n && n->is_number() && o && o->is_object() && sb.empty(), true, false);
+
+        // every connect shares the first decoded tree
+        if (i == 0)
+            first = o;
+        EXPECT_EQ_BASE(o == first, true, false);
+    }
+
+    Amf0DecodeCacheStats stats = cache.stats();
+    EXPECT_EQ_BASE(stats.hits == 2 && stats.misses == 1 && stats.bypassed == 6 && stats.entries == 1, true, false);
+
+    // a one byte difference is a different value, the oldest is evicted
+    for (int i = 0; i < 2; ++i) {
+        Amf0Object other;
+        other.put("app", new Amf0String(i ? "vod" : "lve"));
+        SimpleBuffer sb;
+        other.write(&sb);
+        std::shared_ptr<Amf0Data> o = cache.decode(&sb);
+        EXPECT_EQ_BASE(o && o != first, true, false);
+    }
+    stats = cache.stats();
+    EXPECT_EQ_BASE(stats.misses == 3 && stats.evictions == 1 && stats.entries == 2, true, false);
+
+    // a truncated object is decoded as without the cache but never kept
+    SimpleBuffer broken;
+    broken.append(message.data(), message.size() - 4);
+    while (!broken.empty() && cache.decode(&broken)) {
+    }
+    EXPECT_EQ_BASE(cache.stats().entries == 2, 2, cache.stats().entries);
+
+    // a miss is kept by the cache, so its tree is not the caller's to free
+    SimpleBuffer deep;
+    for (int i = 0; i < 20; ++i) {
+        deep.write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT);
+        deep.write_2bytes(1);
+        deep.write_string("a");
+    }
+    deep.write_1byte(AMF0_MARKER::AMF0_MARKER_NULL);
+    for (int i = 0; i < 20; ++i) {
+        deep.write_2bytes(0);
+        deep.write_1byte(AMF0_MARKER::AMF0_MARKER_OBJECT_END);
+    }
+
+    Amf0CountingAllocator counting;
+    {
+        SimpleBuffer sb;
+        sb.append(deep.data(), deep.size());
+        Amf0AllocatorScope scope(&counting);
+        EXPECT_EQ_BASE(cache.decode(&sb) != nullptr, true, false);
+    }
+    EXPECT_EQ_BASE(counting.allocations() == 0, 0, counting.allocations());
+
+    // and a hit still answers to the limits of the context
+    Amf0DecodeContext ctx;
+    ctx.max_depth = 4;
+    SimpleBuffer again;
+    again.append(deep.data(), deep.size());
+    EXPECT_EQ_BASE(cache.decode(&again, &ctx) == nullptr, true, false);
+    EXPECT_EQ_BASE(ctx.error == ERROR_AMF0_DEPTH, ERROR_AMF0_DEPTH, ctx.error);
+
+    ctx.max_depth = 0;
+    ctx.max_nodes = 10;
+    again.skip(-again.pos());
+    EXPECT_EQ_BASE(cache.decode(&again, &ctx) == nullptr, true, false);
+    EXPECT_EQ_BASE(ctx.error == ERROR_AMF0_NODES, ERROR_AMF0_NODES, ctx.error);
+
+    ctx.max_nodes = 0;
+    again.skip(-again.pos());
+    uint64_t hits = cache.stats().hits;
+    EXPECT_EQ_BASE(cache.decode(&again, &ctx) != nullptr && ctx.nodes == 21, true, ctx.nodes);
+    EXPECT_EQ_BASE(cache.stats().hits == hits + 1, true, false);
+}
+
+static constexpr auto play_start = amf0_lit_message(
+    amf0_lit_string("onStatus"),
+    amf0_lit_number(0),
+    amf0_lit_null(),
+    amf0_lit_object(
+        amf0_lit_property("level", amf0_lit_string("status")),
+        amf0_lit_property("code", amf0_lit_string("NetStream.Play.Start")),
+        amf0_lit_property("description", amf0_lit_string(""))));
+
+static_assert(play_start.size() == 11 + 9 + 1 + 1 + 16 + 29 + 16 + 3, "literal size");
+static_assert(play_start[0] == AMF0_MARKER::AMF0_MARKER_STRING && play_start[2] == 8, "literal header");
+
+static bool same_bytes(SimpleBuffer &sb, const char *data, int size)
+{
+    return sb.size() == size && memcmp(sb.data(), data, size) == 0;
+}
+
+static void test_literal()
+{
+    SimpleBuffer sb;
+    Amf0String name("onStatus");
+    name.write(&sb);
+    Amf0Number txid(0);
+    txid.write(&sb);
+    Amf0Null null;
+    null.write(&sb);
+    Amf0Object info;
+    info.put("level", new Amf0String("status"));
+    info.put("code", new Amf0String("NetStream.Play.Start"));
+    info.put("description", new Amf0String(""));
+    info.write(&sb);
+    EXPECT_EQ_BASE(same_bytes(sb, play_start.data(), play_start.size()), true, false);
+
+    // numbers are encoded bit for bit like the runtime encoder
+    const double values[] = { 1, -2.5, 3.141592653589793, 44100, 1e300, -1e-300, 0.1, 9007199254740993.0 };
+    constexpr Amf0Literal<9> literals[] = { amf0_lit_number(1), amf0_lit_number(-2.5), amf0_lit_number(3.141592653589793),
+        amf0_lit_number(44100), amf0_lit_number(1e300), amf0_lit_number(-1e-300), amf0_lit_number(0.1), amf0_lit_number(9007199254740993.0) };
+    int matched = 0;
+    for (int i = 0; i < 8; ++i) {
+        SimpleBuffer n;
+        Amf0Number number(values[i]);
+        number.write(&n);
+        matched += same_bytes(n, literals[i].data(), literals[i].size());
+    }
+    EXPECT_EQ_BASE(matched == 8, 8, matched);
+
+    static constexpr auto sample = amf0_lit_message(amf0_lit_string("|RtmpSampleAccess"), amf0_lit_boolean(false), amf0_lit_boolean(false));
+    SimpleBuffer access;
+    Amf0String access_name("|RtmpSampleAccess");
+    access_name.write(&access);
+    Amf0Boolean no(false);
+    no.write(&access);
+    no.write(&access);
+    EXPECT_EQ_BASE(same_bytes(access, sample.data(), sample.size()), true, false);
+
+    static constexpr auto arrays = amf0_lit_ecma_array(
+        amf0_lit_property("list", amf0_lit_strict_array(amf0_lit_number(1), amf0_lit_undefined())));
+    SimpleBuffer decoded;
+    decoded.append(arrays.data(), arrays.size());
+    Amf0Data *value = Amf0Data::create_amf0data(&decoded);
+    Amf0EcmaArray *ecma = dynamic_cast<Amf0EcmaArray *>(value);
+    Amf0StrictArray *list = ecma ? dynamic_cast<Amf0StrictArray *>(ecma->value_at(string("list"))) : nullptr;
+    EXPECT_EQ_BASE(ecma && ecma->count() == 1 && list && list->count() == 2 && decoded.empty(), true, false);
+    delete value;
+}
+
+static void test_lazy_object()
+{
+    Amf0Object command;
+    command.put("app", new Amf0String("live"));
+    command.put("flashVer", new Amf0String("LNX 9,0,124,2"));
+    command.put("tcUrl", new Amf0String("rtmp://localhost/live"));
+    Amf0Object *caps = new Amf0Object();
+    caps->put("audio", new Amf0Number(3575));
+    command.put("caps", caps);
+    command.put("fpad", new Amf0Boolean(false));
+
+    SimpleBuffer encoded;
+    command.write(&encoded);
+    encoded.write_1byte(AMF0_MARKER::AMF0_MARKER_NULL);
+
+    Amf0LazyObject lazy;
+    EXPECT_EQ_BASE(lazy.read(&encoded) == 0, true, false);
+    EXPECT_EQ_BASE(lazy.count() == 5 && lazy.materialized() == 0, true, false);
+    // the value after the object is left for the next read
+    EXPECT_EQ_BASE(encoded.size() - encoded.pos() == 1, true, false);
+
+    Amf0String *app = dynamic_cast<Amf0String *>(lazy.value_at(string("app")));
+    EXPECT_EQ_BASE(app && app->value == "live" && lazy.materialized() == 1, true, false);
+    EXPECT_EQ_BASE(lazy.value_at(string("app")) == app && lazy.materialized() == 1, true, false);
+    EXPECT_EQ_BASE(lazy.value_at(string("missing")) == nullptr && lazy.key_at(3) == "caps", true, false);
+
+    // untouched and unchanged values come out byte for byte
+    SimpleBuffer expected;
+    command.write(&expected);
+    SimpleBuffer out;
+    lazy.write(&out);
+    EXPECT_EQ_BASE(out.to_string() == expected.to_string(), true, false);
+
+    app->value = "vod";
+    lazy.put("objectEncoding", new Amf0Number(0));
+    ((Amf0String *)command.value_at(string("app")))->value = "vod";
+    command.put("objectEncoding", new Amf0Number(0));
+    expected.clear();
+    command.write(&expected);
+    out.clear();
+    lazy.write(&out);
+    EXPECT_EQ_BASE(out.to_string() == expected.to_string(), true, false);
+
+    Amf0Object *decoded_caps = dynamic_cast<Amf0Object *>(lazy.value_at(3));
+    Amf0Number *audio = decoded_caps ? dynamic_cast<Amf0Number *>(decoded_caps->value_at(string("audio"))) : nullptr;
+    EXPECT_EQ_BASE(audio && audio->value == 3575, true, false);
+
+    // a clone shares the decoded values until it changes one
+    Amf0LazyObject *copy = (Amf0LazyObject *)lazy.clone();
+    Amf0Object *copy_caps = dynamic_cast<Amf0Object *>(copy->mutable_value_at(string("caps")));
+    Amf0Number *copy_audio = copy_caps ? dynamic_cast<Amf0Number *>(copy_caps->mutable_value_at(string("audio"))) : nullptr;
+    if (copy_audio)
+        copy_audio->value = 44100;
+    EXPECT_EQ_BASE(copy_audio && copy_caps != decoded_caps && audio->value == 3575, true, false);
+    EXPECT_EQ_BASE(copy->mutable_value_at(string("none")) == nullptr && copy->value_at(0) == lazy.value_at(0), true, false);
+    delete copy;
+
+    // consumers of objects reach a lazy one through its own class
+    EXPECT_EQ_BASE(amf0_equal(&lazy, &command) && amf0_equal(&command, &lazy), true, false);
+    Amf0Frozen *frozen = Amf0Frozen::freeze(&lazy);
+    Amf0FrozenValue root = frozen ? frozen->root() : Amf0FrozenValue();
+    EXPECT_EQ_BASE(root.is_object() && root.count() == 6 && root.value_at(string("app")).string() == "vod", true, root.count());
+    delete frozen;
+
+    // the values must be measured up front, so a cut object fails
+    SimpleBuffer cut;
+    cut.append(expected.data(), expected.size() - 3);
+    EXPECT_EQ_BASE(lazy.read(&cut) != 0 && lazy.count() == 0, true, false);
+}
+
+static void test_fixed_encode()
+{
+    Amf0EcmaArray meta;
+    meta.put("duration", new Amf0Number(120));
+    meta.put("encoder", new Amf0String("a key long enough to skip the small string buffer"));
+    Amf0StrictArray *list = new Amf0StrictArray();
+    list->put(new Amf0Boolean(true));
+    meta.put("list", list);
+
+    SimpleBuffer expected;
+    meta.write(&expected);
+    int size = expected.size();
+
+    // the allocator sees nothing while encoding in place
+    char out[256];
+    Amf0CountingAllocator counting;
+    int written = 0;
+    {
+        Amf0AllocatorScope scope(&counting);
+        written = amf0_encode(&meta, out, sizeof(out));
+    }
+    EXPECT_EQ_BASE(written == size && memcmp(out, expected.data(), size) == 0, true, false);
+    EXPECT_EQ_BASE(counting.allocations() == 0, 0, counting.allocations());
+
+    // too small: the exact size comes back and the bytes past the end
+    // are left alone
+    memset(out, 'x', sizeof(out));
+    EXPECT_EQ_BASE(amf0_encode(&meta, out, size - 1) == size, size, amf0_encode(&meta, out, size - 1));
+    EXPECT_EQ_BASE(out[size - 1] == 'x' && out[size] == 'x', true, false);
+    EXPECT_EQ_BASE(amf0_encode(&meta, out, size) == size && memcmp(out, expected.data(), size) == 0, true, false);
+    EXPECT_EQ_BASE(amf0_encode(&meta, nullptr, 0) == size, size, amf0_encode(&meta, nullptr, 0));
+
+    // counts patched by the writer stay inside the buffer too
+    char small[8];
+    FixedSimpleBuffer fixed(small, sizeof(small));
+    Amf0Writer w(&fixed);
+    w.begin_ecma_array();
+    w.key("k");
+    w.number(1);
+    w.end_ecma_array();
+    EXPECT_EQ_BASE(fixed.overflowed() && fixed.size() == 1 + 4 + 3 + 9 + 3, true, false);
+
+    // a copy takes only the bytes the overflowed buffer really holds
+    SimpleBuffer copy;
+    copy = fixed;
+    EXPECT_EQ_BASE(copy.size() == sizeof(small) && memcmp(copy.data(), small, sizeof(small)) == 0, true, copy.size());
+}
+
+// reassembles one chunked message the way a receiver does, csid < 64
+static bool dechunk(SimpleBuffer &sb, int chunk_size, string &payload, int &length, uint32_t &timestamp)
+{
+    const uint8_t *p = (const uint8_t *)sb.data();
+    int n = sb.size();
+    if (n < 12 || (p[0] >> 6) != 0)
+        return false;
+
+    int csid = p[0] & 0x3f;
+    timestamp = (p[1] << 16) | (p[2] << 8) | p[3];
+    length = (p[4] << 16) | (p[5] << 8) | p[6];
+    int pos = 12;
+    bool extended = timestamp == 0xffffff;
+    if (extended) {
+        timestamp = ((uint32_t)p[12] << 24) | (p[13] << 16) | (p[14] << 8) | p[15];
+        pos += 4;
+    }
+
+    payload.clear();
+    while ((int)payload.size() < length) {
+        if (!payload.empty()) {
+            if (pos >= n || p[pos] != (0xc0 | csid))
+                return false;
+            pos += extended ? 5 : 1;
+        }
+        int take = min(chunk_size, length - (int)payload.size());
+        if (pos + take > n)
+            return false;
+        payload.append((const char *)p + pos, take);
+        pos += take;
+    }
+
+    return pos == n;
+}
+
+static void test_chunked_encode()
+{
+    Amf0String name("connect");
+    Amf0Number txid(1);
+    Amf0Object command;
+    command.put("app", new Amf0String("live"));
+    command.put("tcUrl", new Amf0String(string(300, 'u')));
+    command.put("videoCodecs", new Amf0Number(252));
+
+    SimpleBuffer plain;
+    name.write(&plain);
+    txid.write(&plain);
+    command.write(&plain);
+
+    // every chunk size, so boundaries fall inside numbers, lengths and keys
+    int matched = 0;
+    for (int chunk_size = 1; chunk_size <= 160; ++chunk_size) {
+        ChunkedSimpleBuffer sb(chunk_size);
+        sb.begin_message(3, 1000, RTMP_MSG_AMF0_COMMAND, 0);
+        name.write(&sb);
+        txid.write(&sb);
+        command.write(&sb);
+        sb.end_message();
+
+        string payload;
+        int length = 0;
+        uint32_t timestamp = 0;
+        if (dechunk(sb, chunk_size, payload, length, timestamp) && payload == plain.to_string()
+            && length == plain.size() && sb.payload_size() == length && timestamp == 1000)
+            matched++;
+    }
+    EXPECT_EQ_BASE(matched == 160, 160, matched);
+
+    // counts patched by the writer land in the payload, not the headers,
+    // also with extended timestamps in every chunk header
+    matched = 0;
+    for (int chunk_size = 1; chunk_size <= 20; ++chunk_size) {
+        SimpleBuffer expected;
+        Amf0Writer plain_writer(&expected);
+        plain_writer.begin_ecma_array();
+        plain_writer.key("duration");
+        plain_writer.number(30);
+        plain_writer.end_ecma_array();
+
+        ChunkedSimpleBuffer sb(chunk_size);
+        sb.begin_message(4, 0x1000000, RTMP_MSG_AMF0_DATA, 1);
+        Amf0Writer w(&sb);
+        w.begin_ecma_array();
+        w.key("duration");
+        w.number(30);
+        w.end_ecma_array();
+        sb.end_message();
+
+        string payload;
+        int length = 0;
+        uint32_t timestamp = 0;
+        if (dechunk(sb, chunk_size, payload, length, timestamp) && payload == expected.to_string() && timestamp == 0x1000000)
+            matched++;
+    }
+    EXPECT_EQ_BASE(matched == 20, 20, matched);
+}
+
+static void write_connect(SimpleBuffer *sb, const char *app, double caps, const char *extra_key)
+{
+    Amf0Object command;
+    command.put("app", new Amf0String(app));
+    command.put("flashVer", new Amf0String("LNX 9,0,124,2"));
+    command.put("fpad", new Amf0Boolean(false));
+    command.put("capabilities", new Amf0Number(caps));
+    command.put(extra_key, new Amf0Null());
+    command.write(sb);
+}
+
+static void test_shape_decoder()
+{
+    Amf0ShapeDecoder decoder;
+
+    SimpleBuffer sb;
+    write_connect(&sb, "live", 15, "pageUrl");
+    write_connect(&sb, "vod/longer/app", 239, "pageUrl");
+    write_connect(&sb, "live", 15, "swfUrl");
+    Amf0Number txid(1);
+    txid.write(&sb);
+
+    Amf0Object *first = dynamic_cast<Amf0Object *>(decoder.decode(&sb));
+    EXPECT_EQ_BASE(first && decoder.misses() == 1 && decoder.shapes() == 1, true, false);
+
+    // same skeleton: the kept tree is refilled in place
+    Amf0Object *second = dynamic_cast<Amf0Object *>(decoder.decode(&sb));
+    Amf0String *app = second ? dynamic_cast<Amf0String *>(second->value_at(string("app"))) : nullptr;
+    Amf0Number *caps = second ? dynamic_cast<Amf0Number *>(second->value_at(string("capabilities"))) : nullptr;
+    EXPECT_EQ_BASE(second == first && decoder.hits() == 1, true, false);
+    EXPECT_EQ_BASE(app && app->value == "vod/longer/app" && caps && caps->value == 239, true, false);
+
+    // a different key is a different shape
+    Amf0Object *third = dynamic_cast<Amf0Object *>(decoder.decode(&sb));
+    EXPECT_EQ_BASE(third && third->value_at(string("swfUrl")) && decoder.misses() == 2 && decoder.shapes() == 2, true, false);
+
+    Amf0Number *number = dynamic_cast<Amf0Number *>(decoder.decode(&sb));
+    EXPECT_EQ_BASE(number && number->value == 1 && sb.empty(), true, false);
+
+    // nested containers are not learned, a cut message fails as usual
+    SimpleBuffer nested;
+    Amf0Object outer;
+    outer.put("inner", new Amf0Object());
+    outer.write(&nested);
+    outer.write(&nested);
+    decoder.decode(&nested);
+    EXPECT_EQ_BASE(decoder.decode(&nested) != nullptr && decoder.shapes() == 2 && decoder.hits() == 1, true, false);
+
+    SimpleBuffer cut;
+    write_connect(&cut, "live", 15, "pageUrl");
+    SimpleBuffer truncated;
+    truncated.append(cut.data(), 20);
+    EXPECT_EQ_BASE(decoder.decode(&truncated) == nullptr, true, false);
+
+    // a clone of a result keeps its values over the next hit
+    Amf0ShapeDecoder kept;
+    SimpleBuffer twice;
+    write_connect(&twice, "live", 15, "pageUrl");
+    write_connect(&twice, "vod", 31, "pageUrl");
+    Amf0Data *copy = kept.decode(&twice)->clone();
+    Amf0Object *hit = dynamic_cast<Amf0Object *>(kept.decode(&twice));
+    Amf0String *was = dynamic_cast<Amf0String *>(((Amf0Object *)copy)->value_at(string("app")));
+    Amf0String *now = hit ? dynamic_cast<Amf0String *>(hit->value_at(string("app"))) : nullptr;
+    EXPECT_EQ_BASE(kept.hits() == 1 && was && was->value == "live" && now && now->value == "vod", true, false);
+    delete copy;
+
+    // the learned tree does not live in the caller's allocator
+    Amf0ShapeDecoder pooled;
+    SimpleBuffer first_pool;
+    write_connect(&first_pool, "live", 15, "pageUrl");
+    Amf0CountingAllocator pool_upstream;
+    {
+        Amf0PoolAllocator pool(&pool_upstream, 4096);
+        Amf0AllocatorScope scope(&pool);
+        pooled.decode(&first_pool);
+    }
+    EXPECT_EQ_BASE(pool_upstream.allocations() == 0, 0, pool_upstream.allocations());
+    SimpleBuffer second_pool;
+    write_connect(&second_pool, "vod", 31, "pageUrl");
+    Amf0Object *refilled = dynamic_cast<Amf0Object *>(pooled.decode(&second_pool));
+    Amf0Number *refilled_caps = refilled ? dynamic_cast<Amf0Number *>(refilled->value_at(string("capabilities"))) : nullptr;
+    EXPECT_EQ_BASE(pooled.hits() == 1 && refilled_caps && refilled_caps->value == 31, true, false);
+}
+
+static void test_clone()
+{
+    Amf0EcmaArray meta;
+    meta.put("duration", new Amf0Number(60));
+    meta.put("server", new Amf0String("origin"));
+    Amf0Object *video = new Amf0Object();
+    video->put("codec", new Amf0String("avc1"));
+    video->put("width", new Amf0Number(1280));
+    meta.put("video", video);
+    Amf0StrictArray *list = new Amf0StrictArray();
+    for (int i = 0; i < 1000; ++i) {
+        list->put(new Amf0Number(i));
+    }
+    meta.put("times", list);
+
+    SimpleBuffer original;
+    meta.write(&original);
+
+    // a variant allocates per level it changes, not per node it holds
+    Amf0CountingAllocator counting;
+    Amf0EcmaArray *variant = nullptr;
+    {
+        Amf0AllocatorScope scope(&counting);
+        variant = (Amf0EcmaArray *)meta.clone();
+        variant->put("server", new Amf0String("edge-7"));
+        Amf0Object *v = (Amf0Object *)variant->mutable_value_at(string("video"));
+        ((Amf0Number *)v->mutable_value_at(string("width")))->value = 640;
+    }
+    EXPECT_EQ_BASE(counting.allocations() < 20, true, counting.allocations());
+
+    SimpleBuffer after;
+    meta.write(&after);
+    EXPECT_EQ_BASE(after.to_string() == original.to_string(), true, false);
+
+    // untouched subtrees are the same nodes, the changed path is not
+    EXPECT_EQ_BASE(variant->value_at(string("times")) == list, true, false);
+    EXPECT_EQ_BASE(variant->value_at(string("video")) != video, true, false);
+    Amf0Object *vvideo = (Amf0Object *)variant->value_at(string("video"));
+    EXPECT_EQ_BASE(vvideo->value_at(string("codec")) == video->value_at(string("codec")), true, false);
+    EXPECT_EQ_BASE(((Amf0Number *)vvideo->value_at(string("width")))->value == 640, true, false);
+    EXPECT_EQ_BASE(((Amf0String *)variant->value_at(string("server")))->value == "edge-7", true, false);
+    EXPECT_EQ_BASE(((Amf0Number *)video->value_at(string("width")))->value == 1280, true, false);
+
+    // once a node is owned by one tree alone it is changed in place
+    Amf0Data *width = vvideo->mutable_value_at(string("width"));
+    EXPECT_EQ_BASE(vvideo->mutable_value_at(string("width")) == width && vvideo->mutable_value_at(string("none")) == nullptr, true, false);
+
+    // the original outlives nothing it shares
+    delete variant;
+    SimpleBuffer last;
+    meta.write(&last);
+    EXPECT_EQ_BASE(last.to_string() == original.to_string(), true, false);
+}
+
+static void test_buffer_pool()
+{
+    Amf0Object status;
+    status.put("level", new Amf0String("status"));
+    status.put("code", new Amf0String("NetStream.Play.Start"));
+    status.put("description", new Amf0String("Started playing stream."));
+
+    Amf0BufferPoolStats before;
+    amf0_buffer_pool_stats(&before);
+
+    // warm up once, after that encoding allocates nothing
+    {
+        Amf0PooledBuffer sb;
+        status.write(sb.get());
+    }
+    Amf0CountingAllocator counting;
+    int size = 0;
+    {
+        Amf0AllocatorScope scope(&counting);
+        for (int i = 0; i < 1000; ++i) {
+            Amf0PooledBuffer sb;
+            status.write(sb.get());
+            size += sb->size();
+        }
+    }
+    EXPECT_EQ_BASE(size == 88 * 1000, 88 * 1000, size);
+    EXPECT_EQ_BASE((int)counting.allocations() == 0, 0, (int)counting.allocations());
+
+    Amf0BufferPoolStats after;
+    amf0_buffer_pool_stats(&after);
+    EXPECT_EQ_BASE((int)(after.acquires - before.acquires) == 1001, 1001, (int)(after.acquires - before.acquires));
+    EXPECT_EQ_BASE(after.hits - before.hits >= 1000, true, false);
+    EXPECT_EQ_BASE(after.retained_bytes >= 256 && after.retained_buffers >= 1, true, false);
+
+    // one huge message is freed on release instead of pinning memory
+    SimpleBuffer *huge = amf0_buffer_acquire(4 * 1024 * 1024);
+    EXPECT_EQ_BASE(huge->capacity() >= 4 * 1024 * 1024, true, false);
+    amf0_buffer_release(huge);
+    amf0_buffer_pool_stats(&after);
+    EXPECT_EQ_BASE((int)(after.dropped - before.dropped) == 1, 1, (int)(after.dropped - before.dropped));
+    EXPECT_EQ_BASE(after.retained_bytes < 4 * 1024 * 1024, true, false);
+
+    // a buffer grown past its class is filed under the larger class
+    SimpleBuffer *grown = amf0_buffer_acquire(100);
+    grown->append(string(3000, 'x').data(), 3000);
+    int capacity = grown->capacity();
+    amf0_buffer_release(grown);
+    SimpleBuffer *again = amf0_buffer_acquire(2048);
+    EXPECT_EQ_BASE(again == grown && again->size() == 0 && again->capacity() == capacity, true, false);
+
+    // storage the pool keeps never comes from the caller's scope, neither
+    // on a miss nor when a write grows it
+    {
+        Amf0AllocatorScope scope(&counting);
+        SimpleBuffer *fresh = amf0_buffer_acquire(300 * 1024);
+        fresh->append(string(600 * 1024, 'x').data(), 600 * 1024);
+        amf0_buffer_release(fresh);
+    }
+    EXPECT_EQ_BASE((int)counting.allocations() == 0, 0, (int)counting.allocations());
+
+    // released on another thread, it goes back to the thread it came from
+    amf0_buffer_pool_stats(&before);
+    std::thread io([again]() { amf0_buffer_release(again); });
+    io.join();
+    amf0_buffer_pool_stats(&after);
+    EXPECT_EQ_BASE((int)(after.remote_releases - before.remote_releases) == 1, 1, (int)(after.remote_releases - before.remote_releases));
+    EXPECT_EQ_BASE(amf0_buffer_acquire(2048) == again, true, false);
+
+    // or stays with the releasing thread when remote return is off
+    amf0_buffer_pool_set_remote_return(false);
+    std::thread adopt([again]() {
+        amf0_buffer_release(again);
+        EXPECT_EQ_BASE(amf0_buffer_acquire(2048) == again, true, false);
+        amf0_buffer_release(again);
+    });
+    adopt.join();
+    amf0_buffer_pool_set_remote_return(true);
+    amf0_buffer_pool_stats(&after);
+    EXPECT_EQ_BASE((int)(after.remote_releases - before.remote_releases) == 1, 1, (int)(after.remote_releases - before.remote_releases));
+}
+
+// applies the events of a shared object message to a copy of so
+static Amf0EcmaArray *apply_events(Amf0EcmaArray *so, SimpleBuffer *events)
+{
+    Amf0EcmaArray *result = new Amf0EcmaArray();
+    for (int i = 0; i < so->count(); ++i) {
+        result->put(so->key_at(i), so->value_at(i)->clone());
+    }
+
+    while (!events->empty()) {
+        int type = events->read_1byte();
+        int end = events->pos() + 4 + events->read_4bytes();
+        std::string key = events->read_string(events->read_2bytes());
+        if (type == RTMP_SO_EVENT_CHANGE) {
+            result->put(key, Amf0Data::create_amf0data(events));
+        } else {
+            // no remove on arrays, rebuild without the key
+            Amf0EcmaArray *rest = new Amf0EcmaArray();
+            for (int j = 0; j < result->count(); ++j) {
+                if (result->key_at(j) != key) {
+                    rest->put(result->key_at(j), result->value_at(j)->clone());
+                }
+            }
+            delete result;
+            result = rest;
+        }
+        EXPECT_EQ_BASE(events->pos() == end, end, events->pos());
+    }
+    return result;
+}
+
+static void test_diff()
+{
+    Amf0EcmaArray v1;
+    for (int i = 0; i < 200; ++i) {
+        v1.put("player" + std::to_string(i), new Amf0Number(i));
+    }
+    Amf0Object *room = new Amf0Object();
+    room->put("name", new Amf0String("lobby"));
+    room->put("open", new Amf0Boolean(true));
+    v1.put("room", room);
+
+    Amf0Diff diff;
+    EXPECT_EQ_BASE(diff.diff(&v1, &v1) == 0 && diff.empty(), true, false);
+    Amf0Number scalar(1);
+    EXPECT_EQ_BASE(diff.diff(&v1, &scalar) != 0, true, false);
+
+    // a clone with two changes diffs to two events
+    Amf0EcmaArray *v2 = (Amf0EcmaArray *)v1.clone();
+    ((Amf0Number *)v2->mutable_value_at(string("player7")))->value = 700;
+    ((Amf0Boolean *)((Amf0Object *)v2->mutable_value_at(string("room")))->mutable_value_at(string("open")))->value = false;
+    EXPECT_EQ_BASE(diff.diff(&v1, v2) == 0 && diff.changes().size() == 2, true, diff.changes().size());
+    EXPECT_EQ_STRING("player7", diff.changes()[0].key);
+    EXPECT_EQ_STRING("room", diff.changes()[1].key);
+
+    SimpleBuffer events;
+    diff.write(&events);
+    SimpleBuffer full;
+    v2->write(&full);
+    EXPECT_EQ_BASE(events.size() * 20 < full.size(), true, events.size());
+
+    // put() moves a changed key to the end, so compare key by key
+    Amf0EcmaArray *applied = apply_events(&v1, &events);
+    bool same = applied->count() == v2->count();
+    for (int i = 0; same && i < v2->count(); ++i) {
+        same = amf0_equal(applied->value_at(v2->key_at(i)), v2->value_at(i));
+    }
+    EXPECT_EQ_BASE(same, true, false);
+    delete applied;
+
+    // removals, additions and a reorder built from scratch
+    Amf0EcmaArray v3;
+    for (int i = 199; i >= 1; --i) {
+        v3.put("player" + std::to_string(i), new Amf0Number(i));
+    }
+    v3.put("room", v1.value_at(string("room"))->clone());
+    v3.put("player200", new Amf0Number(200));
+    EXPECT_EQ_BASE(diff.diff(&v1, &v3) == 0 && diff.changes().size() == 2, true, diff.changes().size());
+    EXPECT_EQ_BASE(diff.changes()[0].key == "player200" && diff.changes()[0].value != nullptr, true, false);
+    EXPECT_EQ_BASE(diff.changes()[1].key == "player0" && diff.changes()[1].value == nullptr, true, false);
+
+    SimpleBuffer removal;
+    diff.write(&removal);
+    const char remove_event[] = { RTMP_SO_EVENT_REMOVE, 0, 0, 0, 9, 0, 7, 'p', 'l', 'a', 'y', 'e', 'r', '0' };
+    EXPECT_EQ_BASE(removal.size() >= 14 && memcmp(removal.data() + removal.size() - 14, remove_event, 14) == 0, true, false);
+
+    // from nothing every property is a change
+    EXPECT_EQ_BASE(diff.diff(nullptr, &v1) == 0 && diff.changes().size() == 201, true, diff.changes().size());
+    delete v2;
+}
+
+static void test_capture()
+{
+    const char *path = "amf0_test.cap";
+
+    Amf0CaptureWriter *writer = Amf0CaptureWriter::open(path);
+    EXPECT_EQ_BASE(writer != nullptr, true, false);
+    SimpleBuffer sb;
+    Amf0String("onStatus").write(&sb);
+    Amf0Null().write(&sb);
+    EXPECT_EQ_BASE(writer->write(RTMP_MSG_AMF0_COMMAND, sb.data(), sb.size()) == 0, true, false);
+    EXPECT_EQ_BASE(writer->write(RTMP_MSG_AMF0_DATA, nullptr, 0) == 0, true, false);
+    EXPECT_EQ_BASE(writer->close() == 0, true, false);
+    delete writer;
+
+    Amf0CaptureReader *reader = Amf0CaptureReader::open(path);
+    EXPECT_EQ_BASE(reader != nullptr && reader->size() == (uint64_t)(8 + 5 + sb.size() + 5), true, false);
+    Amf0CaptureMessage message;
+    EXPECT_EQ_BASE(reader->next(message) && message.type == RTMP_MSG_AMF0_COMMAND, true, false);
+    EXPECT_EQ_BASE(message.size == (uint32_t)sb.size() && memcmp(message.data, sb.data(), sb.size()) == 0, true, false);
+    EXPECT_EQ_BASE(reader->next(message) && message.type == RTMP_MSG_AMF0_DATA && message.size == 0, true, false);
+    EXPECT_EQ_BASE(!reader->next(message) && !reader->truncated(), true, false);
+    reader->rewind();
+    EXPECT_EQ_BASE(reader->next(message) && message.type == RTMP_MSG_AMF0_COMMAND, true, false);
+    delete reader;
+
+    // a record cut short ends the walk and is reported
+    FILE *fp = fopen(path, "ab");
+    fwrite("\x00\x00\x01\x00\x12xyz", 8, 1, fp);
+    fclose(fp);
+    reader = Amf0CaptureReader::open(path);
+    int n = 0;
+    while (reader->next(message)) {
+        n++;
+    }
+    EXPECT_EQ_BASE(n == 2 && reader->truncated(), true, n);
+    delete reader;
+
+    remove(path);
+    EXPECT_EQ_BASE(Amf0CaptureReader::open(path) == nullptr, true, false);
+}
+
+static void test_trace()
+{
+    string json;
+    if (!amf0_trace_enabled()) {
+        amf0_trace_json(json);
+        EXPECT_EQ_STRING("{\"traceEvents\":[]}", json);
+        return;
+    }
+
+    Amf0Object status;
+    status.put("code", new Amf0String("NetStream.Play.Start"));
+    status.put("level", new Amf0String("status"));
+
+    amf0_trace_reset();
+    SimpleBuffer sb;
+    status.write(&sb);
+    Amf0Data *value = Amf0Data::create_amf0data(&sb);
+    EXPECT_EQ_BASE(value != nullptr, true, false);
+    delete value;
+
+    // spans nest by thread, the growth shows the capacity it grew to
+    amf0_trace_json(json);
+    EXPECT_EQ_BASE(json.find("\"name\":\"Amf0Object::write\",\"ph\":\"B\"") != string::npos, true, false);
+    EXPECT_EQ_BASE(json.find("\"name\":\"SimpleBuffer::grow\",\"ph\":\"B\"") != string::npos, true, false);
+    EXPECT_EQ_BASE(json.find("\"args\":{\"value\":256}") != string::npos, true, false);
+    EXPECT_EQ_BASE(json.find("\"name\":\"create_amf0data\",\"ph\":\"E\"") != string::npos, true, false);
+    EXPECT_EQ_BASE(json.find("\"name\":\"Amf0String::read\",\"ph\":\"B\"") != string::npos, true, false);
+    EXPECT_EQ_BASE(json.find("Amf0ObjectProperty::put") != string::npos, true, false);
+
+    int begins = 0, ends = 0;
+    for (size_t p = json.find("\"ph\":\"B\""); p != string::npos; p = json.find("\"ph\":\"B\"", p + 1)) {
+        begins++;
+    }
+    for (size_t p = json.find("\"ph\":\"E\""); p != string::npos; p = json.find("\"ph\":\"E\"", p + 1)) {
+        ends++;
+    }
+    EXPECT_EQ_BASE(begins == ends && begins > 10, true, begins);
+
+    amf0_trace_reset();
+    amf0_trace_json(json);
+    EXPECT_EQ_BASE(json.find("create_amf0data") == string::npos, true, false);
+
+    // threads coming one after the other share the ring of the first
+    for (int i = 0; i < 20; ++i) {
+        std::thread t([]() { AMF0_TRACE_INSTANT("test_trace", 1); });
+        t.join();
+    }
+    amf0_trace_json(json);
+    int instants = 0;
+    string tid;
+    bool same = true;
+    for (size_t p = json.find("\"name\":\"test_trace\""); p != string::npos; p = json.find("\"name\":\"test_trace\"", p + 1)) {
+        size_t at = json.find("\"tid\":", p);
+        string t = json.substr(at, json.find_first_of(",}", at) - at);
+        same = same && (tid.empty() || t == tid);
+        tid = t;
+        instants++;
+    }
+    EXPECT_EQ_BASE(instants == 20 && same, true, instants);
 }
 
 int main()
 {
     test_parse();
+    test_batch();
+    test_utf8();
+    test_key_lookup();
+    test_dtoa();
+    test_json();
+    test_stats();
+    test_allocator();
+    test_inline_buffer();
+    test_writer();
+    test_decode_limits();
+    test_frozen();
+    test_catalog();
+    test_flv();
+    test_registry();
+    test_decode_cache();
+    test_literal();
+    test_lazy_object();
+    test_fixed_encode();
+    test_chunked_encode();
+    test_shape_decoder();
+    test_clone();
+    test_buffer_pool();
+    test_diff();
+    test_capture();
+    test_trace();
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
     return main_ret;
 }